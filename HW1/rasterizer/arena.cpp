@@ -0,0 +1,46 @@
+#include "arena.hpp"
+
+#include <algorithm>
+
+Arena::Arena(size_t blockSize)
+    : blockSize(std::max<size_t>(blockSize, 64)) {}
+
+void* Arena::Allocate(size_t bytes, size_t alignment) {
+    while (true) {
+        if (this->current < this->blocks.size()) {
+            Block& block = this->blocks[this->current];
+            uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+            uintptr_t start = (base + this->offset + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+            size_t end = start - base + bytes;
+            if (end <= block.size) {
+                this->used += end - this->offset;
+                this->peak = std::max(this->peak, this->used);
+                this->offset = end;
+                return reinterpret_cast<void*>(start);
+            }
+            // the rest of this block is wasted until the next Reset
+            this->used += block.size - this->offset;
+            ++this->current;
+            this->offset = 0;
+            continue;
+        }
+        size_t size = std::max(this->blockSize, bytes + alignment);
+        this->blocks.push_back({ std::make_unique<std::byte[]>(size), size });
+    }
+}
+
+void Arena::Reset() {
+    this->current = 0;
+    this->offset = 0;
+    this->used = 0;
+    this->peak = 0;
+}
+
+Arena& FrameArena::Local() {
+    thread_local Arena arena;
+    return arena;
+}
+
+void FrameArena::Reset() {
+    FrameArena::Local().Reset();
+}
@@ -0,0 +1,65 @@
+// Bump allocators for data that only lives for one frame
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+class Arena {
+public:
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 1 << 20;
+
+    Arena(size_t blockSize = DEFAULT_BLOCK_SIZE);
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* Allocate(size_t bytes, size_t alignment = alignof(std::max_align_t));
+
+    // Storage for `count` objects; only types without destructors may live in an arena since nothing is destroyed
+    //     on Reset
+    template <typename T>
+    std::span<T> AllocateArray(size_t count) {
+        static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+        T* data = static_cast<T*>(this->Allocate(count * sizeof(T), alignof(T)));
+        std::uninitialized_default_construct_n(data, count);
+        return { data, count };
+    }
+
+    // Rewind to the first block and start a new peak; blocks are kept for the next frame, so this is O(1)
+    void Reset();
+
+    inline size_t GetUsedBytes() const { return this->used; }
+    // Highest usage since the last Reset
+    inline size_t GetPeakBytes() const { return this->peak; }
+
+private:
+    struct Block {
+        std::unique_ptr<std::byte[]> data;
+        size_t size;
+    };
+
+    size_t blockSize;
+    std::vector<Block> blocks;
+    size_t current = 0;   // index of the block being bumped
+    size_t offset = 0;    // first free byte in the current block
+    size_t used = 0;
+    size_t peak = 0;
+};
+
+// Per-frame arena made of one sub-arena per thread, so that worker threads never contend on allocation. A frame
+//     belongs to the thread that renders it, so several threads can render frames at once (see render_server.hpp).
+class FrameArena {
+public:
+    // The calling thread's sub-arena
+    static Arena& Local();
+
+    // End the calling thread's frame, rewinding its sub-arena; the other threads' frames are not affected
+    static void Reset();
+};
+
+#endif
@@ -0,0 +1,83 @@
+#include "async_writer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <iostream>
+
+AsyncWriter::AsyncWriter(uint32_t threads, size_t maxPendingBytes)
+    : maxPendingBytes(maxPendingBytes) {
+    for (uint32_t i = 0; i < std::max(1u, threads); ++i) this->workers.emplace_back(&AsyncWriter::Work, this);
+}
+
+AsyncWriter::~AsyncWriter() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->jobReady.notify_all();
+    // workers drain the queue before they exit
+    for (std::thread& worker : this->workers) worker.join();
+}
+
+size_t AsyncWriter::Enqueue(Job job) {
+    auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->jobDone.wait(lock, [&] {
+        return this->pendingBytes == 0 || this->pendingBytes + job.bytes <= this->maxPendingBytes;
+    });
+    this->stats.blockedMs
+      += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    const size_t depth = this->jobs.size() + this->inFlight;
+    this->stats.maxQueueDepth = std::max(this->stats.maxQueueDepth, depth + 1);
+    this->pendingBytes += job.bytes;
+    this->jobs.push_back(std::move(job));
+    lock.unlock();
+    this->jobReady.notify_one();
+    return depth;
+}
+
+void AsyncWriter::Flush() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->jobDone.wait(lock, [this] { return this->jobs.empty() && this->inFlight == 0; });
+}
+
+WriterStats AsyncWriter::GetStats() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->stats;
+}
+
+void AsyncWriter::Work() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        this->jobReady.wait(lock, [this] { return this->stopping || !this->jobs.empty(); });
+        if (this->jobs.empty()) return;   // stopping with nothing left to write
+
+        Job job = std::move(this->jobs.front());
+        this->jobs.pop_front();
+        ++this->inFlight;
+        lock.unlock();
+
+        auto start = std::chrono::steady_clock::now();
+        bool written = false;
+        try {
+            written = job.write();
+        } catch (const std::exception& e) {
+            std::cerr << std::string("Writing an image failed: ") + e.what() + "\n";
+        }
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        job.write = nullptr;   // release the frame before making its bytes available again
+
+        lock.lock();
+        --this->inFlight;
+        this->pendingBytes -= job.bytes;
+        if (written)
+            ++this->stats.imagesWritten;
+        else
+            ++this->stats.imagesFailed;
+        this->stats.encodeMs += ms;
+        this->stats.maxEncodeMs = std::max(this->stats.maxEncodeMs, ms);
+        this->jobDone.notify_all();
+    }
+}
@@ -0,0 +1,81 @@
+// Background encoding of finished frames, so that the renderer can start on the next job while the last one is
+//     still being compressed and written to disk
+
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "frame_stream.hpp"
+#include "image.hpp"
+#include "stats.hpp"
+
+// PNG encoding is already spread over all cores, so one thread is enough to keep a frame in flight; it also keeps
+//     streamed frames in submission order
+constexpr uint32_t ASYNC_WRITER_THREADS = 1;
+// Frames queued beyond this many bytes make the renderer wait, so a fast renderer cannot pile up memory
+constexpr size_t ASYNC_WRITER_BYTES = size_t(256) << 20;
+
+class AsyncWriter {
+public:
+    explicit AsyncWriter(uint32_t threads = ASYNC_WRITER_THREADS, size_t maxPendingBytes = ASYNC_WRITER_BYTES);
+    AsyncWriter(const AsyncWriter&) = delete;
+    AsyncWriter& operator=(const AsyncWriter&) = delete;
+    ~AsyncWriter();   // writes out whatever is still queued
+
+    // Take over `image` and write it with `options` in the background. Waits while the queued frames hold more than
+    //     the byte budget (a frame larger than the budget is still accepted once the queue is empty). Returns the
+    //     number of frames that were still queued or being written when this one was handed over.
+    template <typename T>
+    size_t Submit(ImageBuffer<T>&& image, const WriteOptions& options) {
+        const size_t bytes = static_cast<size_t>(image.GetWidth()) * image.GetHeight() * sizeof(T);
+        // shared_ptr keeps the job copyable for std::function without ever copying the pixels
+        auto owned = std::make_shared<ImageBuffer<T>>(std::move(image));
+        return this->Enqueue({ [owned, options] { return owned->Write(options); }, bytes });
+    }
+
+    // Same, but send the frame to `stream` instead of a file; `stream` must outlive the job
+    template <typename T>
+    size_t Submit(ImageBuffer<T>&& image, FrameStream& stream) {
+        const size_t bytes = static_cast<size_t>(image.GetWidth()) * image.GetHeight() * sizeof(T);
+        auto owned = std::make_shared<ImageBuffer<T>>(std::move(image));
+        return this->Enqueue({ [owned, &stream] { return stream.Send(*owned); }, bytes });
+    }
+
+    // Block until every submitted frame is on disk
+    void Flush();
+
+    WriterStats GetStats() const;
+
+private:
+    struct Job {
+        std::function<bool()> write;   // false when the frame did not reach its file or stream
+        size_t bytes;
+    };
+
+    size_t Enqueue(Job job);
+    void Work();
+
+    size_t maxPendingBytes;
+
+    mutable std::mutex mutex;
+    std::condition_variable jobReady;   // workers wait for jobs or shutdown
+    std::condition_variable jobDone;    // Submit waits for room, Flush for an empty queue
+    std::deque<Job> jobs;
+    size_t pendingBytes = 0;   // queued or being written
+    size_t inFlight = 0;       // jobs taken by a worker but not finished
+    bool stopping = false;
+    WriterStats stats;
+
+    std::vector<std::thread> workers;
+};
+
+#endif
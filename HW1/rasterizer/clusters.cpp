@@ -0,0 +1,171 @@
+#include "clusters.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "../thirdparty/tinyobj/tiny_obj_loader.h"
+
+ShapeClusters BuildClusters(const tinyobj::shape_t& shape, const tinyobj::attrib_t& attribs, uint32_t maxTriangles) {
+    ShapeClusters result;
+    const uint32_t faceCount = static_cast<uint32_t>(shape.mesh.num_face_vertices.size());
+    if (faceCount == 0 || maxTriangles == 0) return result;
+
+    auto position = [&](size_t corner) {
+        const float* p = &attribs.vertices[3 * size_t(shape.mesh.indices[corner].vertex_index)];
+        return glm::vec3(p[0], p[1], p[2]);
+    };
+    std::vector<glm::vec3> centroids(faceCount), normals(faceCount);
+    for (uint32_t f = 0; f < faceCount; ++f) {
+        const glm::vec3 a = position(3 * f), b = position(3 * f + 1), c = position(3 * f + 2);
+        centroids[f] = (a + b + c) / 3.f;
+        const glm::vec3 n = glm::cross(b - a, c - a);
+        const float length = glm::length(n);
+        // degenerate faces cover no pixel and do not constrain the cone
+        normals[f] = length > 0.f ? n / length : glm::vec3(0.f);
+    }
+
+    // faces around each vertex, for growing clusters over shared vertices
+    const size_t vertexCount = attribs.vertices.size() / 3;
+    std::vector<uint32_t> vertexStart(vertexCount + 1, 0);
+    for (size_t corner = 0; corner < 3 * size_t(faceCount); ++corner)
+        ++vertexStart[shape.mesh.indices[corner].vertex_index + 1];
+    for (size_t v = 0; v < vertexCount; ++v) vertexStart[v + 1] += vertexStart[v];
+    std::vector<uint32_t> vertexFaces(3 * size_t(faceCount));
+    {
+        std::vector<uint32_t> fill(vertexStart.begin(), vertexStart.end() - 1);
+        for (size_t corner = 0; corner < 3 * size_t(faceCount); ++corner)
+            vertexFaces[fill[shape.mesh.indices[corner].vertex_index]++] = static_cast<uint32_t>(corner / 3);
+    }
+
+    constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+    std::vector<bool> assigned(faceCount, false);
+    std::vector<uint32_t> queuedFor(faceCount, NONE);   // cluster whose frontier last took the face
+    std::vector<uint32_t> frontier;
+    result.faces.reserve(faceCount);
+    uint32_t nextSeed = 0;
+
+    while (result.faces.size() < faceCount) {
+        const uint32_t id = static_cast<uint32_t>(result.clusters.size());
+        Cluster& cluster = result.clusters.emplace_back();
+        cluster.firstFace = static_cast<uint32_t>(result.faces.size());
+
+        // continue next to the previous cluster when it left faces behind, so that neighbors stay close in order
+        uint32_t seed = NONE;
+        for (const uint32_t f : frontier)
+            if (!assigned[f]) {
+                seed = f;
+                break;
+            }
+        if (seed == NONE) {
+            while (assigned[nextSeed]) ++nextSeed;
+            seed = nextSeed;
+        }
+        frontier.clear();
+
+        glm::vec3 centroidSum(0.f);
+        auto add = [&](uint32_t f) {
+            assigned[f] = true;
+            result.faces.push_back(f);
+            centroidSum += centroids[f];
+            for (uint32_t v = 0; v < 3; ++v) {
+                const int vertex = shape.mesh.indices[3 * size_t(f) + v].vertex_index;
+                for (uint32_t i = vertexStart[vertex]; i < vertexStart[vertex + 1]; ++i) {
+                    const uint32_t neighbor = vertexFaces[i];
+                    if (assigned[neighbor] || queuedFor[neighbor] == id) continue;
+                    queuedFor[neighbor] = id;
+                    frontier.push_back(neighbor);
+                }
+            }
+        };
+        add(seed);
+        while (result.faces.size() - cluster.firstFace < maxTriangles) {
+            // the frontier face closest to the centroid keeps the cluster round
+            const glm::vec3 centroid = centroidSum / static_cast<float>(result.faces.size() - cluster.firstFace);
+            size_t best = frontier.size();
+            float bestDistance = std::numeric_limits<float>::infinity();
+            for (size_t i = 0; i < frontier.size(); ++i) {
+                const glm::vec3 offset = centroids[frontier[i]] - centroid;
+                const float distance = glm::dot(offset, offset);
+                if (distance < bestDistance) {
+                    best = i;
+                    bestDistance = distance;
+                }
+            }
+            if (best == frontier.size()) break;   // a piece of the mesh with no more faces
+            const uint32_t f = frontier[best];
+            frontier[best] = frontier.back();
+            frontier.pop_back();
+            add(f);
+        }
+        cluster.faceCount = static_cast<uint32_t>(result.faces.size()) - cluster.firstFace;
+
+        // bounds, sphere and normal cone
+        constexpr float FAR = std::numeric_limits<float>::infinity();
+        cluster.boundsMin = glm::vec3(FAR);
+        cluster.boundsMax = glm::vec3(-FAR);
+        glm::vec3 normalSum(0.f);
+        for (uint32_t i = cluster.firstFace; i < cluster.firstFace + cluster.faceCount; ++i) {
+            for (uint32_t v = 0; v < 3; ++v) {
+                const glm::vec3 p = position(3 * size_t(result.faces[i]) + v);
+                cluster.boundsMin = glm::min(cluster.boundsMin, p);
+                cluster.boundsMax = glm::max(cluster.boundsMax, p);
+            }
+            normalSum += normals[result.faces[i]];
+        }
+        cluster.center = (cluster.boundsMin + cluster.boundsMax) * 0.5f;
+        float minCos = 1.f;
+        const float sumLength = glm::length(normalSum);
+        cluster.coneAxis = sumLength > 0.f ? normalSum / sumLength : glm::vec3(0.f);
+        for (uint32_t i = cluster.firstFace; i < cluster.firstFace + cluster.faceCount; ++i) {
+            for (uint32_t v = 0; v < 3; ++v) {
+                const glm::vec3 offset = position(3 * size_t(result.faces[i]) + v) - cluster.center;
+                cluster.radius = std::max(cluster.radius, glm::length(offset));
+            }
+            if (normals[result.faces[i]] != glm::vec3(0.f))
+                minCos = std::min(minCos, glm::dot(cluster.coneAxis, normals[result.faces[i]]));
+        }
+        cluster.coneSin = sumLength > 0.f && minCos > 0.f ? std::sqrt(1.f - minCos * minCos) : 1.f;
+    }
+    return result;
+}
+
+ScreenBox ProjectBox(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& modelViewProjection) {
+    constexpr float FAR = std::numeric_limits<float>::infinity();
+    ScreenBox box { glm::vec2(FAR), glm::vec2(-FAR), 0.f, false };
+    float nearestW = FAR;
+    for (int corner = 0; corner < 8; ++corner) {
+        const glm::vec3 p((corner & 1) ? boundsMax.x : boundsMin.x, (corner & 2) ? boundsMax.y : boundsMin.y,
+                          (corner & 4) ? boundsMax.z : boundsMin.z);
+        const glm::vec4 clip = modelViewProjection * glm::vec4(p, 1.f);
+        // crossing the camera plane: the projection is not bounded by the corners'
+        if (!(clip.w > 0.f)) {
+            box.crossesCamera = true;
+            return box;
+        }
+        const glm::vec2 screen = glm::vec2(clip) / clip.w;
+        box.min = glm::min(box.min, screen);
+        box.max = glm::max(box.max, screen);
+        nearestW = std::min(nearestW, clip.w);
+    }
+    box.nearestInvW = 1.f / nearestW;
+    return box;
+}
+
+ClusterCull TestCluster(const Cluster& cluster, const ClusterView& view) {
+    // Facing away when, seen from anywhere in the bounding sphere, every normal of the cone points away from the
+    //     eye: the angle from the axis to the center is below 90 degrees minus the cone's and the sphere's spreads
+    if (view.cullBackFaces && cluster.coneSin < 1.f) {
+        const glm::vec3 toCenter = cluster.center - view.eye;
+        const float distance = glm::length(toCenter);
+        if (glm::dot(toCenter, cluster.coneAxis) > cluster.coneSin * distance + cluster.radius)
+            return ClusterCull::BACK_FACING;
+    }
+
+    const ScreenBox box = ProjectBox(cluster.boundsMin, cluster.boundsMax, view.modelViewProjection);
+    if (!OnScreen(box, view.width, view.height)) return ClusterCull::OFF_SCREEN;
+    if (view.occlusion && !box.crossesCamera
+        && view.occlusion->Occluded(box.min.x, box.max.x, box.min.y, box.max.y, box.nearestInvW))
+        return ClusterCull::OCCLUDED;
+    return ClusterCull::VISIBLE;
+}
@@ -0,0 +1,72 @@
+// Clusters (meshlets): each shape split into runs of a few dozen neighboring triangles with their own bounds and
+//     normal cone, so that runs off-screen, facing away or hidden behind what is already drawn are skipped whole,
+//     before any of their vertices is transformed
+
+#ifndef CLUSTERS_H
+#define CLUSTERS_H
+
+#include <cstdint>
+#include <vector>
+
+#include "../thirdparty/glm/glm.hpp"
+#include "../thirdparty/tinyobj/tiny_obj_fwd.h"
+#include "occlusion.hpp"
+
+// Largest cluster a config may ask for; the default aims at the 64-128 triangles meshlet pipelines use
+constexpr uint32_t MAX_CLUSTER_TRIANGLES = 256;
+constexpr uint32_t DEFAULT_CLUSTER_TRIANGLES = 96;
+
+struct Cluster {
+    uint32_t firstFace = 0, faceCount = 0;   // range of ShapeClusters::faces
+    glm::vec3 boundsMin {}, boundsMax {};     // model space
+    glm::vec3 center {};                      // bounding sphere, model space
+    float radius = 0.f;
+    // Every face normal lies within asin(coneSin) of coneAxis; coneSin is 1 when they spread too far for a cone
+    glm::vec3 coneAxis {};
+    float coneSin = 1.f;
+};
+
+struct ShapeClusters {
+    std::vector<uint32_t> faces;   // face indices of the shape, cluster after cluster
+    std::vector<Cluster> clusters;
+};
+
+// Split `shape` into clusters of at most `maxTriangles` faces, grown from a seed face over faces sharing a vertex,
+//     closest to the cluster's centroid first, so that clusters stay compact and their bounds tight
+ShapeClusters BuildClusters(const tinyobj::shape_t& shape, const tinyobj::attrib_t& attribs, uint32_t maxTriangles);
+
+// Screen extent of a model-space box drawn with `modelViewProjection` (model to screen, before the perspective
+//     divide). When a corner is not in front of the camera the projection is unbounded and `crossesCamera` is set.
+struct ScreenBox {
+    glm::vec2 min, max;
+    float nearestInvW;   // 1 / w of the box's closest point, w being linear over the box
+    bool crossesCamera;
+};
+ScreenBox ProjectBox(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& modelViewProjection);
+
+// Whether a projected box may reach a width x height screen, with a pixel of margin for snapping
+inline bool OnScreen(const ScreenBox& box, uint32_t width, uint32_t height) {
+    if (box.crossesCamera) return true;
+    // NaNs fail every compare and keep the box
+    return !(box.max.x < -1.f || box.max.y < -1.f || box.min.x > static_cast<float>(width)
+             || box.min.y > static_cast<float>(height));
+}
+
+// What a cluster test found
+enum class ClusterCull { VISIBLE, OFF_SCREEN, BACK_FACING, OCCLUDED };
+
+// One draw of a clustered shape: a shape or an instance under its matrices
+struct ClusterView {
+    glm::mat4 modelViewProjection;
+    glm::vec3 eye;   // camera position in the shape's model space
+    uint32_t width, height;
+    bool cullBackFaces;                // only sound for closed meshes wound counter-clockwise seen from outside
+    OcclusionBuffer* occlusion;        // null when nothing is drawn into one
+};
+
+// Test a cluster against its normal cone, the screen and the surfaces drawn so far, cheapest first. Culled
+//     clusters cannot change the image: they are off-screen, behind a nearer surface at every pixel they could
+//     reach, or facing away and so covered by the front faces of their closed mesh.
+ClusterCull TestCluster(const Cluster& cluster, const ClusterView& view);
+
+#endif
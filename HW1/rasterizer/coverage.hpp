@@ -0,0 +1,160 @@
+// Coverage traversal of a set-up triangle: finds the runs of pixels it owns, coarse to fine
+
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstdlib>
+
+#include "triangle_batch.hpp"
+
+// Block sizes of the descent. A partially covered block is split into 4x4 blocks of the next size, and partially
+//     covered blocks of the last size are tested pixel by pixel.
+constexpr uint32_t COVERAGE_BLOCK_SIZES[] = { 64, 16, 4 };
+constexpr uint32_t COVERAGE_LEVELS = sizeof(COVERAGE_BLOCK_SIZES) / sizeof(COVERAGE_BLOCK_SIZES[0]);
+
+// Triangles whose box is at most this many pixels wide and high are tested per pixel right away
+constexpr uint32_t COVERAGE_SMALL_TRIANGLE = 8;
+
+enum class BlockCoverage { OUT, PARTIAL, FULL };
+
+// The three edge functions of a triangle over pixel indices: At(e, x, y) is edge e of the batch evaluated at the
+//     center of pixel (x, y), so it is >= 0 exactly where the triangle owns the pixel
+class CoverageEdges {
+public:
+    // With `conservative`, the edges are pushed out by half a pixel so that every pixel the triangle touches counts
+    CoverageEdges(const TriangleBatch& batch, uint32_t index, bool conservative) {
+        for (int e = 0; e != 3; ++e) {
+            const TriangleBatch::Edge& edge = batch.GetEdge(index, e);
+            this->a[e] = static_cast<int64_t>(edge.a) * SUBPIXEL_ONE;
+            this->b[e] = static_cast<int64_t>(edge.b) * SUBPIXEL_ONE;
+            this->c[e] = edge.At(SUBPIXEL_HALF, SUBPIXEL_HALF);
+            if (conservative) this->c[e] += (std::abs(this->a[e]) + std::abs(this->b[e])) / 2;
+        }
+    }
+
+    inline int64_t At(int e, uint32_t x, uint32_t y) const {
+        return this->a[e] * static_cast<int64_t>(x) + this->b[e] * static_cast<int64_t>(y) + this->c[e];
+    }
+
+    // Classify the inclusive block [x0, x1] x [y0, y1]. The edges are linear, so each one only has to be checked at
+    //     the corner where it is largest (all outside when negative) and the one where it is smallest (all inside
+    //     when not negative).
+    inline BlockCoverage Classify(uint32_t x0, uint32_t x1, uint32_t y0, uint32_t y1) const {
+        bool full = true;
+        for (int e = 0; e != 3; ++e) {
+            const bool right = this->a[e] > 0, up = this->b[e] > 0;
+            if (this->At(e, right ? x1 : x0, up ? y1 : y0) < 0) return BlockCoverage::OUT;
+            if (this->At(e, right ? x0 : x1, up ? y0 : y1) < 0) full = false;
+        }
+        return full ? BlockCoverage::FULL : BlockCoverage::PARTIAL;
+    }
+
+    // Call visit(y, xBegin, xEnd) for every run of owned pixels in the inclusive block, testing each pixel
+    template <typename VisitSpan>
+    void EmitPixels(uint32_t x0, uint32_t x1, uint32_t y0, uint32_t y1, VisitSpan& visit) const {
+        for (uint32_t y = y0; y <= y1; ++y) {
+            int64_t e0 = this->At(0, x0, y), e1 = this->At(1, x0, y), e2 = this->At(2, x0, y);
+            uint32_t runBegin = x0;
+            bool inRun = false;
+            for (uint32_t x = x0; x <= x1; ++x) {
+                const bool covered = (e0 | e1 | e2) >= 0;
+                if (covered != inRun) {
+                    if (inRun) visit(y, runBegin, x - 1);
+                    runBegin = x;
+                    inRun = covered;
+                }
+                e0 += this->a[0];
+                e1 += this->a[1];
+                e2 += this->a[2];
+            }
+            if (inRun) visit(y, runBegin, x1);
+        }
+    }
+
+private:
+    std::array<int64_t, 3> a, b, c;
+};
+
+namespace coverage_detail {
+
+// Visit the block of COVERAGE_BLOCK_SIZES[level] pixels at (bx, by), clipped to `bounds`
+template <typename VisitSpan>
+void Descend(const CoverageEdges& edges, const PixelBounds& bounds, uint32_t level, uint32_t bx, uint32_t by,
+             VisitSpan& visit) {
+    const uint32_t size = COVERAGE_BLOCK_SIZES[level];
+    const uint32_t x0 = std::max(bx, bounds.xmin), x1 = std::min(bx + size - 1, bounds.xmax);
+    const uint32_t y0 = std::max(by, bounds.ymin), y1 = std::min(by + size - 1, bounds.ymax);
+    if (x0 > x1 || y0 > y1) return;
+
+    switch (edges.Classify(x0, x1, y0, y1)) {
+    case BlockCoverage::OUT:
+        return;
+    case BlockCoverage::FULL:
+        for (uint32_t y = y0; y <= y1; ++y) visit(y, x0, x1);
+        return;
+    case BlockCoverage::PARTIAL:
+        if (level + 1 == COVERAGE_LEVELS) {
+            edges.EmitPixels(x0, x1, y0, y1, visit);
+            return;
+        }
+        const uint32_t subSize = COVERAGE_BLOCK_SIZES[level + 1];
+        for (uint32_t sy = by; sy < by + size; sy += subSize)
+            for (uint32_t sx = bx; sx < bx + size; sx += subSize) Descend(edges, bounds, level + 1, sx, sy, visit);
+        return;
+    }
+}
+
+}   // namespace coverage_detail
+
+// Call visit(y, xBegin, xEnd) for runs of pixels (inclusive, within one row) that the triangle owns and that lie in
+//     `clip`. Stamp-sized triangles replay the mask from setup. Large triangles are walked coarse to fine: blocks
+//     entirely inside are emitted whole without any per-pixel test, and blocks entirely outside are skipped. With
+//     `conservative`, every pixel the triangle touches is visited instead.
+template <typename VisitSpan>
+void ForEachCoveredSpan(const TriangleBatch& batch, uint32_t index, bool conservative, const PixelBounds& clip,
+                        VisitSpan&& visit) {
+    const PixelBounds& full = batch.Bounds(index);
+    const PixelBounds bounds = { std::max(full.xmin, clip.xmin), std::min(full.xmax, clip.xmax),
+                                 std::max(full.ymin, clip.ymin), std::min(full.ymax, clip.ymax) };
+    if (bounds.Empty()) return;
+
+    if (!conservative && full.FitsStamp()) {
+        // coverage was already computed during setup, relative to the unclipped box
+        const uint16_t mask = batch.StampMask(index);
+        const uint32_t columns = ((2u << (bounds.xmax - full.xmin)) - 1) & ~((1u << (bounds.xmin - full.xmin)) - 1);
+        for (uint32_t y = bounds.ymin - full.ymin; y <= bounds.ymax - full.ymin; ++y) {
+            uint32_t row = (mask >> (y * STAMP_SIZE)) & columns;
+            while (row != 0) {
+                const uint32_t begin = std::countr_zero(row);
+                const uint32_t end = begin + std::countr_one(row >> begin) - 1;
+                visit(full.ymin + y, full.xmin + begin, full.xmin + end);
+                row &= ~((2u << end) - 1);
+            }
+        }
+        return;
+    }
+
+    const CoverageEdges edges(batch, index, conservative);
+
+    if (bounds.xmax - bounds.xmin < COVERAGE_SMALL_TRIANGLE && bounds.ymax - bounds.ymin < COVERAGE_SMALL_TRIANGLE) {
+        edges.EmitPixels(bounds.xmin, bounds.xmax, bounds.ymin, bounds.ymax, visit);
+        return;
+    }
+
+    const uint32_t size = COVERAGE_BLOCK_SIZES[0];
+    for (uint32_t by = bounds.ymin / size * size; by <= bounds.ymax; by += size)
+        for (uint32_t bx = bounds.xmin / size * size; bx <= bounds.xmax; bx += size)
+            coverage_detail::Descend(edges, bounds, 0, bx, by, visit);
+}
+
+// ForEachCoveredSpan over the whole triangle
+template <typename VisitSpan>
+void ForEachCoveredSpan(const TriangleBatch& batch, uint32_t index, bool conservative, VisitSpan&& visit) {
+    ForEachCoveredSpan(batch, index, conservative, batch.Bounds(index), visit);
+}
+
+#endif
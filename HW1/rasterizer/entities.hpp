@@ -5,6 +5,8 @@
 
 #include <array>
 #include <cmath>
+#include <cstdint>
+#include <limits>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -96,16 +98,35 @@ public:
         , scale(scale) {}
 };
 
+// Copies of one shape of the model, each drawn with its own transform applied on top of the shape's (`instances`)
+struct InstanceSet {
+    uint32_t shape;
+    std::vector<MeshTransform> transforms;
+};
+
 struct Light {
 public:
     glm::vec3 pos;
     float intensity;
     Color color;
+    // Distance at which the light stops contributing; infinite for plain inverse-square falloff (see Attenuation)
+    float radius;
 
-    Light(glm::vec3 pos, float intensity, Color color)
+    Light(glm::vec3 pos, float intensity, Color color, float radius = std::numeric_limits<float>::infinity())
         : pos(pos)
         , intensity(intensity)
-        , color(color) {}
+        , color(color)
+        , radius(radius) {}
+
+    inline bool Bounded() const { return std::isfinite(this->radius); }
+
+    // Falloff at squared distance `d2`: 1 / d2, windowed by (1 - (d / radius)^4)^2 for bounded lights so that it
+    //     reaches 0 exactly at the radius instead of being cut off with a visible edge
+    inline float Attenuation(float d2) const {
+        const float r2 = this->radius * this->radius;
+        const float fade = glm::max(1.f - d2 * d2 / (r2 * r2), 0.f);
+        return fade * fade / d2;
+    }
 };
 
 #endif
@@ -0,0 +1,154 @@
+#include "frame_stream.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr uint32_t STREAM_VERSION = 1;
+constexpr size_t SLOT_ALIGNMENT = 64;
+// Widest pixel format, so that a ring sized for one frame takes any format at that resolution
+constexpr size_t MAX_PIXEL_BYTES = 4 * sizeof(float);
+
+size_t AlignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+void ReportError(const std::string& what, const std::string& target) {
+    std::cerr << "Frame stream " + target + ": " + what + " (" + std::strerror(errno) + ")\n";
+}
+
+}   // namespace
+
+FrameStream::FrameStream(const std::string& target)
+    : target(target) {
+    // a consumer that exits should fail the next send, not kill the renderer
+    std::signal(SIGPIPE, SIG_IGN);
+
+    if (target == "-") {
+        this->fd = STDOUT_FILENO;
+    } else if (target.rfind("shm:", 0) == 0) {
+        this->shmName = target.substr(4);
+        this->fd = shm_open(this->shmName.c_str(), O_CREAT | O_RDWR, 0600);
+        if (this->fd < 0) ReportError("cannot open shared memory", target);
+    } else {
+        // blocks until a reader opens a named pipe; a regular file loses the frames of an earlier, longer run
+        this->fd = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (this->fd < 0) ReportError("cannot open", target);
+    }
+}
+
+FrameStream::~FrameStream() {
+    if (this->ring) munmap(this->ring, this->ringBytes);
+    if (!this->shmName.empty() && this->fd >= 0) shm_unlink(this->shmName.c_str());
+    if (this->fd >= 0 && this->fd != STDOUT_FILENO) close(this->fd);
+}
+
+bool FrameStream::Send(uint32_t width, uint32_t height, StreamPixelFormat format, const void* pixels, size_t bytes) {
+    if (this->fd < 0) return false;
+    std::lock_guard<std::mutex> lock(this->mutex);
+
+    FrameHeader header {};
+    std::memcpy(header.magic, "RFRM", 4);
+    header.version = STREAM_VERSION;
+    header.width = width;
+    header.height = height;
+    header.pixelFormat = static_cast<uint32_t>(format);
+    header.flags = FRAME_BOTTOM_UP;
+    header.index = this->frameIndex;
+    header.bytes = bytes;
+
+    const bool sent = this->shmName.empty() ? this->SendPipe(header, pixels) : this->SendRing(header, pixels);
+    if (sent) ++this->frameIndex;
+    return sent;
+}
+
+bool FrameStream::SendPipe(const FrameHeader& header, const void* pixels) {
+    // header and pixels in one call, straight from the canvas
+    iovec parts[2] = { { const_cast<FrameHeader*>(&header), sizeof(FrameHeader) },
+                       { const_cast<void*>(pixels), header.bytes } };
+    iovec* part = parts;
+    int remaining = 2;
+    while (remaining != 0) {
+        const ssize_t written = writev(this->fd, part, remaining);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            ReportError("write failed", this->target);
+            return false;
+        }
+        // skip what went through, possibly stopping in the middle of a part
+        size_t done = static_cast<size_t>(written);
+        while (remaining != 0 && done >= part->iov_len) {
+            done -= part->iov_len;
+            ++part;
+            --remaining;
+        }
+        if (remaining != 0) {
+            part->iov_base = static_cast<unsigned char*>(part->iov_base) + done;
+            part->iov_len -= done;
+        }
+    }
+    return true;
+}
+
+bool FrameStream::CreateRing(size_t slotBytes) {
+    const size_t slotStride = AlignUp(sizeof(SlotHeader), SLOT_ALIGNMENT) + AlignUp(slotBytes, SLOT_ALIGNMENT);
+    const size_t bytes = AlignUp(sizeof(RingHeader), SLOT_ALIGNMENT) + RING_SLOTS * slotStride;
+    if (ftruncate(this->fd, static_cast<off_t>(bytes)) != 0) {
+        ReportError("cannot size shared memory", this->target);
+        return false;
+    }
+    void* mapping = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+    if (mapping == MAP_FAILED) {
+        ReportError("cannot map shared memory", this->target);
+        return false;
+    }
+    this->ring = static_cast<unsigned char*>(mapping);
+    this->ringBytes = bytes;
+
+    RingHeader* header = new (this->ring) RingHeader {};
+    header->version = STREAM_VERSION;
+    header->slotCount = RING_SLOTS;
+    header->slotBytes = slotBytes;
+    header->slotStride = slotStride;
+    header->published.store(0, std::memory_order_relaxed);
+    for (uint32_t i = 0; i < RING_SLOTS; ++i) {
+        unsigned char* slot = this->ring + AlignUp(sizeof(RingHeader), SLOT_ALIGNMENT) + i * slotStride;
+        new (slot) SlotHeader {};
+    }
+    // the magic goes last, so a consumer that sees it also sees a complete header
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(header->magic, "RRNG", 4);
+    return true;
+}
+
+bool FrameStream::SendRing(const FrameHeader& frame, const void* pixels) {
+    if (!this->ring && !this->CreateRing(static_cast<size_t>(frame.width) * frame.height * MAX_PIXEL_BYTES))
+        return false;
+
+    RingHeader* header = reinterpret_cast<RingHeader*>(this->ring);
+    if (frame.bytes > header->slotBytes) {
+        std::cerr << "Frame stream " + this->target + ": a " + std::to_string(frame.width) + "x"
+                       + std::to_string(frame.height) + " frame does not fit the ring made for the first frame\n";
+        return false;
+    }
+
+    unsigned char* slot = this->ring + AlignUp(sizeof(RingHeader), SLOT_ALIGNMENT)
+                        + (frame.index % RING_SLOTS) * header->slotStride;
+    SlotHeader* slotHeader = reinterpret_cast<SlotHeader*>(slot);
+    slotHeader->sequence.store(2 * frame.index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slotHeader->frame = frame;
+    std::memcpy(slot + AlignUp(sizeof(SlotHeader), SLOT_ALIGNMENT), pixels, frame.bytes);
+    slotHeader->sequence.store(2 * (frame.index + 1), std::memory_order_release);
+    header->published.store(frame.index + 1, std::memory_order_release);
+    return true;
+}
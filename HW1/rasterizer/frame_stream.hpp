@@ -0,0 +1,104 @@
+// Raw frame output to a local consumer: a pipe (stdout or a named pipe) or a POSIX shared-memory ring buffer
+
+#ifndef FRAME_STREAM_H
+#define FRAME_STREAM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "image.hpp"
+
+enum class StreamPixelFormat : uint32_t { RGBA8 = 0, R32F = 1, RGBA32F = 2 };
+
+class FrameStream {
+public:
+    // Sent before every frame on a pipe, and stored at the start of every ring slot. Pixels follow as is: rows of
+    //     `width` pixels, contiguous, in host byte order, the bottom row first (the canvas layout).
+    struct FrameHeader {
+        char magic[4];          // "RFRM"
+        uint32_t version;
+        uint32_t width;
+        uint32_t height;
+        uint32_t pixelFormat;   // a StreamPixelFormat
+        uint32_t flags;         // FRAME_BOTTOM_UP
+        uint64_t index;         // frames sent before this one
+        uint64_t bytes;         // size of the pixels that follow
+    };
+    static constexpr uint32_t FRAME_BOTTOM_UP = 1;
+
+    // Shared-memory layout: this header, then `slotCount` slots of `slotStride` bytes, each a 64-byte aligned
+    //     SlotHeader followed by at most `slotBytes` of pixels. Frame i goes to slot i % slotCount, so a consumer
+    //     that falls behind misses frames instead of stalling the renderer. A slot is a seqlock: `sequence` is odd
+    //     while the slot is written and 2 * (index + 1) once frame `index` is complete; a reader copies the slot and
+    //     keeps the copy only if `sequence` was the same even value before and after.
+    struct RingHeader {
+        char magic[4];   // "RRNG"
+        uint32_t version;
+        uint32_t slotCount;
+        uint32_t reserved;
+        uint64_t slotBytes;
+        uint64_t slotStride;
+        std::atomic<uint64_t> published;   // frames completed so far; the newest is in slot (published - 1) % slotCount
+    };
+    struct SlotHeader {
+        std::atomic<uint64_t> sequence;
+        FrameHeader frame;
+    };
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring counters are shared between processes");
+
+    static constexpr uint32_t RING_SLOTS = 3;
+
+    // `target` is "-" for stdout, "shm:/name" for a shared-memory ring, or the path of a named pipe (or file). The
+    //     ring is created on the first frame, with room for that frame's pixel count in the widest format.
+    explicit FrameStream(const std::string& target);
+    FrameStream(const FrameStream&) = delete;
+    FrameStream& operator=(const FrameStream&) = delete;
+    ~FrameStream();   // closes the pipe, or unmaps and unlinks the ring
+
+    inline bool IsOpen() const { return this->fd >= 0; }
+    inline bool IsStdout() const { return this->target == "-"; }
+    inline const std::string& GetTarget() const { return this->target; }
+
+    // Send the canvas of `image` straight from its storage; false (with a message) if the consumer went away or the
+    //     frame does not fit the ring
+    template <typename T>
+    bool Send(const ImageBuffer<T>& image);
+
+private:
+    bool Send(uint32_t width, uint32_t height, StreamPixelFormat format, const void* pixels, size_t bytes);
+    bool SendPipe(const FrameHeader& header, const void* pixels);
+    bool SendRing(const FrameHeader& header, const void* pixels);
+    bool CreateRing(size_t slotBytes);
+
+    std::string target;
+    std::string shmName;   // empty unless the target is a ring
+    int fd = -1;
+    unsigned char* ring = nullptr;
+    size_t ringBytes = 0;
+    uint64_t frameIndex = 0;
+    std::mutex mutex;   // frames are sent whole and in order even from several writer threads
+};
+
+template <>
+inline bool FrameStream::Send(const Image& image) {
+    static_assert(sizeof(Color) == 4, "Color is streamed as RGBA8");
+    return this->Send(image.GetWidth(), image.GetHeight(), StreamPixelFormat::RGBA8, image.Pixels().data(),
+                      image.Pixels().size_bytes());
+}
+
+template <>
+inline bool FrameStream::Send(const ImageGrey& image) {
+    return this->Send(image.GetWidth(), image.GetHeight(), StreamPixelFormat::R32F, image.Pixels().data(),
+                      image.Pixels().size_bytes());
+}
+
+template <>
+inline bool FrameStream::Send(const ImageHDR& image) {
+    return this->Send(image.GetWidth(), image.GetHeight(), StreamPixelFormat::RGBA32F, image.Pixels().data(),
+                      image.Pixels().size_bytes());
+}
+
+#endif
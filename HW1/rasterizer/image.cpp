@@ -1,12 +1,13 @@
 #include "image.hpp"
 
 #include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "../thirdparty/stb/stb_image_write.h"
+#include "image_writer.hpp"
 
 Color Color::White = Color(255, 255, 255, 255);
 Color Color::Black = Color(0, 0, 0, 255);
@@ -35,20 +36,6 @@ Color::Color(glm::vec4& v)
 Color::Color(glm::vec3& v)
     : Color({ v.x, v.y, v.z, 255 }) {}
 
-Color::Color(const Color& c)
-    : r(c.r)
-    , g(c.g)
-    , b(c.b)
-    , a(c.a) {}
-
-Color& Color::operator=(const Color& c) {
-    this->r = c.r;
-    this->g = c.g;
-    this->b = c.b;
-    this->a = c.a;
-    return *this;
-}
-
 bool Color::operator==(const Color& c) {
     return (c.r == this->r && c.g == this->g && c.b == this->b && c.a == this->a);
 }
@@ -69,60 +56,194 @@ const char Color::operator[](size_t index) const {
     return a;
 }
 
-template <>
-ImageBuffer<Color>::ImageBuffer(std::string filename) {
-    this->width = 100;
-    this->height = 100;
-    this->canvas = new Color[100 * 100];
-    for (size_t i = 0; i != 100 * 100; ++i) this->canvas[i] = Color::Black;
-    this->filename = filename;
+namespace {
+
+// Pixels converted per block; with a fixed trip count the block loop vectorizes at plain -O2
+constexpr size_t RESOLVE_BLOCK = 16;
+
+// Round [0, 1] to 8 bits. Clamping happens on the integer, where it becomes a min/max (a float clamp feeding the
+//     conversion is not if-converted), and NaN converts to INT_MIN and ends up black.
+inline unsigned char Quantize(float value) {
+    int32_t level = static_cast<int32_t>(value * 255.f + 0.5f);
+    level = level < 0 ? 0 : level;
+    level = level > 255 ? 255 : level;
+    return static_cast<unsigned char>(level);
 }
 
-template <>
-ImageBuffer<Color>::ImageBuffer(unsigned int w, unsigned int h, std::string filename) {
-    if (w > 2000) w = 2000;
-    if (h > 2000) h = 2000;
-    this->width = w;
-    this->height = h;
-    this->canvas = new Color[static_cast<size_t>(w) * static_cast<size_t>(h)];
-    for (size_t i = 0; i != this->width * this->height; ++i) this->canvas[i] = Color::Black;
-    this->filename = filename;
+// Tonemap one color channel; Reinhard of a negative value stays negative and is clamped to 0 later
+template <ToneMap TONE_MAP>
+inline float MapChannel(float value) {
+    if constexpr (TONE_MAP == ToneMap::REINHARD) return value / (1.f + std::abs(value));
+    return value;
+}
+
+// The channels are spelled out instead of looped over, which would keep the caller's loop from vectorizing
+template <ToneMap TONE_MAP>
+inline void ResolvePixel(const float* __restrict source, unsigned char* __restrict target) {
+    target[0] = Quantize(MapChannel<TONE_MAP>(source[0]));
+    target[1] = Quantize(MapChannel<TONE_MAP>(source[1]));
+    target[2] = Quantize(MapChannel<TONE_MAP>(source[2]));
+    target[3] = Quantize(source[3]);
 }
 
+// Kept out of line: once inlined into the caller the `__restrict` promises are dropped and the float/byte aliasing
+//     keeps the block loop scalar
+template <ToneMap TONE_MAP>
+[[gnu::noinline]] void ResolvePixels(const float* __restrict source, unsigned char* __restrict target, size_t pixels) {
+    size_t i = 0;
+    for (; i + RESOLVE_BLOCK <= pixels; i += RESOLVE_BLOCK)
+        for (size_t k = 0; k != RESOLVE_BLOCK; ++k) ResolvePixel<TONE_MAP>(source + 4 * (i + k), target + 4 * (i + k));
+    for (; i != pixels; ++i) ResolvePixel<TONE_MAP>(source + 4 * i, target + 4 * i);
+}
+
+}   // namespace
+
+void ResolveHDR(const ImageHDR& source, Image& target, ToneMap toneMap) {
+    static_assert(sizeof(ColorHDR) == 4 * sizeof(float) && sizeof(Color) == 4, "channels must be packed");
+    if (source.GetWidth() != target.GetWidth() || source.GetHeight() != target.GetHeight())
+        throw std::invalid_argument("ResolveHDR needs buffers of the same size");
+
+    const float* channels = &source.Pixels().data()->x;
+    unsigned char* bytes = &target.Pixels().data()->r;
+    const size_t pixels = source.Pixels().size();
+    if (toneMap == ToneMap::REINHARD)
+        ResolvePixels<ToneMap::REINHARD>(channels, bytes, pixels);
+    else
+        ResolvePixels<ToneMap::CLAMP>(channels, bytes, pixels);
+}
+
+namespace {
+
+const char* FormatName(ImageFormat format) {
+    switch (format) {
+    case ImageFormat::PPM: return "PPM";
+    case ImageFormat::PFM: return "PFM";
+    case ImageFormat::QOI: return "QOI";
+    default: return "PNG";
+    }
+}
+
+// Extension of a file with `channels` channels; single channel netpbm files are PGM
+std::string FormatExtension(ImageFormat format, uint32_t channels) {
+    switch (format) {
+    case ImageFormat::PPM: return channels == 1 ? ".pgm" : ".ppm";
+    case ImageFormat::PFM: return ".pfm";
+    case ImageFormat::QOI: return ".qoi";
+    default: return ".png";
+    }
+}
+
+void ReportWrite(ImageFormat format, uint32_t width, uint32_t height, const char* kind) {
+    // one insertion, so that lines from background writers do not interleave with the renderer's
+    std::string resStr = std::to_string(width) + "x" + std::to_string(height);
+    std::cout << "Writing to " + std::string(FormatName(format)) + " with resolution " + resStr + " for " + kind
+                   + " images.\n";
+}
+
+bool ReportFailure(bool success, const std::string& path) {
+    if (!success) std::cerr << "Writing to " + path + " failed.\n";
+    return success;
+}
+
+}   // namespace
+
 template <typename T>
-void ImageBuffer<T>::Write() {
+bool ImageBuffer<T>::Write(const WriteOptions&) {
     std::cerr << "Writing files not of greyscale or color type is not supported.\n";
+    return false;
 }
 
-template <>
-void ImageBuffer<Color>::Write() {
-    std::string resStr = std::to_string(this->width) + "x" + std::to_string(this->height);
-    std::cout << "Writing to PNG with resolution " << resStr << " for colored images.\n";
-    stbi_flip_vertically_on_write(true);
+// The canvas is stored bottom-up, so picture row y (from the top) is canvas row height - 1 - y
 
-    int info;
-    info = stbi_write_png((filename + ".png").c_str(), this->width, this->height, 4, this->canvas, 0);
-    if (!info) std::cerr << "Writing to " << filename << ".png failed." << std::endl;
+template <>
+bool ImageBuffer<Color>::Write(const WriteOptions& options) {
+    ReportWrite(options.format, this->width, this->height, "colored");
+    const uint32_t w = this->width, h = this->height;
+    auto row = [this](uint32_t y) { return this->Row(this->height - 1 - y); };
+
+    const uint32_t channels = options.format == ImageFormat::PPM || options.format == ImageFormat::PFM ? 3 : 4;
+    const std::string path = this->filename + FormatExtension(options.format, channels);
+    auto rgb = [&](uint32_t y, unsigned char* out) {
+        const Color* pixels = row(y);
+        for (uint32_t x = 0; x != w; ++x) {
+            out[3 * x + 0] = pixels[x].r;
+            out[3 * x + 1] = pixels[x].g;
+            out[3 * x + 2] = pixels[x].b;
+        }
+    };
+    auto rgba = [&](uint32_t y, unsigned char* out) { std::memcpy(out, row(y), w * sizeof(Color)); };
+
+    bool success;
+    switch (options.format) {
+    case ImageFormat::PPM: success = WritePNM(path, w, h, 3, 8, rgb); break;
+    case ImageFormat::QOI: success = WriteQOI(path, w, h, 4, rgba); break;
+    case ImageFormat::PFM:
+        success = WritePFM(path, w, h, 3, [&](uint32_t y, float* out) {
+            const Color* pixels = row(y);
+            for (uint32_t x = 0; x != w; ++x) {
+                out[3 * x + 0] = static_cast<unsigned char>(pixels[x].r) / 255.f;
+                out[3 * x + 1] = static_cast<unsigned char>(pixels[x].g) / 255.f;
+                out[3 * x + 2] = static_cast<unsigned char>(pixels[x].b) / 255.f;
+            }
+        });
+        break;
+    default: success = WritePNG(path, w, h, 4, 8, options.compression, rgba); break;
+    }
+    return ReportFailure(success, path);
 }
 
+// Depth in [-1, 1] is written as 1 - depth scaled to the integer range (8 or 16 bits), or as is to PFM
 template <>
-void ImageBuffer<float>::Write() {
-    std::string resStr = std::to_string(this->width) + "x" + std::to_string(this->height);
-    std::cout << "Writing to PNG with resolution " << resStr << " for greyscale images.\n";
-    stbi_flip_vertically_on_write(true);
-
-    Color* colorCanvas = new Color[this->width * this->height];
-
-    for (size_t index = 0; index != this->width * this->height; ++index) {
-        float val = this->canvas[index];
-        val = 127.5f - 127.5f * val;
-        val = std::clamp(val, 0.f, 255.f);
-        colorCanvas[index] = Color(val, val, val, 255);
+bool ImageBuffer<float>::Write(const WriteOptions& options) {
+    ReportWrite(options.format, this->width, this->height, "greyscale");
+    const uint32_t w = this->width, h = this->height;
+    auto row = [this](uint32_t y) { return this->Row(this->height - 1 - y); };
+
+    const uint32_t channels = options.format == ImageFormat::QOI ? 3 : 1;
+    const std::string path = this->filename + FormatExtension(options.format, channels);
+    const bool wide = options.depthBits == 16 && options.format != ImageFormat::QOI;
+    auto grey = [&](uint32_t y, unsigned char* out) {
+        const float* depths = row(y);
+        for (uint32_t x = 0; x != w; ++x) {
+            if (wide) {
+                const float level = std::clamp(32767.5f - 32767.5f * depths[x], 0.f, 65535.f);
+                const uint16_t value = static_cast<uint16_t>(level);
+                out[2 * x] = static_cast<unsigned char>(value >> 8);
+                out[2 * x + 1] = static_cast<unsigned char>(value);
+            } else {
+                const float level = std::clamp(127.5f - 127.5f * depths[x], 0.f, 255.f);
+                const unsigned char value = static_cast<unsigned char>(level);
+                std::fill_n(out + channels * x, channels, value);
+            }
+        }
+    };
+
+    bool success;
+    switch (options.format) {
+    case ImageFormat::PPM: success = WritePNM(path, w, h, 1, wide ? 16 : 8, grey); break;
+    case ImageFormat::QOI: success = WriteQOI(path, w, h, 3, grey); break;
+    case ImageFormat::PFM:
+        success = WritePFM(path, w, h, 1, [&](uint32_t y, float* out) { std::memcpy(out, row(y), w * sizeof(float)); });
+        break;
+    default: success = WritePNG(path, w, h, 1, wide ? 16 : 8, options.compression, grey); break;
     }
+    return ReportFailure(success, path);
+}
 
-    int info;
-    info = stbi_write_png((filename + ".png").c_str(), this->width, this->height, 4, colorCanvas, 0);
-    if (!info) std::cerr << "Writing to " << filename << ".png failed." << std::endl;
-
-    delete[] colorCanvas;
+// Linear color has no 8-bit form without a tonemap, so it only goes to PFM
+template <>
+bool ImageBuffer<ColorHDR>::Write(const WriteOptions& options) {
+    const std::string path = this->filename + FormatExtension(ImageFormat::PFM, 3);
+    if (options.format != ImageFormat::PFM) std::cerr << "Linear color images are always written as PFM.\n";
+    ReportWrite(ImageFormat::PFM, this->width, this->height, "linear color");
+    const uint32_t w = this->width;
+    const bool success = WritePFM(path, w, this->height, 3, [&](uint32_t y, float* out) {
+        const ColorHDR* pixels = this->Row(this->height - 1 - y);
+        for (uint32_t x = 0; x != w; ++x) {
+            out[3 * x + 0] = pixels[x].r;
+            out[3 * x + 1] = pixels[x].g;
+            out[3 * x + 2] = pixels[x].b;
+        }
+    });
+    return ReportFailure(success, path);
 }
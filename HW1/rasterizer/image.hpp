@@ -2,10 +2,17 @@
 #define ImageBuffer_H
 
 #include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <new>
 #include <optional>
+#include <span>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
 
 #include "../thirdparty/glm/glm.hpp"
+#include "image_writer.hpp"
 
 class Color {
 public:
@@ -18,10 +25,10 @@ public:
     Color(float, float, float, float);
     Color(glm::vec4&);
     Color(glm::vec3&);
-    Color(const Color&);
+    Color(const Color&) = default;
 
     // Assignments and equality judgement
-    Color& operator=(const Color&);
+    Color& operator=(const Color&) = default;
     bool operator==(const Color&);
     bool operator!=(const Color&);
     const char operator[](size_t index) const;
@@ -47,21 +54,65 @@ inline Color operator*(const Color& c, float coeff) {
     return coeff * c;
 }
 
+// Tag for constructing a buffer whose pixels are about to be overwritten anyway (e.g. by Fill or InitZBuffer)
+struct NoInit {};
+
+// Unchecked pixel accesses are only validated when compiled with IMAGE_BOUNDS_CHECK defined
+inline void CheckPixelBounds([[maybe_unused]] uint32_t w, [[maybe_unused]] uint32_t h,
+                             [[maybe_unused]] uint32_t width, [[maybe_unused]] uint32_t height) {
+#if defined IMAGE_BOUNDS_CHECK
+    if (w >= width || h >= height)
+        throw std::out_of_range("pixel (" + std::to_string(w) + ", " + std::to_string(h) + ") outside of "
+                                + std::to_string(width) + "x" + std::to_string(height) + " buffer");
+#endif
+}
+
+// Non-owning window into a buffer; rows are `stride` pixels apart
+template <typename T>
+struct ImageView {
+    T* data;
+    uint32_t width, height;
+    size_t stride;
+
+    inline T* Row(uint32_t h) const {
+        CheckPixelBounds(0, h, 1, this->height);
+        return this->data + h * this->stride;
+    }
+    inline T& operator()(uint32_t w, uint32_t h) const {
+        CheckPixelBounds(w, h, this->width, this->height);
+        return this->data[h * this->stride + w];
+    }
+    inline ImageView SubView(uint32_t x, uint32_t y, uint32_t w, uint32_t h) const {
+        CheckPixelBounds(x + w - 1, y + h - 1, this->width, this->height);
+        return { this->data + y * this->stride + x, w, h, this->stride };
+    }
+};
+
 template <typename T>
 class ImageBuffer {
 private:
+    // Canvas storage is aligned to a cache line so that rows can be streamed with vector loads/stores
+    static constexpr std::align_val_t ALIGNMENT { 64 };
+
     uint32_t width, height;
     T* canvas;
     std::string filename;
 
+    static T* Allocate(size_t count);
+    void Release();
+
 public:
     // Constructors
+    //     Pixels are value-initialized (0 for greyscale, Color::Black for colors) unless NoInit is passed
     ImageBuffer(std::string = "output");
     ImageBuffer(uint32_t width, uint32_t height, std::string = "output");
+    ImageBuffer(uint32_t width, uint32_t height, NoInit, std::string = "output");
     ImageBuffer(const ImageBuffer&);
+    ImageBuffer(ImageBuffer&&) noexcept;
     ~ImageBuffer();
 
     ImageBuffer& operator=(const ImageBuffer&);
+    ImageBuffer& operator=(ImageBuffer&&) noexcept;
 
     // Set/Get color for a specific pixel
     //     Attempting to set color to an invalid pixel will result in no change in the canvas
@@ -69,8 +120,38 @@ public:
     void Set(uint32_t w, uint32_t h, T);
     std::optional<T> Get(uint32_t w, uint32_t h) const;
 
-    // Write the canvas to a .png file with the designated filename
-    void Write();
+    // Set every pixel to the same value
+    void Fill(const T& value);
+
+    // Direct access for hot loops, without the checks of Set/Get; callers must clamp coordinates to the buffer
+    //     first. Rows are contiguous and `GetWidth()` pixels long.
+    inline T& operator()(uint32_t w, uint32_t h) {
+        CheckPixelBounds(w, h, this->width, this->height);
+        return this->canvas[static_cast<size_t>(h) * this->width + w];
+    }
+    inline const T& operator()(uint32_t w, uint32_t h) const {
+        CheckPixelBounds(w, h, this->width, this->height);
+        return this->canvas[static_cast<size_t>(h) * this->width + w];
+    }
+    inline T* Row(uint32_t h) {
+        CheckPixelBounds(0, h, 1, this->height);
+        return this->canvas + static_cast<size_t>(h) * this->width;
+    }
+    inline const T* Row(uint32_t h) const {
+        CheckPixelBounds(0, h, 1, this->height);
+        return this->canvas + static_cast<size_t>(h) * this->width;
+    }
+    inline ImageView<T> View() { return { this->canvas, this->width, this->height, this->width }; }
+    inline ImageView<const T> View() const { return { this->canvas, this->width, this->height, this->width }; }
+    inline std::span<T> Pixels() { return { this->canvas, static_cast<size_t>(this->width) * this->height }; }
+    inline std::span<const T> Pixels() const {
+        return { this->canvas, static_cast<size_t>(this->width) * this->height };
+    }
+
+    // Write the canvas to a .png file with the designated filename; false when the file could not be written
+    inline bool Write() { return this->Write(WriteOptions {}); }
+    // Write in another format or with other settings; the extension follows the format (see image_writer.hpp)
+    bool Write(const WriteOptions& options);
 
     inline uint32_t GetWidth() const { return width; }
     inline uint32_t GetHeight() const { return height; }
@@ -79,66 +160,116 @@ public:
 using Image = ImageBuffer<Color>;
 using ImageGrey = ImageBuffer<float>;
 
+// Linear color where 1 is display white. Shading accumulates into these without clamping, and the frame is
+//     converted to 8-bit `Color` once, by `ResolveHDR`.
+using ColorHDR = glm::vec4;
+using ImageHDR = ImageBuffer<ColorHDR>;
+
+// How `ResolveHDR` maps linear values to [0, 1]: CLAMP keeps the look of 8-bit accumulation, REINHARD (x / (1 + x))
+//     rolls off highlights instead of clipping them
+enum class ToneMap { CLAMP, REINHARD };
+
+// Tonemap and quantize `source` into `target` (same size) in a single pass; alpha is only clamped
+void ResolveHDR(const ImageHDR& source, Image& target, ToneMap toneMap);
+
 template <typename T>
-ImageBuffer<T>::ImageBuffer(std::string filename) {
-    this->width = 100;
-    this->height = 100;
-    this->canvas = new T[100 * 100];
-    this->filename = filename;
+T* ImageBuffer<T>::Allocate(size_t count) {
+    return static_cast<T*>(::operator new(std::max<size_t>(count, 1) * sizeof(T), ALIGNMENT));
 }
 
 template <typename T>
-ImageBuffer<T>::ImageBuffer(unsigned int w, unsigned int h, std::string filename) {
-    if (w > 2000) w = 2000;
-    if (h > 2000) h = 2000;
-    this->width = w;
-    this->height = h;
-    this->canvas = new T[static_cast<size_t>(w) * static_cast<size_t>(h)];
-    this->filename = filename;
+void ImageBuffer<T>::Release() {
+    if (!this->canvas) return;
+    std::destroy_n(this->canvas, static_cast<size_t>(this->width) * this->height);
+    ::operator delete(this->canvas, ALIGNMENT);
+    this->canvas = nullptr;
 }
 
-template <>
-ImageBuffer<Color>::ImageBuffer(std::string filename);
+template <typename T>
+ImageBuffer<T>::ImageBuffer(std::string filename)
+    : ImageBuffer(100, 100, filename) {}
+
+template <typename T>
+ImageBuffer<T>::ImageBuffer(uint32_t w, uint32_t h, std::string filename)
+    : width(w)
+    , height(h)
+    , canvas(Allocate(static_cast<size_t>(w) * h))
+    , filename(filename) {
+    std::uninitialized_value_construct_n(this->canvas, static_cast<size_t>(w) * h);
+}
 
-template <>
-ImageBuffer<Color>::ImageBuffer(std::string filename);
+template <typename T>
+ImageBuffer<T>::ImageBuffer(uint32_t w, uint32_t h, NoInit, std::string filename)
+    : width(w)
+    , height(h)
+    , canvas(Allocate(static_cast<size_t>(w) * h))
+    , filename(filename) {
+    // trivially copyable pixels (floats, Color, ...) may start their lifetime without running a constructor
+    if constexpr (!std::is_trivially_copyable_v<T>)
+        std::uninitialized_default_construct_n(this->canvas, static_cast<size_t>(w) * h);
+}
 
-template <>
-ImageBuffer<Color>::ImageBuffer(unsigned int w, unsigned int h, std::string filename);
+template <typename T>
+ImageBuffer<T>::ImageBuffer(const ImageBuffer<T>& image)
+    : width(image.width)
+    , height(image.height)
+    , canvas(Allocate(static_cast<size_t>(image.width) * image.height))
+    , filename(image.filename) {
+    std::uninitialized_copy_n(image.canvas, static_cast<size_t>(image.width) * image.height, this->canvas);
+}
 
 template <typename T>
-ImageBuffer<T>::ImageBuffer(const ImageBuffer<T>& image) {
-    *this = image;
+ImageBuffer<T>::ImageBuffer(ImageBuffer<T>&& image) noexcept
+    : width(image.width)
+    , height(image.height)
+    , canvas(image.canvas)
+    , filename(std::move(image.filename)) {
+    image.canvas = nullptr;
+    image.width = 0;
+    image.height = 0;
 }
 
 template <typename T>
 ImageBuffer<T>::~ImageBuffer() {
-    if (canvas) delete[] canvas;
+    this->Release();
 }
 
 template <typename T>
 ImageBuffer<T>& ImageBuffer<T>::operator=(const ImageBuffer<T>& image) {
-    if (this->canvas) delete[] canvas;
+    if (this == &image) return *this;
+    return *this = ImageBuffer<T>(image);
+}
+
+template <typename T>
+ImageBuffer<T>& ImageBuffer<T>::operator=(ImageBuffer<T>&& image) noexcept {
+    if (this == &image) return *this;
+    this->Release();
 
     this->width = image.width;
     this->height = image.height;
-    this->canvas = new T[image.width * image.height];
-
-    for (unsigned int i = 0; i != image.width * image.height; ++i) this->canvas[i] = image.canvas[i];
-    this->filename = image.filename;
+    this->canvas = image.canvas;
+    this->filename = std::move(image.filename);
 
+    image.canvas = nullptr;
+    image.width = 0;
+    image.height = 0;
     return *this;
 }
 
 template <typename T>
 void ImageBuffer<T>::Set(unsigned int w, unsigned int h, T c) {
-    if (!(!canvas || w >= width || h >= height)) this->canvas[(size_t) (h * this->width + w)] = c;
+    if (!(!canvas || w >= width || h >= height)) this->canvas[static_cast<size_t>(h) * this->width + w] = c;
 }
 
 template <typename T>
 std::optional<T> ImageBuffer<T>::Get(unsigned int w, unsigned int h) const {
-    if (!(!canvas || w >= width || h >= height)) return this->canvas[(size_t) (h * this->width + w)];
+    if (!(!canvas || w >= width || h >= height)) return this->canvas[static_cast<size_t>(h) * this->width + w];
     return std::nullopt;
 }
 
+template <typename T>
+void ImageBuffer<T>::Fill(const T& value) {
+    if (this->canvas) std::fill_n(this->canvas, static_cast<size_t>(this->width) * this->height, value);
+}
+
 #endif
@@ -0,0 +1,448 @@
+#include "image_writer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include "parallel.hpp"
+
+namespace {
+
+using Bytes = std::vector<unsigned char>;
+
+// Bands are sized so that each one carries enough data to be worth a thread, and to give deflate some history
+constexpr size_t PNG_BAND_BYTES = 1 << 17;
+
+constexpr std::array<uint32_t, 256> CRC_TABLE = [] {
+    std::array<uint32_t, 256> table {};
+    for (uint32_t n = 0; n != 256; ++n) {
+        uint32_t c = n;
+        for (int k = 0; k != 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        table[n] = c;
+    }
+    return table;
+}();
+
+// CRC-32 as used by PNG; chaining Crc32(b, size, Crc32(a, ...)) gives the CRC of a followed by b
+uint32_t Crc32(const unsigned char* data, size_t size, uint32_t crc = 0) {
+    crc = ~crc;
+    for (size_t i = 0; i != size; ++i) crc = CRC_TABLE[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+constexpr uint32_t ADLER_MOD = 65521;
+
+uint32_t Adler32(const unsigned char* data, size_t size) {
+    uint32_t s1 = 1, s2 = 0;
+    while (size != 0) {
+        // 5552 is the most bytes that can be summed before s2 may overflow
+        const size_t block = std::min<size_t>(size, 5552);
+        for (size_t i = 0; i != block; ++i) {
+            s1 += data[i];
+            s2 += s1;
+        }
+        s1 %= ADLER_MOD;
+        s2 %= ADLER_MOD;
+        data += block;
+        size -= block;
+    }
+    return (s2 << 16) | s1;
+}
+
+// Adler-32 of a followed by b, from the checksums of both and the length of b
+uint32_t AdlerCombine(uint32_t a, uint32_t b, size_t sizeB) {
+    const uint32_t remainder = static_cast<uint32_t>(sizeB % ADLER_MOD);
+    const uint32_t a1 = a & 0xFFFF, a2 = a >> 16, b1 = b & 0xFFFF, b2 = b >> 16;
+    const uint32_t s1 = (a1 + b1 + ADLER_MOD - 1) % ADLER_MOD;
+    const uint32_t s2 = static_cast<uint32_t>((static_cast<uint64_t>(remainder) * a1 + a2 + b2 + ADLER_MOD
+                                               - remainder) % ADLER_MOD);
+    return (s2 << 16) | s1;
+}
+
+void PutBigEndian(Bytes& out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) out.push_back(static_cast<unsigned char>(value >> shift));
+}
+
+// Length, type, data and CRC of a PNG chunk
+void AppendChunk(Bytes& out, const char* type, const unsigned char* data, size_t size) {
+    PutBigEndian(out, static_cast<uint32_t>(size));
+    const size_t typeOffset = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + size);
+    PutBigEndian(out, Crc32(out.data() + typeOffset, size + 4));
+}
+
+// Deflate bits go out least significant first
+class BitWriter {
+public:
+    explicit BitWriter(Bytes& out)
+        : out(out) {}
+
+    inline void Add(uint32_t bits, uint32_t count) {
+        this->buffer |= bits << this->count;
+        this->count += count;
+        while (this->count >= 8) {
+            this->out.push_back(static_cast<unsigned char>(this->buffer));
+            this->buffer >>= 8;
+            this->count -= 8;
+        }
+    }
+
+    inline void AlignToByte() {
+        if (this->count != 0) this->Add(0, 8 - this->count);
+    }
+
+private:
+    Bytes& out;
+    uint32_t buffer = 0;
+    uint32_t count = 0;
+};
+
+// The fixed Huffman code of deflate; codes are stored bit-reversed, ready for BitWriter
+struct HuffmanCode {
+    uint16_t bits;
+    uint8_t length;
+};
+
+constexpr uint16_t Reverse(uint32_t code, uint32_t length) {
+    uint32_t reversed = 0;
+    for (uint32_t i = 0; i != length; ++i) reversed |= ((code >> i) & 1) << (length - 1 - i);
+    return static_cast<uint16_t>(reversed);
+}
+
+constexpr std::array<HuffmanCode, 288> FIXED_LITERALS = [] {
+    std::array<HuffmanCode, 288> codes {};
+    for (uint32_t s = 0; s != 288; ++s) {
+        if (s <= 143)
+            codes[s] = { Reverse(0x30 + s, 8), 8 };
+        else if (s <= 255)
+            codes[s] = { Reverse(0x190 + s - 144, 9), 9 };
+        else if (s <= 279)
+            codes[s] = { Reverse(s - 256, 7), 7 };
+        else
+            codes[s] = { Reverse(0xC0 + s - 280, 8), 8 };
+    }
+    return codes;
+}();
+
+constexpr uint32_t END_OF_BLOCK = 256;
+constexpr uint32_t MIN_MATCH = 3, MAX_MATCH = 258, WINDOW = 32768;
+
+constexpr std::array<uint16_t, 29> LENGTH_BASE = { 3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                                   31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+constexpr std::array<uint8_t, 29> LENGTH_EXTRA = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                                   2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+constexpr std::array<uint16_t, 30> DISTANCE_BASE = { 1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+                                                     33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+                                                     1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+
+// Length code (0-based, symbol 257 + code) of every match length
+constexpr std::array<uint8_t, MAX_MATCH + 1> LENGTH_CODE = [] {
+    std::array<uint8_t, MAX_MATCH + 1> codes {};
+    for (uint32_t code = 0; code != LENGTH_BASE.size(); ++code)
+        for (uint32_t length = LENGTH_BASE[code]; length < MAX_MATCH + 1u; ++length) codes[length] = code;
+    return codes;
+}();
+
+// Distance code of a match distance in [1, 32768]: two codes per power of two past the first four
+inline uint32_t DistanceCode(uint32_t distance) {
+    if (distance <= 4) return distance - 1;
+    const uint32_t bits = std::bit_width(distance - 1) - 1;
+    return 2 * bits + (((distance - 1) >> (bits - 1)) & 1);
+}
+
+inline uint32_t DistanceExtra(uint32_t code) {
+    return code < 4 ? 0 : code / 2 - 1;
+}
+
+inline size_t MatchLength(const unsigned char* a, const unsigned char* b, size_t limit) {
+    size_t length = 0;
+    if constexpr (std::endian::native == std::endian::little) {
+        // eight bytes at a time; the lowest differing byte is the first mismatch
+        while (length + 8 <= limit) {
+            uint64_t x, y;
+            std::memcpy(&x, a + length, 8);
+            std::memcpy(&y, b + length, 8);
+            if (x != y) return length + std::countr_zero(x ^ y) / 8;
+            length += 8;
+        }
+    }
+    while (length < limit && a[length] == b[length]) ++length;
+    return length;
+}
+
+constexpr uint32_t HASH_BITS = 15;
+
+inline uint32_t Hash(const unsigned char* data) {
+    const uint32_t key = data[0] | (data[1] << 8) | (data[2] << 16);
+    return (key * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Candidates tried per position, by compression level
+constexpr std::array<uint32_t, 10> MAX_CHAIN = { 0, 2, 4, 8, 16, 32, 64, 128, 512, 2048 };
+
+// Deflate `data` as non-final blocks that end on a byte boundary (with an empty stored block, like a zlib sync
+//     flush), so that independently compressed bands can simply be concatenated. Level 0 stores the data; other
+//     levels use LZ77 with hash chains and the fixed Huffman code.
+void DeflateBand(const unsigned char* data, size_t size, int level, Bytes& out) {
+    if (level <= 0) {
+        for (size_t offset = 0; offset < size; offset += 0xFFFF) {
+            const uint32_t length = static_cast<uint32_t>(std::min<size_t>(size - offset, 0xFFFF));
+            out.push_back(0);   // BFINAL = 0, BTYPE = 00, then aligned
+            out.push_back(static_cast<unsigned char>(length));
+            out.push_back(static_cast<unsigned char>(length >> 8));
+            out.push_back(static_cast<unsigned char>(~length));
+            out.push_back(static_cast<unsigned char>(~length >> 8));
+            out.insert(out.end(), data + offset, data + offset + length);
+        }
+        return;
+    }
+
+    const uint32_t maxChain = MAX_CHAIN[std::min(level, 9)];
+    std::vector<int32_t> head(1u << HASH_BITS, -1), previous(size);
+    auto insert = [&](size_t position) {
+        const uint32_t h = Hash(data + position);
+        previous[position] = head[h];
+        head[h] = static_cast<int32_t>(position);
+    };
+
+    BitWriter bits(out);
+    auto literal = [&](uint32_t symbol) { bits.Add(FIXED_LITERALS[symbol].bits, FIXED_LITERALS[symbol].length); };
+
+    bits.Add(0b010, 3);   // BFINAL = 0, BTYPE = 01 (fixed Huffman)
+    size_t i = 0;
+    while (i + MIN_MATCH <= size) {
+        const size_t limit = std::min<size_t>(MAX_MATCH, size - i);
+        size_t best = 0, bestDistance = 0;
+        uint32_t chain = maxChain;
+        for (int32_t candidate = head[Hash(data + i)]; candidate >= 0 && i - candidate <= WINDOW && chain-- != 0;
+             candidate = previous[candidate]) {
+            // a candidate can only win if it also matches the byte that ends the best match so far
+            if (data[candidate + best] != data[i + best] && best != 0) continue;
+            const size_t length = MatchLength(data + candidate, data + i, limit);
+            if (length > best) {
+                best = length;
+                bestDistance = i - candidate;
+                if (length == limit) break;
+            }
+        }
+
+        if (best >= MIN_MATCH) {
+            const uint32_t lengthCode = LENGTH_CODE[best];
+            literal(257 + lengthCode);
+            bits.Add(static_cast<uint32_t>(best - LENGTH_BASE[lengthCode]), LENGTH_EXTRA[lengthCode]);
+            const uint32_t distanceCode = DistanceCode(static_cast<uint32_t>(bestDistance));
+            bits.Add(Reverse(distanceCode, 5), 5);
+            bits.Add(static_cast<uint32_t>(bestDistance - DISTANCE_BASE[distanceCode]), DistanceExtra(distanceCode));
+            for (size_t end = i + best; i != end; ++i)
+                if (i + MIN_MATCH <= size) insert(i);
+        } else {
+            insert(i);
+            literal(data[i++]);
+        }
+    }
+    for (; i != size; ++i) literal(data[i]);
+    literal(END_OF_BLOCK);
+
+    bits.Add(0, 3);   // empty stored block: BFINAL = 0, BTYPE = 00, aligned, LEN = 0, NLEN = 0xFFFF
+    bits.AlignToByte();
+    out.insert(out.end(), { 0x00, 0x00, 0xFF, 0xFF });
+}
+
+inline unsigned char Paeth(int a, int b, int c) {
+    const int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc) return static_cast<unsigned char>(a);
+    return static_cast<unsigned char>(pb <= pc ? b : c);
+}
+
+// PNG filter `type` of a row against the row above it; `bpp` is the distance to the same byte of the left pixel
+void FilterRow(uint32_t type, const unsigned char* row, const unsigned char* above, size_t size, size_t bpp,
+               unsigned char* out) {
+    for (size_t i = 0; i != size; ++i) {
+        const int left = i >= bpp ? row[i - bpp] : 0;
+        const int upperLeft = i >= bpp ? above[i - bpp] : 0;
+        switch (type) {
+        case 0: out[i] = row[i]; break;
+        case 1: out[i] = static_cast<unsigned char>(row[i] - left); break;
+        case 2: out[i] = static_cast<unsigned char>(row[i] - above[i]); break;
+        case 3: out[i] = static_cast<unsigned char>(row[i] - ((left + above[i]) >> 1)); break;
+        default: out[i] = static_cast<unsigned char>(row[i] - Paeth(left, above[i], upperLeft)); break;
+        }
+    }
+}
+
+// Filtered rows of a band, each prefixed by its filter type; the filter is the one with the smallest sum of
+//     absolute (signed) residuals, the usual heuristic
+void FilterBand(const RowSource& rows, uint32_t y0, uint32_t y1, size_t rowBytes, size_t bpp, int level, Bytes& out) {
+    Bytes above(rowBytes, 0), row(rowBytes), candidate(rowBytes);
+    if (y0 != 0) rows(y0 - 1, above.data());
+
+    out.resize((y1 - y0) * (rowBytes + 1));
+    for (uint32_t y = y0; y != y1; ++y) {
+        rows(y, row.data());
+        unsigned char* target = out.data() + (y - y0) * (rowBytes + 1);
+
+        uint32_t bestType = 0;
+        if (level > 0) {
+            uint64_t bestCost = UINT64_MAX;
+            for (uint32_t type = 0; type != 5; ++type) {
+                FilterRow(type, row.data(), above.data(), rowBytes, bpp, candidate.data());
+                uint64_t cost = 0;
+                for (unsigned char residual : candidate) cost += std::abs(static_cast<signed char>(residual));
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestType = type;
+                }
+            }
+        }
+        target[0] = static_cast<unsigned char>(bestType);
+        FilterRow(bestType, row.data(), above.data(), rowBytes, bpp, target + 1);
+        std::swap(above, row);
+    }
+}
+
+bool WriteFile(const std::string& path, const Bytes& header, const std::vector<Bytes>& parts) {
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(header.data()), static_cast<std::streamsize>(header.size()));
+    for (const Bytes& part : parts)
+        file.write(reinterpret_cast<const char*>(part.data()), static_cast<std::streamsize>(part.size()));
+    return static_cast<bool>(file);
+}
+
+}   // namespace
+
+bool WritePNG(const std::string& path, uint32_t width, uint32_t height, uint32_t channels, uint32_t bitDepth,
+              int compression, const RowSource& rows) {
+    const size_t bpp = channels * bitDepth / 8;
+    const size_t rowBytes = width * bpp;
+    const uint32_t bandRows = static_cast<uint32_t>(std::max<size_t>(1, PNG_BAND_BYTES / (rowBytes + 1)));
+    const uint32_t bandCount = (height + bandRows - 1) / bandRows;
+
+    // each band becomes one IDAT chunk; together they hold a single zlib stream
+    std::vector<Bytes> chunks(bandCount);
+    std::vector<uint32_t> adlers(bandCount);
+    std::vector<size_t> sizes(bandCount);
+    ParallelFor(bandCount, [&](uint32_t band, uint32_t) {
+        Bytes filtered, compressed;
+        FilterBand(rows, band * bandRows, std::min(height, (band + 1) * bandRows), rowBytes, bpp, compression,
+                   filtered);
+        adlers[band] = Adler32(filtered.data(), filtered.size());
+        sizes[band] = filtered.size();
+
+        if (band == 0) compressed = { 0x78, 0x01 };   // zlib header: deflate, 32K window
+        DeflateBand(filtered.data(), filtered.size(), compression, compressed);
+        AppendChunk(chunks[band], "IDAT", compressed.data(), compressed.size());
+    });
+
+    uint32_t adler = 1;
+    for (uint32_t band = 0; band != bandCount; ++band) adler = AdlerCombine(adler, adlers[band], sizes[band]);
+    Bytes tail = { 0x03, 0x00 };   // empty final block with the fixed code
+    PutBigEndian(tail, adler);
+    chunks.emplace_back();
+    AppendChunk(chunks.back(), "IDAT", tail.data(), tail.size());
+    chunks.emplace_back();
+    AppendChunk(chunks.back(), "IEND", nullptr, 0);
+
+    static constexpr unsigned char COLOR_TYPE[] = { 0, 0, 0, 2, 6 };   // by channel count
+    Bytes header = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    Bytes ihdr;
+    PutBigEndian(ihdr, width);
+    PutBigEndian(ihdr, height);
+    ihdr.insert(ihdr.end(), { static_cast<unsigned char>(bitDepth), COLOR_TYPE[channels], 0, 0, 0 });
+    AppendChunk(header, "IHDR", ihdr.data(), ihdr.size());
+    return WriteFile(path, header, chunks);
+}
+
+bool WritePNM(const std::string& path, uint32_t width, uint32_t height, uint32_t channels, uint32_t bitDepth,
+              const RowSource& rows) {
+    const std::string text = std::string(channels == 1 ? "P5\n" : "P6\n") + std::to_string(width) + " "
+                           + std::to_string(height) + "\n" + (bitDepth == 16 ? "65535" : "255") + "\n";
+    const Bytes header(text.begin(), text.end());
+    std::vector<Bytes> body(1, Bytes(static_cast<size_t>(height) * width * channels * bitDepth / 8));
+    const size_t rowBytes = body[0].size() / std::max(height, 1u);
+    for (uint32_t y = 0; y != height; ++y) rows(y, body[0].data() + y * rowBytes);
+    return WriteFile(path, header, body);
+}
+
+bool WritePFM(const std::string& path, uint32_t width, uint32_t height, uint32_t channels,
+              const FloatRowSource& rows) {
+    // a negative scale marks little-endian data; rows are stored from the bottom up
+    const std::string text = std::string(channels == 1 ? "Pf\n" : "PF\n") + std::to_string(width) + " "
+                           + std::to_string(height) + "\n"
+                           + (std::endian::native == std::endian::little ? "-1.0" : "1.0") + "\n";
+    const Bytes header(text.begin(), text.end());
+    std::vector<float> values(static_cast<size_t>(height) * width * channels);
+    const size_t rowValues = static_cast<size_t>(width) * channels;
+    for (uint32_t y = 0; y != height; ++y) rows(height - 1 - y, values.data() + y * rowValues);
+
+    std::vector<Bytes> body(1, Bytes(values.size() * sizeof(float)));
+    std::memcpy(body[0].data(), values.data(), body[0].size());
+    return WriteFile(path, header, body);
+}
+
+bool WriteQOI(const std::string& path, uint32_t width, uint32_t height, uint32_t channels, const RowSource& rows) {
+    struct Pixel {
+        unsigned char r, g, b, a;
+        bool operator==(const Pixel&) const = default;
+    };
+
+    Bytes header = { 'q', 'o', 'i', 'f' };
+    PutBigEndian(header, width);
+    PutBigEndian(header, height);
+    header.insert(header.end(), { static_cast<unsigned char>(channels), 0 });
+
+    std::vector<Bytes> body(1);
+    Bytes& out = body[0];
+    out.reserve(static_cast<size_t>(width) * height * (channels + 1) / 2);
+    std::array<Pixel, 64> seen {};
+    Pixel last = { 0, 0, 0, 255 };
+    uint32_t run = 0;
+    Bytes row(static_cast<size_t>(width) * channels);
+    for (uint32_t y = 0; y != height; ++y) {
+        rows(y, row.data());
+        for (uint32_t x = 0; x != width; ++x) {
+            const unsigned char* source = row.data() + static_cast<size_t>(x) * channels;
+            const Pixel pixel = { source[0], source[1], source[2], channels == 4 ? source[3] : last.a };
+            if (pixel == last) {
+                if (++run == 62) {
+                    out.push_back(static_cast<unsigned char>(0xC0 | (run - 1)));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run != 0) {
+                out.push_back(static_cast<unsigned char>(0xC0 | (run - 1)));
+                run = 0;
+            }
+
+            const uint32_t slot = (pixel.r * 3 + pixel.g * 5 + pixel.b * 7 + pixel.a * 11) % 64;
+            if (seen[slot] == pixel) {
+                out.push_back(static_cast<unsigned char>(slot));
+            } else if (pixel.a == last.a) {
+                const int dr = static_cast<signed char>(pixel.r - last.r);
+                const int dg = static_cast<signed char>(pixel.g - last.g);
+                const int db = static_cast<signed char>(pixel.b - last.b);
+                const int drg = dr - dg, dbg = db - dg;
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                    out.push_back(static_cast<unsigned char>(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+                } else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+                    out.push_back(static_cast<unsigned char>(0x80 | (dg + 32)));
+                    out.push_back(static_cast<unsigned char>((drg + 8) << 4 | (dbg + 8)));
+                } else {
+                    out.insert(out.end(), { 0xFE, pixel.r, pixel.g, pixel.b });
+                }
+            } else {
+                out.insert(out.end(), { 0xFF, pixel.r, pixel.g, pixel.b, pixel.a });
+            }
+            seen[slot] = pixel;
+            last = pixel;
+        }
+    }
+    if (run != 0) out.push_back(static_cast<unsigned char>(0xC0 | (run - 1)));
+    out.insert(out.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+    return WriteFile(path, header, body);
+}
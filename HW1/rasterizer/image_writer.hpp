@@ -0,0 +1,42 @@
+// Image file encoders: PNG with filtering and deflate done per band of rows in parallel, and raw formats (PPM, PFM,
+//     QOI) that cost next to nothing to produce for pipelines that post-process the output anyway
+
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+enum class ImageFormat { PNG, PPM, PFM, QOI };
+
+struct WriteOptions {
+    ImageFormat format = ImageFormat::PNG;
+    int compression = 6;      // PNG deflate effort, from 0 (stored, fastest) to 9
+    uint32_t depthBits = 8;   // bits per pixel of greyscale PNG/PPM output, 8 or 16
+};
+
+// Writes row y of the picture, counted from the top, into `row`; rows are requested from several threads at once.
+//     Samples are bytes, or big-endian pairs of bytes for 16-bit output.
+using RowSource = std::function<void(uint32_t y, unsigned char* row)>;
+
+// Float variant for PFM, `channels` floats per pixel
+using FloatRowSource = std::function<void(uint32_t y, float* row)>;
+
+// 1 (grey), 3 (RGB) or 4 (RGBA) channels of 8 or 16 bits. Bands of rows are filtered and deflated independently on
+//     all cores and stored as consecutive IDAT chunks; matches never reach across bands, which costs a little size.
+bool WritePNG(const std::string& path, uint32_t width, uint32_t height, uint32_t channels, uint32_t bitDepth,
+              int compression, const RowSource& rows);
+
+// Binary PGM (1 channel) or PPM (3 channels) of 8 or 16 bits
+bool WritePNM(const std::string& path, uint32_t width, uint32_t height, uint32_t channels, uint32_t bitDepth,
+              const RowSource& rows);
+
+// Little-endian PFM with 1 or 3 float channels
+bool WritePFM(const std::string& path, uint32_t width, uint32_t height, uint32_t channels,
+              const FloatRowSource& rows);
+
+// QOI with 3 or 4 channels of 8 bits
+bool WriteQOI(const std::string& path, uint32_t width, uint32_t height, uint32_t channels, const RowSource& rows);
+
+#endif
@@ -0,0 +1,138 @@
+#include "instancing.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+
+#include "../thirdparty/glm/gtx/quaternion.hpp"
+#include "../thirdparty/glm/gtx/transform.hpp"
+#include "../thirdparty/tinyobj/tiny_obj_loader.h"
+
+namespace {
+
+// `out[i] = m * (x[i], y[i], z[i], 1)` for row `row` of the product and i in [first, first + count), with the
+//     operations in the order glm's matrix-vector product uses, so that results match the per-face loop bit for bit
+void TransformRow(const glm::mat4& m, int row, const std::vector<float>& x, const std::vector<float>& y,
+                  const std::vector<float>& z, std::vector<float>& out, size_t first, size_t count) {
+    const float a = m[0][row], b = m[1][row], c = m[2][row], d = m[3][row];
+    const float* px = x.data() + first;
+    const float* py = y.data() + first;
+    const float* pz = z.data() + first;
+    float* result = out.data() + first;
+    for (size_t i = 0; i < count; ++i) result[i] = (a * px[i] + b * py[i]) + (c * pz[i] + d);
+}
+
+// Same with a w per element; d * 1 is exact, so elements with w = 1 get the very same bits
+void TransformRow(const glm::mat4& m, int row, const std::vector<float>& x, const std::vector<float>& y,
+                  const std::vector<float>& z, const std::vector<float>& w, std::vector<float>& out, size_t first,
+                  size_t count) {
+    const float a = m[0][row], b = m[1][row], c = m[2][row], d = m[3][row];
+    const float* px = x.data() + first;
+    const float* py = y.data() + first;
+    const float* pz = z.data() + first;
+    const float* pw = w.data() + first;
+    float* result = out.data() + first;
+    for (size_t i = 0; i < count; ++i) result[i] = (a * px[i] + b * py[i]) + (c * pz[i] + d * pw[i]);
+}
+
+}   // namespace
+
+glm::mat4 ComposeTransform(const MeshTransform& transform) {
+    return glm::translate(glm::mat4(1.f), transform.translation) * glm::toMat4(transform.rotation)
+         * glm::scale(glm::mat4(1.f), transform.scale);
+}
+
+InstancedMesh::InstancedMesh(const tinyobj::shape_t& shape, const tinyobj::attrib_t& attribs,
+                             const ShapeClusters* clusters) {
+    constexpr float FAR = std::numeric_limits<float>::infinity();
+    this->boundsMin = glm::vec3(FAR);
+    this->boundsMax = glm::vec3(-FAR);
+
+    // corners sharing all three indices become one vertex, so each is transformed once per instance
+    struct Key {
+        int vertex, normal, texcoord;
+        bool operator==(const Key&) const = default;
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            const size_t vertex = static_cast<size_t>(key.vertex) * 0x9E3779B97F4A7C15ull;
+            return vertex ^ (static_cast<size_t>(key.normal) << 21) ^ static_cast<size_t>(key.texcoord);
+        }
+    };
+    std::unordered_map<Key, uint32_t, KeyHash> vertices;
+
+    const uint32_t faceCount = static_cast<uint32_t>(shape.mesh.num_face_vertices.size());
+    this->corners.reserve(3 * size_t(faceCount));
+    // vertices are not shared across clusters, so that each one's transform covers only its own
+    auto addFace = [&](uint32_t face) {
+        for (size_t c = 3 * size_t(face); c < 3 * size_t(face) + 3; ++c) {
+            const tinyobj::index_t& idx = shape.mesh.indices[c];
+            const Key key { idx.vertex_index, idx.normal_index, idx.texcoord_index };
+            const auto [found, added] = vertices.try_emplace(key, static_cast<uint32_t>(this->px.size()));
+            this->corners.push_back(found->second);
+            if (added) this->AddVertex(idx, attribs);
+        }
+    };
+    auto addRange = [&](uint32_t firstVertex, uint32_t firstFace) {
+        this->ranges.push_back({ firstVertex, static_cast<uint32_t>(this->px.size()) - firstVertex, firstFace,
+                                 static_cast<uint32_t>(this->corners.size() / 3) - firstFace });
+    };
+    if (clusters && !clusters->clusters.empty()) {
+        for (const Cluster& cluster : clusters->clusters) {
+            vertices.clear();
+            const uint32_t firstVertex = static_cast<uint32_t>(this->px.size());
+            for (uint32_t i = cluster.firstFace; i < cluster.firstFace + cluster.faceCount; ++i)
+                addFace(clusters->faces[i]);
+            addRange(firstVertex, cluster.firstFace);
+        }
+    } else {
+        for (uint32_t face = 0; face < faceCount; ++face) addFace(face);
+        addRange(0, 0);
+    }
+
+    const size_t count = this->px.size();
+    for (auto* column : { &this->clipX, &this->clipY, &this->clipZ, &this->clipW, &this->worldX, &this->worldY,
+                          &this->worldZ, &this->worldW, &this->normalX, &this->normalY, &this->normalZ,
+                          &this->normalW })
+        column->resize(count);
+}
+
+void InstancedMesh::AddVertex(const tinyobj::index_t& idx, const tinyobj::attrib_t& attribs) {
+    const float* p = &attribs.vertices[3 * size_t(idx.vertex_index)];
+    this->px.push_back(p[0]);
+    this->py.push_back(p[1]);
+    this->pz.push_back(p[2]);
+    this->boundsMin = glm::min(this->boundsMin, glm::vec3(p[0], p[1], p[2]));
+    this->boundsMax = glm::max(this->boundsMax, glm::vec3(p[0], p[1], p[2]));
+    const float* n = idx.normal_index >= 0 ? &attribs.normals[3 * size_t(idx.normal_index)] : nullptr;
+    this->nx.push_back(n ? n[0] : 0.f);
+    this->ny.push_back(n ? n[1] : 0.f);
+    this->nz.push_back(n ? n[2] : 0.f);
+    this->nw.push_back(n ? 1.f : 0.f);
+    const float* t = idx.texcoord_index >= 0 ? &attribs.texcoords[2 * size_t(idx.texcoord_index)] : nullptr;
+    this->u.push_back(t ? t[0] : 0.f);
+    this->v.push_back(t ? t[1] : 0.f);
+}
+
+bool InstancedMesh::Visible(const glm::mat4& modelViewProjection, uint32_t width, uint32_t height) const {
+    if (this->px.empty()) return false;
+    return OnScreen(ProjectBox(this->boundsMin, this->boundsMax, modelViewProjection), width, height);
+}
+
+void InstancedMesh::Transform(const glm::mat4& model, const glm::mat4& modelViewProjection, uint32_t cluster) {
+    const size_t first = this->ranges[cluster].firstVertex;
+    const size_t count = this->ranges[cluster].vertexCount;
+    TransformRow(modelViewProjection, 0, this->px, this->py, this->pz, this->clipX, first, count);
+    TransformRow(modelViewProjection, 1, this->px, this->py, this->pz, this->clipY, first, count);
+    TransformRow(modelViewProjection, 2, this->px, this->py, this->pz, this->clipZ, first, count);
+    TransformRow(modelViewProjection, 3, this->px, this->py, this->pz, this->clipW, first, count);
+    TransformRow(model, 0, this->px, this->py, this->pz, this->worldX, first, count);
+    TransformRow(model, 1, this->px, this->py, this->pz, this->worldY, first, count);
+    TransformRow(model, 2, this->px, this->py, this->pz, this->worldZ, first, count);
+    TransformRow(model, 3, this->px, this->py, this->pz, this->worldW, first, count);
+    // normals go through the full model matrix like in the per-face loop; missing ones stay zero
+    TransformRow(model, 0, this->nx, this->ny, this->nz, this->nw, this->normalX, first, count);
+    TransformRow(model, 1, this->nx, this->ny, this->nz, this->nw, this->normalY, first, count);
+    TransformRow(model, 2, this->nx, this->ny, this->nz, this->nw, this->normalZ, first, count);
+    TransformRow(model, 3, this->nx, this->ny, this->nz, this->nw, this->normalW, first, count);
+}
@@ -0,0 +1,87 @@
+// Instanced drawing: one shape of the model drawn under many transforms (the `instances` of a config). The shape's
+//     vertices are gathered once into structure-of-arrays form; each instance then transforms all of them in lane
+//     loops the compiler vectorizes, instead of three matrix products per face. With clusters, the vertices are
+//     gathered per cluster so that each instance only transforms the clusters it draws.
+
+#ifndef INSTANCING_H
+#define INSTANCING_H
+
+#include <cstdint>
+#include <vector>
+
+#include "../thirdparty/glm/glm.hpp"
+#include "../thirdparty/tinyobj/tiny_obj_fwd.h"
+#include "clusters.hpp"
+#include "entities.hpp"
+
+namespace tinyobj {
+struct shape_t;
+struct attrib_t;
+struct index_t;
+}
+
+// Triangles of consecutive instances set up before the raster passes that run once per shape are flushed
+constexpr uint32_t INSTANCE_BATCH_TRIANGLES = 4096;
+
+// Model matrix of an instance: scale, then rotation, then translation
+glm::mat4 ComposeTransform(const MeshTransform& transform);
+
+class InstancedMesh {
+public:
+    // Faces are kept in the order of `clusters`, one vertex range per cluster, or as one range without them
+    InstancedMesh(const tinyobj::shape_t& shape, const tinyobj::attrib_t& attribs,
+                  const ShapeClusters* clusters = nullptr);
+
+    inline size_t FaceCount() const { return this->corners.size() / 3; }
+    inline uint32_t ClusterCount() const { return static_cast<uint32_t>(this->ranges.size()); }
+    // Faces [first, first + count) of the mesh belong to cluster `cluster`
+    inline uint32_t ClusterFirstFace(uint32_t cluster) const { return this->ranges[cluster].firstFace; }
+    inline uint32_t ClusterFaceCount(uint32_t cluster) const { return this->ranges[cluster].faceCount; }
+
+    // Whether an instance drawn with `modelViewProjection` (model to screen, before the perspective divide) may
+    //     reach a width x height screen. Only instances whose bounding box lies entirely in front of the camera and
+    //     entirely off-screen are culled: their triangles project into the box's projection, so none of them could
+    //     have been drawn.
+    bool Visible(const glm::mat4& modelViewProjection, uint32_t width, uint32_t height) const;
+
+    // Transform the vertices of one cluster for one instance; Face then reads its triangles
+    void Transform(const glm::mat4& model, const glm::mat4& modelViewProjection, uint32_t cluster);
+
+    // Face `face` of the cluster last transformed for it, with the same values the renderer's per-face loop computes
+    //     for a shape drawn with the instance's matrices. Corners without a normal, which that loop leaves unset,
+    //     get a zero normal.
+    inline void Face(size_t face, Triangle& transformed, Triangle& original) const {
+        for (size_t v = 0; v < 3; ++v) {
+            const uint32_t i = this->corners[3 * face + v];
+            transformed.pos[v] = glm::vec4(this->clipX[i], this->clipY[i], this->clipZ[i], this->clipW[i]);
+            original.pos[v] = glm::vec4(this->worldX[i], this->worldY[i], this->worldZ[i], this->worldW[i]);
+            original.normal[v] = glm::vec4(this->normalX[i], this->normalY[i], this->normalZ[i], this->normalW[i]);
+            original.tex_coord[v] = glm::vec2(this->u[i], this->v[i]);
+        }
+        transformed.tex_coord = original.tex_coord;
+    }
+
+private:
+    struct Range {
+        uint32_t firstVertex, vertexCount;
+        uint32_t firstFace, faceCount;
+    };
+
+    // distinct (position, normal, tex coord) corners of each cluster; missing normals and tex coords are zero
+    std::vector<float> px, py, pz;
+    std::vector<float> nx, ny, nz;
+    std::vector<float> nw;   // 1 for corners with a normal, 0 keeps the transformed normal of the others zero
+    std::vector<float> u, v;
+    std::vector<uint32_t> corners;   // three vertex indices per face
+    std::vector<Range> ranges;       // by cluster
+    glm::vec3 boundsMin, boundsMax;   // model space
+
+    // the vertices of the last transformed instance
+    std::vector<float> clipX, clipY, clipZ, clipW;
+    std::vector<float> worldX, worldY, worldZ, worldW;
+    std::vector<float> normalX, normalY, normalZ, normalW;
+
+    void AddVertex(const tinyobj::index_t& idx, const tinyobj::attrib_t& attribs);
+};
+
+#endif
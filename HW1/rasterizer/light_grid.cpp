@@ -0,0 +1,91 @@
+#include "light_grid.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Cell coordinates of `p` along each axis, clamped to the grid
+glm::uvec3 CellOf(glm::vec3 p, glm::vec3 origin, float invCellSize, glm::uvec3 cells) {
+    const glm::vec3 c = glm::floor((p - origin) * invCellSize);
+    const glm::vec3 last = glm::vec3(cells) - 1.f;
+    return glm::uvec3(glm::clamp(c, glm::vec3(0.f), last));
+}
+
+}   // namespace
+
+void LightGrid::Build(const std::vector<Light>& lights) {
+    this->spheres.clear();
+    this->unbounded.clear();
+    this->cellStart.clear();
+    this->cellLights.clear();
+    this->cells = glm::uvec3(0);
+
+    glm::vec3 lo(std::numeric_limits<float>::infinity()), hi(-std::numeric_limits<float>::infinity());
+    float radiusSum = 0.f;
+    for (uint32_t i = 0; i < lights.size(); ++i) {
+        const Light& light = lights[i];
+        this->spheres.emplace_back(light.pos, light.radius);
+        if (!light.Bounded()) {
+            this->unbounded.push_back(i);
+            continue;
+        }
+        lo = glm::min(lo, light.pos - light.radius);
+        hi = glm::max(hi, light.pos + light.radius);
+        radiusSum += light.radius;
+    }
+    const size_t bounded = this->BoundedCount();
+    if (bounded == 0) return;
+
+    // cells about as wide as a light, unless that would make too many of them
+    const glm::vec3 extent = hi - lo;
+    const float widest = std::max({ extent.x, extent.y, extent.z });
+    const float cellSize = std::max({ radiusSum / static_cast<float>(bounded), widest / LIGHT_GRID_MAX_CELLS, 1e-6f });
+    this->origin = lo;
+    this->invCellSize = 1.f / cellSize;
+    this->cells = glm::uvec3(glm::clamp(glm::ceil(extent * this->invCellSize), glm::vec3(1.f),
+                                        glm::vec3(static_cast<float>(LIGHT_GRID_MAX_CELLS))));
+
+    // count, prefix-sum, then fill in light order, so every cell's list comes out sorted
+    const size_t cellCount = static_cast<size_t>(this->cells.x) * this->cells.y * this->cells.z;
+    this->cellStart.assign(cellCount + 1, 0);
+    auto forEachCell = [&](const Light& light, auto&& visit) {
+        const glm::uvec3 c0 = CellOf(light.pos - light.radius, this->origin, this->invCellSize, this->cells);
+        const glm::uvec3 c1 = CellOf(light.pos + light.radius, this->origin, this->invCellSize, this->cells);
+        for (uint32_t z = c0.z; z <= c1.z; ++z)
+            for (uint32_t y = c0.y; y <= c1.y; ++y)
+                for (uint32_t x = c0.x; x <= c1.x; ++x) visit((size_t(z) * this->cells.y + y) * this->cells.x + x);
+    };
+    for (const Light& light : lights)
+        if (light.Bounded()) forEachCell(light, [&](size_t cell) { ++this->cellStart[cell + 1]; });
+    for (size_t c = 0; c < cellCount; ++c) this->cellStart[c + 1] += this->cellStart[c];
+
+    this->cellLights.resize(this->cellStart[cellCount]);
+    std::vector<uint32_t> cursor(this->cellStart.begin(), this->cellStart.end() - 1);
+    for (uint32_t i = 0; i < lights.size(); ++i)
+        if (lights[i].Bounded()) forEachCell(lights[i], [&](size_t cell) { this->cellLights[cursor[cell]++] = i; });
+}
+
+void LightGrid::Gather(glm::vec3 boxMin, glm::vec3 boxMax, std::vector<uint32_t>& out) const {
+    out.assign(this->unbounded.begin(), this->unbounded.end());
+    if (this->cells.x == 0) return;
+
+    const glm::uvec3 c0 = CellOf(boxMin, this->origin, this->invCellSize, this->cells);
+    const glm::uvec3 c1 = CellOf(boxMax, this->origin, this->invCellSize, this->cells);
+    for (uint32_t z = c0.z; z <= c1.z; ++z)
+        for (uint32_t y = c0.y; y <= c1.y; ++y)
+            for (uint32_t x = c0.x; x <= c1.x; ++x) {
+                const size_t cell = (size_t(z) * this->cells.y + y) * this->cells.x + x;
+                for (uint32_t k = this->cellStart[cell]; k < this->cellStart[cell + 1]; ++k) {
+                    // cells are coarse and the box is clamped into the grid, so test the sphere itself
+                    const glm::vec4 sphere = this->spheres[this->cellLights[k]];
+                    const glm::vec3 center(sphere);
+                    const glm::vec3 d = glm::clamp(center, boxMin, boxMax) - center;
+                    if (glm::dot(d, d) <= sphere.w * sphere.w) out.push_back(this->cellLights[k]);
+                }
+            }
+
+    // a light overlapping several of the cells was added once per cell
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+}
@@ -0,0 +1,40 @@
+// Uniform grid over the spheres of influence of bounded lights, so shading only visits the lights that reach it
+
+#ifndef LIGHT_GRID_H
+#define LIGHT_GRID_H
+
+#include <cstdint>
+#include <vector>
+
+#include "../thirdparty/glm/glm.hpp"
+#include "entities.hpp"
+
+// Cells per axis at most; the cell size otherwise follows the mean light radius
+constexpr uint32_t LIGHT_GRID_MAX_CELLS = 64;
+
+class LightGrid {
+public:
+    // Bucket every bounded light into the cells its sphere's box overlaps. Unbounded lights are kept aside and
+    //     returned by every query.
+    void Build(const std::vector<Light>& lights);
+
+    // Replace `out` with the lights whose sphere meets the box [boxMin, boxMax] (world space), unbounded lights
+    //     included, as indices into the lights of the last Build in increasing order. The order is the one of a loop
+    //     over all lights, so shading through the grid sums the same terms in the same order.
+    void Gather(glm::vec3 boxMin, glm::vec3 boxMax, std::vector<uint32_t>& out) const;
+
+    inline size_t LightCount() const { return this->spheres.size(); }
+    inline size_t BoundedCount() const { return this->spheres.size() - this->unbounded.size(); }
+
+private:
+    glm::vec3 origin {};
+    float invCellSize = 0.f;
+    glm::uvec3 cells {};   // 0 without bounded lights
+
+    std::vector<glm::vec4> spheres;     // center and radius of every light, by light index
+    std::vector<uint32_t> unbounded;    // indices of lights without a radius
+    std::vector<uint32_t> cellStart;    // lights of cell c are cellLights[cellStart[c], cellStart[c + 1])
+    std::vector<uint32_t> cellLights;
+};
+
+#endif
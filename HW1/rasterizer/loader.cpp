@@ -1,12 +1,20 @@
 #include "loader.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "../thirdparty/fkyaml/node.hpp"
 #include "image.hpp"
+#include "yaml_lists.hpp"
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #define TINYOBJLOADER_USE_MAPBOX_EARCUT   // use robust triangulation
@@ -88,6 +96,130 @@ void LoadQuat(const fkyaml::node& parent, std::string tag, glm::quat& quat) {
 #define LOAD_COLOR_FROM_YAML(node, tag, vec) LoadColor(node, #tag, vec);
 #define LOAD_QUAT_FROM_YAML(node, tag, vec) LoadQuat(node, #tag, vec);
 
+// The items of a list of transforms
+void LoadTransformList(const fkyaml::node& list, std::vector<MeshTransform>& transforms) {
+    for (auto& subnode : list) {
+        glm::quat rotation;
+        glm::vec3 translation, scale;
+        LOAD_QUAT_FROM_YAML(subnode, rotation, rotation)
+        LOAD_VEC3_FROM_YAML(subnode, translation, translation)
+        LOAD_VEC3_FROM_YAML(subnode, scale, scale)
+        glm::vec3 scale3(scale);
+        transforms.emplace_back(rotation, translation, scale3);
+    }
+}
+
+// Optional list of per-shape transforms under the `transforms` tag, unless the scanner already read it
+void LoadTransforms(const fkyaml::node& root, std::optional<std::vector<MeshTransform>>& scanned,
+                    std::vector<MeshTransform>& transforms) {
+    if (scanned) {
+        transforms = std::move(*scanned);
+        return;
+    }
+    LOAD_NODE_FROM_YAML_NOERROR(transformNode, root, transforms)
+    if (transformNode != root) LoadTransformList(transformNode, transforms);
+}
+
+// Optional copies of shapes under the `instances` tag. Each entry names a `shape` of the model and either lists
+//     its `transforms` or lays them out on a `grid`: `count` copies per axis, `spacing` apart from `origin`, all
+//     with the same `rotation` and `scale`.
+void LoadInstances(const fkyaml::node& root, std::vector<InstanceSet>& instances) {
+    if (!root.contains("instances")) return;
+    const auto& instanceNode = root["instances"];
+    if (!instanceNode.is_sequence()) throw fkyaml::exception("invalid instances: must be a list");
+
+    // bounds the memory a mistyped grid can ask for
+    const uint64_t MAX_INSTANCES = 1 << 24;
+    uint64_t total = 0;
+    for (auto& entry : instanceNode) {
+        InstanceSet set;
+        LOAD_DATA_FROM_YAML(set.shape, entry, shape, uint32_t)
+        if (entry.contains("transforms")) {
+            LoadTransformList(entry["transforms"], set.transforms);
+        } else if (entry.contains("grid")) {
+            LOAD_NODE_FROM_YAML(gridNode, entry, grid)
+            LOAD_NODE_FROM_YAML(countNode, gridNode, count)
+            const glm::uvec3 count(countNode[0].get_value<uint32_t>(), countNode[1].get_value<uint32_t>(),
+                                   countNode[2].get_value<uint32_t>());
+            if (static_cast<uint64_t>(count.x) * count.y * count.z > MAX_INSTANCES - total)
+                throw fkyaml::exception("invalid instances: more than 16777216 copies");
+            glm::vec3 spacing, origin(0.f), scale(1.f);
+            glm::quat rotation(1.f, 0.f, 0.f, 0.f);
+            LOAD_VEC3_FROM_YAML(gridNode, spacing, spacing)
+            if (gridNode.contains("origin")) LOAD_VEC3_FROM_YAML(gridNode, origin, origin)
+            if (gridNode.contains("rotation")) LOAD_QUAT_FROM_YAML(gridNode, rotation, rotation)
+            if (gridNode.contains("scale")) LOAD_VEC3_FROM_YAML(gridNode, scale, scale)
+
+            set.transforms.reserve(static_cast<size_t>(count.x) * count.y * count.z);
+            for (uint32_t z = 0; z < count.z; ++z)
+                for (uint32_t y = 0; y < count.y; ++y)
+                    for (uint32_t x = 0; x < count.x; ++x)
+                        set.transforms.emplace_back(rotation, origin + spacing * glm::vec3(x, y, z), scale);
+        } else {
+            throw fkyaml::exception("missing tag transforms or grid in instances");
+        }
+        total += set.transforms.size();
+        if (total > MAX_INSTANCES) throw fkyaml::exception("invalid instances: more than 16777216 copies");
+        instances.push_back(std::move(set));
+    }
+}
+
+// The items of the top-level list `key`, read by the scanner (see yaml_lists.hpp) and cut out of `text` so that the
+//     YAML parser skips them; only the line breaks stay, so that its errors keep their line numbers. `convert` turns
+//     an item into an element, or returns false for items that only the parser can judge (missing fields, wrong
+//     types, out of range values); the whole list is then left in `text` and nothing comes back, so errors read
+//     exactly as before.
+template <typename T, typename Convert>
+std::optional<std::vector<T>> ScanList(std::string& text, std::string_view key, Convert&& convert) {
+    const std::optional<YamlBlock> block = FindYamlBlock(text, key);
+    if (!block) return std::nullopt;
+    std::vector<T> items;
+    auto scanned = [&](const YamlListItem& item) { return convert(item, items); };
+    if (!ScanYamlList(std::string_view(text).substr(block->begin, block->end - block->begin), scanned))
+        return std::nullopt;
+    const auto first = text.begin() + static_cast<ptrdiff_t>(block->begin);
+    const auto last = text.begin() + static_cast<ptrdiff_t>(block->end);
+    text.erase(std::remove_if(first, last, [](char c) { return c != '\n'; }), last);
+    return items;
+}
+
+bool ScanTransform(const YamlListItem& item, std::vector<MeshTransform>& transforms) {
+    const YamlListField* rotation = item.Find("rotation");
+    const YamlListField* translation = item.Find("translation");
+    const YamlListField* scale = item.Find("scale");
+    if (!rotation || !rotation->Floats(4) || !translation || !translation->Floats(3) || !scale || !scale->Floats(3))
+        return false;
+    auto vec3 = [](const YamlListField* field) {
+        return glm::vec3(static_cast<float>(field->values[0]), static_cast<float>(field->values[1]),
+                         static_cast<float>(field->values[2]));
+    };
+    const glm::quat quat(static_cast<float>(rotation->values[0]), static_cast<float>(rotation->values[1]),
+                         static_cast<float>(rotation->values[2]), static_cast<float>(rotation->values[3]));
+    transforms.emplace_back(quat, vec3(translation), vec3(scale));
+    return true;
+}
+
+bool ScanLight(const YamlListItem& item, std::vector<Light>& lights) {
+    const YamlListField* pos = item.Find("pos");
+    const YamlListField* intensity = item.Find("intensity");
+    const YamlListField* color = item.Find("color");
+    const YamlListField* radius = item.Find("radius");
+    if (!pos || !pos->Floats(3) || !intensity || intensity->sequence || !intensity->isFloat[0] || !color
+        || !color->Integers(3) || (radius && (radius->sequence || !radius->isFloat[0])))
+        return false;
+    if (color->values[0] > 255. || color->values[1] > 255. || color->values[2] > 255.) return false;
+    const float lightRadius
+      = radius ? static_cast<float>(radius->values[0]) : std::numeric_limits<float>::infinity();
+    if (!(lightRadius > 0.f)) return false;
+
+    const glm::vec3 position(static_cast<float>(pos->values[0]), static_cast<float>(pos->values[1]),
+                             static_cast<float>(pos->values[2]));
+    const Color rgb(static_cast<unsigned char>(color->values[0]), static_cast<unsigned char>(color->values[1]),
+                    static_cast<unsigned char>(color->values[2]), 255);
+    lights.emplace_back(position, static_cast<float>(intensity->values[0]), rgb, lightRadius);
+    return true;
+}
+
 Loader::Loader(std::string filename)
     : Loader() {
     this->filename = filename;
@@ -99,7 +231,7 @@ bool Loader::Load() {
         std::cerr << "fail loading yaml. Quit.\n";
         return false;
     } else {
-        if (this->type == TestType::TEXTURE_TEST) {
+        if (this->type == TestType::TEXTURE_TEST || this->type == TestType::TEXTURE_BAKE) {
             return true;
         }
 
@@ -112,7 +244,50 @@ bool Loader::Load() {
     }
 }
 
+std::string Loader::ShadowInfo() const {
+    if (this->shadowMapSize == 0) return "off";
+    const std::string kernel = ", " + std::to_string(this->shadowFilter.kernel) + " texel kernel";
+    std::string filter;
+    switch (this->shadowFilter.filter) {
+    case ShadowFilter::PCF: filter = "pcf" + kernel; break;
+    case ShadowFilter::POISSON: filter = "poisson" + kernel; break;
+    case ShadowFilter::PCSS: filter = "pcss" + kernel + ", light size " + ToStr(this->shadowFilter.lightSize); break;
+    default: filter = "hard";
+    }
+    return std::to_string(this->shadowMapSize) + " per face (" + filter + ")";
+}
+
+std::string Loader::OutputFormatInfo() const {
+    switch (this->writeOptions.format) {
+    case ImageFormat::PPM: return "ppm";
+    case ImageFormat::PFM: return "pfm";
+    case ImageFormat::QOI: return "qoi";
+    default: return "png, compression " + std::to_string(this->writeOptions.compression);
+    }
+}
+
 bool Loader::LoadYaml() {
+    // read in one go; nothing when the file cannot be opened
+    std::optional<std::string> text;
+    std::ifstream ifs(filename, std::ios::binary | std::ios::ate);
+    if (ifs) {
+        text.emplace(static_cast<size_t>(ifs.tellg()), '\0');
+        ifs.seekg(0);
+        ifs.read(text->data(), static_cast<std::streamsize>(text->size()));
+        if (!ifs) text.reset();
+    }
+    return this->LoadYaml(std::move(text));
+}
+
+bool Loader::LoadYaml(std::optional<std::string> text) {
+    const auto parseStart = std::chrono::steady_clock::now();
+    const bool success = this->ParseYaml(text);
+    this->configMs
+      = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - parseStart).count();
+    return success;
+}
+
+bool Loader::ParseYaml(std::optional<std::string>& text) {
     // If the loader fails in any way, the resulting object must have TestType::ERROR
 
     // Parse the exact content of the config file here
@@ -120,12 +295,15 @@ bool Loader::LoadYaml() {
     //   directly setting type to TestType::ERROR so that the error can be
     //   correctly printed out.
     try {
-        std::ifstream ifs(filename);
-        if (!ifs) {
+        if (!text) {
             std::string msg = "error opening config file " + filename;
             throw fkyaml::exception(msg.c_str());
         }
-        fkyaml::node root = fkyaml::node::deserialize(ifs);
+        // The long lists are scanned straight into packed arrays; the YAML tree is only built for the rest
+        std::optional<std::vector<MeshTransform>> scannedTransforms
+          = ScanList<MeshTransform>(*text, "transforms", ScanTransform);
+        std::optional<std::vector<Light>> scannedLights = ScanList<Light>(*text, "lights", ScanLight);
+        fkyaml::node root = fkyaml::node::deserialize(*text);
 
         // type
         LOAD_DEF_DATA_FROM_YAML(task, root, task, std::string)
@@ -143,6 +321,10 @@ bool Loader::LoadYaml() {
             this->type = TestType::DEFERRED_SHADING;
         } else if (task == "texture-test") {
             this->type = TestType::TEXTURE_TEST;
+        } else if (task == "texture-bake") {
+            this->type = TestType::TEXTURE_BAKE;
+        } else if (task == "watertight-test") {
+            this->type = TestType::WATERTIGHT_TEST;
         } else {
             std::string msg = "cannot recognize test type " + task;
             throw fkyaml::exception(msg.c_str());
@@ -153,6 +335,14 @@ bool Loader::LoadYaml() {
             return true;
         }
 
+        // Offline conversion of a texture into a tiled mip chain for virtual texturing
+        if (this->type == TestType::TEXTURE_BAKE) {
+            LOAD_DATA_FROM_YAML(this->textureName, root, texture, std::string)
+            LOAD_DATA_FROM_YAML(this->outputName, root, output, std::string)
+            MAYBE_LOAD_DATA_FROM_YAML(this->tileSize, root, tile, uint32_t)
+            return true;
+        }
+
         // resolution
         LOAD_NODE_FROM_YAML(resNode, root, resolution)
         const uint32_t MAX_RES = 4096;
@@ -167,6 +357,41 @@ bool Loader::LoadYaml() {
         LOAD_DATA_FROM_YAML(this->outputName, root, output, std::string)
         MAYBE_LOAD_DATA_FROM_YAML(this->textureName, root, texture, std::string)
 
+        // Output encoding; png by default, raw formats skip compression entirely
+        std::string formatName = "png";
+        MAYBE_LOAD_DATA_FROM_YAML(formatName, root, format, std::string)
+        if (formatName == "ppm")
+            this->writeOptions.format = ImageFormat::PPM;
+        else if (formatName == "pfm")
+            this->writeOptions.format = ImageFormat::PFM;
+        else if (formatName == "qoi")
+            this->writeOptions.format = ImageFormat::QOI;
+        else if (formatName != "png")
+            throw fkyaml::exception(("cannot recognize format " + formatName).c_str());
+        MAYBE_LOAD_DATA_FROM_YAML(this->writeOptions.compression, root, compression, int)
+        if (this->writeOptions.compression < 0 || this->writeOptions.compression > 9)
+            throw fkyaml::exception("invalid compression: must be within 0..9");
+        MAYBE_LOAD_DATA_FROM_YAML(this->writeOptions.depthBits, root, depthbits, uint32_t)
+        if (this->writeOptions.depthBits != 8 && this->writeOptions.depthBits != 16)
+            throw fkyaml::exception("invalid depthbits: must be 8 or 16");
+        // Raw frames to a pipe or shared memory instead of a file
+        MAYBE_LOAD_DATA_FROM_YAML(this->streamTarget, root, stream, std::string)
+        // `pipeline: generic` draws with passes that check the task and anti-aliasing at every pixel, as a baseline
+        //     to time the specialized ones against (see Rasterizer::SelectPipeline)
+        std::string pipelineName = "specialized";
+        MAYBE_LOAD_DATA_FROM_YAML(pipelineName, root, pipeline, std::string)
+        if (pipelineName == "generic")
+            this->genericPipeline = true;
+        else if (pipelineName != "specialized")
+            throw fkyaml::exception(("cannot recognize pipeline " + pipelineName).c_str());
+
+        // The watertight test rasterizes the model orthographically, so only the transforms are needed
+        if (this->type == TestType::WATERTIGHT_TEST) {
+            LoadTransforms(root, scannedTransforms, this->transforms);
+            LoadInstances(root, this->instances);
+            return true;
+        }
+
         // If the task is TRANSFORM or SHADING, then there must be a camera; load it
         if (this->type != TestType::TRIANGLE) {
             // Load Camera
@@ -180,30 +405,43 @@ bool Loader::LoadYaml() {
             LOAD_DATA_FROM_YAML(camera.farClip, cameraNode, farClip, float)
 
             // Load Transforms
-            LOAD_NODE_FROM_YAML_NOERROR(transformNode, root, transforms)
-            if (transformNode != root) {
-                for (auto& subnode : transformNode) {
-                    glm::quat rotation;
-                    glm::vec3 translation, scale;
-                    LOAD_QUAT_FROM_YAML(subnode, rotation, rotation)
-                    LOAD_VEC3_FROM_YAML(subnode, translation, translation)
-                    LOAD_VEC3_FROM_YAML(subnode, scale, scale)
-                    glm::vec3 scale3(scale);
-                    this->transforms.emplace_back(rotation, translation, scale3);
-                }
-            }
+            LoadTransforms(root, scannedTransforms, this->transforms);
+            LoadInstances(root, this->instances);
+
+            // Simplified levels of each shape, picked per shape and instance from their size on screen
+            MAYBE_LOAD_DATA_FROM_YAML(this->lodCount, root, lods, uint32_t)
+            if (this->lodCount > MAX_LODS) throw fkyaml::exception("invalid lods: at most 4 levels");
+            MAYBE_LOAD_DATA_FROM_YAML(this->lodPixels, root, lodpixels, float)
+            if (!(this->lodPixels > 0.f)) throw fkyaml::exception("invalid lodpixels: must be positive");
+            // Clusters of up to `clusters` triangles, culled as units; `backfaces: cull` also drops those facing away
+            MAYBE_LOAD_DATA_FROM_YAML(this->clusterSize, root, clusters, uint32_t)
+            if (this->clusterSize > MAX_CLUSTER_TRIANGLES)
+                throw fkyaml::exception("invalid clusters: at most 256 triangles");
+            std::string backFaceName = "draw";
+            MAYBE_LOAD_DATA_FROM_YAML(backFaceName, root, backfaces, std::string)
+            if (backFaceName == "cull")
+                this->cullBackFaces = true;
+            else if (backFaceName != "draw")
+                throw fkyaml::exception(("cannot recognize backfaces " + backFaceName).c_str());
 
             // Load Light Infos
-            LOAD_NODE_FROM_YAML_NOERROR(lightNode, root, lights)
-            if (lightNode != root) {
-                for (auto& light : lightNode) {
-                    LOAD_DEF_DATA_FROM_YAML(intensity, light, intensity, float)
-                    glm::vec3 pos;
-                    LOAD_VEC3_FROM_YAML(light, pos, pos)
-
-                    Color color;
-                    LOAD_COLOR_FROM_YAML(light, color, color)
-                    this->lights.emplace_back(pos, intensity, color);
+            if (scannedLights) {
+                this->lights = std::move(*scannedLights);
+            } else {
+                LOAD_NODE_FROM_YAML_NOERROR(lightNode, root, lights)
+                if (lightNode != root) {
+                    for (auto& light : lightNode) {
+                        LOAD_DEF_DATA_FROM_YAML(intensity, light, intensity, float)
+                        glm::vec3 pos;
+                        LOAD_VEC3_FROM_YAML(light, pos, pos)
+
+                        Color color;
+                        LOAD_COLOR_FROM_YAML(light, color, color)
+                        float radius = std::numeric_limits<float>::infinity();
+                        MAYBE_LOAD_DATA_FROM_YAML(radius, light, radius, float)
+                        if (!(radius > 0.f)) throw fkyaml::exception("invalid light radius: must be positive");
+                        this->lights.emplace_back(pos, intensity, color, radius);
+                    }
                 }
             }
 
@@ -211,6 +449,65 @@ bool Loader::LoadYaml() {
                 LOAD_DATA_FROM_YAML(this->specularExponent, root, exponent, float)
                 LOAD_COLOR_FROM_YAML(root, ambient, this->ambientColor)
             }
+
+            if (this->type == TestType::DEFERRED_SHADING) {
+                std::string shaderName = "pixel";
+                MAYBE_LOAD_DATA_FROM_YAML(shaderName, root, shader, std::string)
+                if (shaderName == "batched")
+                    this->shader = ShaderConfig::BATCHED;
+                else if (shaderName != "pixel")
+                    throw fkyaml::exception(("cannot recognize shader " + shaderName).c_str());
+            }
+
+            // How the float color target is mapped to 8 bits; lights are free to overexpose with reinhard
+            if (this->type == TestType::SHADING || this->type == TestType::DEFERRED_SHADING) {
+                std::string toneMapName = "clamp";
+                MAYBE_LOAD_DATA_FROM_YAML(toneMapName, root, tonemap, std::string)
+                if (toneMapName == "reinhard")
+                    this->toneMap = ToneMap::REINHARD;
+                else if (toneMapName != "clamp")
+                    throw fkyaml::exception(("cannot recognize tonemap " + toneMapName).c_str());
+
+                // Cube shadow map per light, `shadows` texels per face side
+                MAYBE_LOAD_DATA_FROM_YAML(this->shadowMapSize, root, shadows, uint32_t)
+                if (this->shadowMapSize > MAX_RES)
+                    throw fkyaml::exception("invalid shadows: shadow map size exceeding 4096");
+                // Soft edges: `shadowfilter` picks the filter, `shadowkernel` its width in texels and `lightsize`
+                //     the light width PCSS derives penumbrae from
+                std::string filterName = "hard";
+                MAYBE_LOAD_DATA_FROM_YAML(filterName, root, shadowfilter, std::string)
+                if (filterName == "pcf")
+                    this->shadowFilter.filter = ShadowFilter::PCF;
+                else if (filterName == "poisson")
+                    this->shadowFilter.filter = ShadowFilter::POISSON;
+                else if (filterName == "pcss")
+                    this->shadowFilter.filter = ShadowFilter::PCSS;
+                else if (filterName != "hard")
+                    throw fkyaml::exception(("cannot recognize shadowfilter " + filterName).c_str());
+                MAYBE_LOAD_DATA_FROM_YAML(this->shadowFilter.kernel, root, shadowkernel, uint32_t)
+                if (this->shadowFilter.kernel % 2 == 0 || this->shadowFilter.kernel > SHADOW_MAX_KERNEL)
+                    throw fkyaml::exception("invalid shadowkernel: must be odd and at most 15");
+                MAYBE_LOAD_DATA_FROM_YAML(this->shadowFilter.lightSize, root, lightsize, float)
+                if (!(this->shadowFilter.lightSize > 0.f))
+                    throw fkyaml::exception("invalid lightsize: must be positive");
+
+                // Light falloff; `windowed` gives each light without a `radius` the distance at which its brightest
+                //     channel drops below `lightcutoff`, so that shading can skip it beyond
+                std::string attenuationName = "inverse-square";
+                MAYBE_LOAD_DATA_FROM_YAML(attenuationName, root, attenuation, std::string)
+                if (attenuationName == "windowed")
+                    this->windowedLights = true;
+                else if (attenuationName != "inverse-square")
+                    throw fkyaml::exception(("cannot recognize attenuation " + attenuationName).c_str());
+                MAYBE_LOAD_DATA_FROM_YAML(this->lightCutoff, root, lightcutoff, float)
+                if (!(this->lightCutoff > 0.f)) throw fkyaml::exception("invalid lightcutoff: must be positive");
+                if (this->windowedLights)
+                    for (Light& light : this->lights) {
+                        if (light.Bounded()) continue;
+                        const float brightest = std::max({ light.color.r, light.color.g, light.color.b });
+                        light.radius = std::sqrt(brightest / 255.f * light.intensity / this->lightCutoff);
+                    }
+            }
         } else if (this->type == TestType::TRIANGLE)
         // if the task is TRIANGLE, then need to check whether it is SSAA
         {
@@ -221,6 +518,13 @@ bool Loader::LoadYaml() {
             } else if (AAName == "SSAA") {
                 this->AAConfig = AntiAliasConfig::SSAA;
                 LOAD_DATA_FROM_YAML(this->AASpp, root, samples, uint32_t)
+
+                std::string filterName = "box";
+                MAYBE_LOAD_DATA_FROM_YAML(filterName, root, filter, std::string)
+                if (filterName == "tent")
+                    this->ssaaFilter = SSAAFilter::TENT;
+                else if (filterName != "box")
+                    throw fkyaml::exception(("cannot recognize filter " + filterName).c_str());
             } else if (AAName == "MSAA") {
                 this->AAConfig = AntiAliasConfig::SSAA;
                 LOAD_DATA_FROM_YAML(this->AASpp, root, samples, uint32_t)
@@ -252,7 +556,50 @@ bool Loader::LoadYaml() {
     return true;
 }
 
+void ModelMeshes::Summarize() {
+    constexpr float FAR = std::numeric_limits<float>::infinity();
+    for (size_t s = this->shapeHashes.size(); s < this->shapes.size(); ++s) {
+        // FNV-1a over the positions of the corners in order, so that an edited model never shares cached shadows
+        uint64_t hash = 0xCBF29CE484222325ull;
+        glm::vec3 boundsMin(FAR), boundsMax(-FAR);
+        for (const tinyobj::index_t& idx : this->shapes[s].mesh.indices) {
+            const float* v = &this->attribs.vertices[3 * size_t(idx.vertex_index)];
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(v);
+            for (size_t i = 0; i < 3 * sizeof(float); ++i) hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+            boundsMin = glm::min(boundsMin, glm::vec3(v[0], v[1], v[2]));
+            boundsMax = glm::max(boundsMax, glm::vec3(v[0], v[1], v[2]));
+        }
+        this->shapeHashes.push_back(hash);
+        this->shapeBounds.emplace_back(boundsMin, boundsMax);
+    }
+}
+
+void Loader::BuildLods() {
+    auto lods = std::make_shared<std::vector<ShapeLods>>();
+    if (this->lodCount != 0)
+        for (const tinyobj::shape_t& shape : this->meshes->shapes)
+            lods->push_back(::BuildLods(shape, this->meshes->attribs, this->lodCount));
+    this->lods = std::move(lods);
+}
+
+void Loader::BuildClusters() {
+    auto clusters = std::make_shared<std::vector<std::vector<ShapeClusters>>>();
+    if (this->clusterSize != 0)
+        for (size_t s = 0; s < this->meshes->shapes.size(); ++s) clusters->push_back(this->ClustersOf(s));
+    this->clusters = std::move(clusters);
+}
+
+std::vector<ShapeClusters> Loader::ClustersOf(size_t shape) const {
+    std::vector<ShapeClusters> levels;
+    levels.push_back(::BuildClusters(this->meshes->shapes[shape], this->meshes->attribs, this->clusterSize));
+    if (shape < this->lods->size())
+        for (const tinyobj::shape_t& level : (*this->lods)[shape].levels)
+            levels.push_back(::BuildClusters(level, this->meshes->attribs, this->clusterSize));
+    return levels;
+}
+
 bool Loader::LoadObj() {
+    const auto loadStart = std::chrono::steady_clock::now();
     std::string filename = this->modelName + ".obj";
     tinyobj::ObjReaderConfig readerConfig;
     readerConfig.mtl_search_path = "./";
@@ -269,8 +616,19 @@ bool Loader::LoadObj() {
 
     if (!reader.Warning().empty()) std::cout << "TinyObjReader [WARNING]: " << reader.Warning();
 
-    this->attribs = reader.GetAttrib();
-    this->shapes = reader.GetShapes();
+    auto meshes = std::make_shared<ModelMeshes>();
+    meshes->attribs = reader.GetAttrib();
+    meshes->shapes = reader.GetShapes();
+    meshes->Summarize();
+    this->meshes = std::move(meshes);
+    for (const InstanceSet& set : this->instances)
+        if (set.shape >= this->meshes->shapes.size()) {
+            std::cerr << "instances: " << filename << " has no shape " << set.shape << "\n";
+            return false;
+        }
+    this->BuildLods();
+    this->BuildClusters();
+    this->modelMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count();
 
     return true;
 }
@@ -1,12 +1,18 @@
 #ifndef LOADER_H
 #define LOADER_H
 
+#include <algorithm>
 #include <cstdint>
+#include <memory>
 #include <optional>
 #include <string>
 
 #include "../thirdparty/tinyobj/tiny_obj_fwd.h"
 #include "entities.hpp"
+#include "clusters.hpp"
+#include "image_writer.hpp"
+#include "lod.hpp"
+#include "shadow.hpp"
 
 namespace tinyobj {
 struct shape_t;
@@ -15,11 +21,26 @@ struct attrib_t;
 
 // Loads yaml config and obj models
 
+// The meshes of a model, read from its OBJ file or added in memory. Loaders share them, and their levels of detail
+//     and clusters, through shared_ptr: a copy made to change transforms, lights or the camera never copies geometry.
+struct ModelMeshes {
+    tinyobj::attrib_t attribs;
+    std::vector<tinyobj::shape_t> shapes;
+    // by shape, from Summarize: a hash of its corner positions, which keys its shadow casters, and its model-space box
+    std::vector<uint64_t> shapeHashes;
+    std::vector<std::pair<glm::vec3, glm::vec3>> shapeBounds;
+
+    // Hash and bound the shapes added since the last call
+    void Summarize();
+};
+
 enum class TestType {
     TRIANGLE,
     TRANSFORM,
     TRANSFORM_TEST,
     TEXTURE_TEST,
+    TEXTURE_BAKE,
+    WATERTIGHT_TEST,
     SHADING_DEPTH,
     SHADING,
     DEFERRED_SHADING,
@@ -28,6 +49,15 @@ enum class TestType {
 
 enum class AntiAliasConfig { NONE, SSAA, MSAA };
 
+// How SSAA samples are filtered into pixels (see supersample.hpp)
+enum class SSAAFilter { BOX, TENT };
+
+// Who shades the deferred resolve: the per-pixel `ShadeAtPixel` hook, or the batched Blinn-Phong kernel
+enum class ShaderConfig { PIXEL, BATCHED };
+
+// Transforms and lights Info prints at most; scenes with thousands of them would mostly print the list
+constexpr size_t INFO_MAX_LISTED = 32;
+
 std::string ToStr(glm::vec4 vec);
 std::string ToStr(glm::vec3 vec);
 
@@ -53,6 +83,10 @@ public:
             typeStr = "transform_test";
         else if (this->type == TestType::TEXTURE_TEST)
             typeStr = "texture_test";
+        else if (this->type == TestType::TEXTURE_BAKE)
+            typeStr = "texture_bake";
+        else if (this->type == TestType::WATERTIGHT_TEST)
+            typeStr = "watertight_test";
         else if (this->type == TestType::ERROR)
             typeStr = "error";
 
@@ -60,7 +94,7 @@ public:
         if (this->AAConfig == AntiAliasConfig::NONE)
             AAStr = "none";
         else if (this->AAConfig == AntiAliasConfig::SSAA)
-            AAStr = "SSAA";
+            AAStr = std::string("SSAA (") + (this->ssaaFilter == SSAAFilter::TENT ? "tent" : "box") + " filter)";
         else if (this->AAConfig == AntiAliasConfig::MSAA)
             AAStr = "MSAA";
 
@@ -70,37 +104,66 @@ public:
                 transformStr = "[WARNING] <no transform specified>\n";
             else {
                 transformStr = "Transforms:\n";
-                for (auto& transform : this->transforms) {
+                for (size_t i = 0; i < std::min(this->transforms.size(), INFO_MAX_LISTED); ++i) {
+                    const MeshTransform& transform = this->transforms[i];
                     transformStr += "| - rotation: " + ToStr(transform.rotation) + "\n";
                     transformStr += "|   translation: " + ToStr(transform.translation) + "\n";
                     transformStr += "|   scale: " + ToStr(transform.scale) + "\n";
                 }
+                transformStr += MoreListed(this->transforms.size());
             }
-            if (this->transforms.size() != this->shapes.size())
+            if (this->transforms.size() != this->meshes->shapes.size())
                 transformStr += "[WARNING] number of transforms does not match number of shapes\n";
+            if (!this->instances.empty()) {
+                transformStr += "Instances:\n";
+                for (size_t i = 0; i < std::min(this->instances.size(), INFO_MAX_LISTED); ++i)
+                    transformStr += "| - shape " + std::to_string(this->instances[i].shape) + ": "
+                                  + std::to_string(this->instances[i].transforms.size()) + " copies\n";
+                transformStr += MoreListed(this->instances.size());
+            }
+            if (this->lodCount != 0)
+                transformStr += "Levels of detail: " + std::to_string(this->lodCount) + " per shape, "
+                              + ToStr(this->lodPixels) + " pixel error\n";
+            if (this->clusterSize != 0)
+                transformStr += "Clusters: up to " + std::to_string(this->clusterSize) + " triangles, back faces "
+                              + (this->cullBackFaces ? "culled" : "drawn") + "\n";
         }
 
         std::string lightStr = "<no light needed>\n";
         if (this->type == TestType::SHADING || this->type == TestType::DEFERRED_SHADING) {
             lightStr = "";
+            if (this->type == TestType::DEFERRED_SHADING)
+                lightStr += std::string("Shader: ") + (this->shader == ShaderConfig::BATCHED ? "batched" : "pixel")
+                          + "\n";
+            lightStr += std::string("Tonemap: ") + (this->toneMap == ToneMap::REINHARD ? "reinhard" : "clamp") + "\n";
+            lightStr += "Shadow maps: " + this->ShadowInfo() + "\n";
+            lightStr += std::string("Attenuation: ")
+                      + (this->windowedLights ? "windowed, cutoff " + ToStr(this->lightCutoff, 4) : "inverse-square")
+                      + "\n";
             lightStr += "Specular Exponent: " + ToStr(this->specularExponent) + "\n";
             lightStr += "Ambient Color: " + ToStr(this->ambientColor) + "\n";
             if (this->lights.empty())
                 lightStr += "[WARNING] <no light specified>\n";
             else {
                 lightStr += "Lights:\n";
-                for (auto& light : this->lights) {
+                for (size_t i = 0; i < std::min(this->lights.size(), INFO_MAX_LISTED); ++i) {
+                    const Light& light = this->lights[i];
                     lightStr += "| - position: " + ToStr(light.pos) + "\n";
                     lightStr += "|   intensity: " + ToStr(light.intensity) + "\n";
                     lightStr += "|   color: " + ToStr(light.color) + "\n";
+                    if (light.Bounded()) lightStr += "|   radius: " + ToStr(light.radius) + "\n";
                 }
+                lightStr += MoreListed(this->lights.size());
             }
         }
 
         return "Type: " + typeStr + "\n" + "Anti-alias: " + AAStr
              + ((this->AAConfig == AntiAliasConfig::NONE) ? "" : " with spp " + ToStr(this->AASpp)) + "\n"
              + "Resolution: " + ToStr(this->width) + "x" + ToStr(this->height) + "\n" + "Model: " + this->modelName
-             + "\n" + "Output: " + this->outputName + "\n"
+             + "\n" + "Output: "
+             + (this->streamTarget.empty() ? this->outputName + " (" + this->OutputFormatInfo() + ")"
+                                           : "stream " + this->streamTarget)
+             + "\n"
              + "Texture: " + (this->textureName.empty() ? "<no texture specified>" : this->textureName) + "\n"
              + ((camera.width == 0) ? "<no camera specified>" : (this->camera.Info())) + "\n" + transformStr + lightStr;
     }
@@ -108,10 +171,20 @@ public:
     inline const TestType GetType() const { return this->type; }
     inline const AntiAliasConfig GetAntiAliasConfig() const { return this->AAConfig; }
     inline const uint32_t GetSpp() const { return this->AASpp; }
+    inline const SSAAFilter GetSSAAFilter() const { return this->ssaaFilter; }
+    inline const ShaderConfig GetShaderConfig() const { return this->shader; }
+    inline const ToneMap GetToneMap() const { return this->toneMap; }
+    inline const uint32_t GetShadowMapSize() const { return this->shadowMapSize; }
+    inline const ShadowFilterOptions& GetShadowFilter() const { return this->shadowFilter; }
     inline const uint32_t GetWidth() const { return this->width; }
     inline const uint32_t GetHeight() const { return this->height; }
+    inline const std::string GetModelName() const { return this->modelName; }
     inline const std::string GetOutputName() const { return this->outputName; }
+    inline const WriteOptions& GetWriteOptions() const { return this->writeOptions; }
+    inline const std::string& GetStreamTarget() const { return this->streamTarget; }
+    inline bool GetGenericPipeline() const { return this->genericPipeline; }
     inline const std::string GetTextureName() const { return this->textureName; }
+    inline const uint32_t GetTileSize() const { return this->tileSize; }
 
     inline const glm::vec3 GetTestInput() const {
         if (this->input.has_value())
@@ -127,42 +200,98 @@ public:
     }
 
     inline const Camera& GetCamera() const { return this->camera; }
-    inline const std::vector<tinyobj::shape_t>& GetShapes() const { return this->shapes; }
+    inline const std::vector<tinyobj::shape_t>& GetShapes() const { return this->meshes->shapes; }
     inline const std::vector<MeshTransform>& GetTransforms() const { return this->transforms; }
+    inline const std::vector<InstanceSet>& GetInstances() const { return this->instances; }
+    // Coarser levels of each shape, empty without `lods`
+    inline const std::vector<ShapeLods>& GetLods() const { return *this->lods; }
+    inline const uint32_t GetLodCount() const { return this->lodCount; }
+    inline const float GetLodPixels() const { return this->lodPixels; }
+    // Clusters of each shape by level of detail, level 0 being the shape itself; empty without `clusters`
+    inline const std::vector<std::vector<ShapeClusters>>& GetClusters() const { return *this->clusters; }
+    inline const uint32_t GetClusterSize() const { return this->clusterSize; }
+    inline const bool GetCullBackFaces() const { return this->cullBackFaces; }
     inline const std::vector<Light>& GetLights() const { return this->lights; }
     inline const float GetSpecularExponent() const { return this->specularExponent; }
     inline const Color GetAmbientColor() const { return this->ambientColor; }
-    inline const tinyobj::attrib_t& GetAttribs() const { return this->attribs; }
+    inline const tinyobj::attrib_t& GetAttribs() const { return this->meshes->attribs; }
+    inline const ModelMeshes& GetMeshes() const { return *this->meshes; }
+    inline double GetConfigMs() const { return this->configMs; }
+    inline double GetModelMs() const { return this->modelMs; }
 
 private:
+    friend class Scene;   // fills the same fields from memory
+
     // configs
     std::string filename;
 
     TestType type;
-    uint32_t width;
-    uint32_t height;
+    uint32_t width = 0;
+    uint32_t height = 0;
     std::string modelName;
     std::string outputName;
     std::string textureName;
+    uint32_t tileSize = 128;
     AntiAliasConfig AAConfig = AntiAliasConfig::NONE;
     uint32_t AASpp = 0;
+    SSAAFilter ssaaFilter = SSAAFilter::BOX;
+    ShaderConfig shader = ShaderConfig::PIXEL;
+    ToneMap toneMap = ToneMap::CLAMP;
+    uint32_t shadowMapSize = 0;   // texels per side of each cube face; 0 disables shadows
+    ShadowFilterOptions shadowFilter;
+    bool windowedLights = false;   // bounded lights get a radius from `lightCutoff` unless the config sets one
+    float lightCutoff = 1.f / 256.f;   // irradiance below which a windowed light is cut, 1 being white
+    WriteOptions writeOptions;
+    std::string streamTarget;   // empty when frames go to files, see frame_stream.hpp
+    bool genericPipeline = false;
+    double configMs = 0;   // reading and parsing the YAML config
+    double modelMs = 0;    // reading and triangulating the OBJ file, simplifying and clustering its shapes
 
     std::optional<glm::vec3> expected;
     std::optional<glm::vec3> input;
 
     Camera camera;
 
-    tinyobj::attrib_t attribs;
-    std::vector<tinyobj::shape_t> shapes;
+    std::shared_ptr<const ModelMeshes> meshes = std::make_shared<ModelMeshes>();
     std::vector<MeshTransform> transforms;
+    std::vector<InstanceSet> instances;   // shapes listed here are only drawn through their instances
+    uint32_t lodCount = 0;                // coarser levels built per shape, at most MAX_LODS
+    float lodPixels = 1.f;                // screen error a level may show before a finer one is drawn
+    std::shared_ptr<const std::vector<ShapeLods>> lods = std::make_shared<std::vector<ShapeLods>>();   // by shape
+    uint32_t clusterSize = 0;             // triangles per cluster at most, 0 without clusters
+    bool cullBackFaces = false;
+    // by shape, then by level of detail
+    std::shared_ptr<const std::vector<std::vector<ShapeClusters>>> clusters
+      = std::make_shared<std::vector<std::vector<ShapeClusters>>>();
 
     std::vector<Light> lights;
     float specularExponent;
     Color ambientColor;
 
     // helpers
+    // The shared data behind `shared` for this loader alone to append to, copied first when others still hold it
+    template <typename T>
+    static T& Unshare(std::shared_ptr<const T>& shared) {
+        if (shared.use_count() != 1) shared = std::make_shared<T>(*shared);
+        // every shared object was made non-const by make_shared
+        return const_cast<T&>(*shared);
+    }
+    std::string OutputFormatInfo() const;
+    // The line closing a list Info cut short, empty when all `count` items were listed
+    static std::string MoreListed(size_t count) {
+        return count > INFO_MAX_LISTED ? "| ... " + std::to_string(count - INFO_MAX_LISTED) + " more\n" : "";
+    }
+    std::string ShadowInfo() const;
     bool LoadYaml();
+    // The text of a config, or nothing when the file could not be read; `filename` only names it in errors
+    bool LoadYaml(std::optional<std::string> text);
+    bool ParseYaml(std::optional<std::string>& text);
     bool LoadObj();
+    // Levels of detail of every shape, as many as `lodCount` asks for
+    void BuildLods();
+    // Clusters of every shape and level, after BuildLods
+    void BuildClusters();
+    std::vector<ShapeClusters> ClustersOf(size_t shape) const;
 };
 
 #endif
@@ -0,0 +1,304 @@
+#include "lod.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <unordered_map>
+
+#include "../thirdparty/tinyobj/tiny_obj_loader.h"
+
+namespace {
+
+// Weight of the planes holding open borders in place, against 1 for the planes of the triangles
+constexpr double BORDER_WEIGHT = 16.0;
+
+// A collapse may turn a triangle's normal by at most acos of this
+constexpr double MIN_NORMAL_COS = 0.5;
+
+// Sum of squared distances to a set of planes, as the upper half of a symmetric 4x4 matrix
+struct Quadric {
+    double a00 = 0, a01 = 0, a02 = 0, a03 = 0, a11 = 0, a12 = 0, a13 = 0, a22 = 0, a23 = 0, a33 = 0;
+
+    // The plane of points p with dot(n, p) + d = 0, n normalized
+    void AddPlane(glm::dvec3 n, double d, double weight) {
+        this->a00 += weight * n.x * n.x;
+        this->a01 += weight * n.x * n.y;
+        this->a02 += weight * n.x * n.z;
+        this->a03 += weight * n.x * d;
+        this->a11 += weight * n.y * n.y;
+        this->a12 += weight * n.y * n.z;
+        this->a13 += weight * n.y * d;
+        this->a22 += weight * n.z * n.z;
+        this->a23 += weight * n.z * d;
+        this->a33 += weight * d * d;
+    }
+
+    Quadric operator+(const Quadric& q) const {
+        return { this->a00 + q.a00, this->a01 + q.a01, this->a02 + q.a02, this->a03 + q.a03, this->a11 + q.a11,
+                 this->a12 + q.a12, this->a13 + q.a13, this->a22 + q.a22, this->a23 + q.a23, this->a33 + q.a33 };
+    }
+
+    double Error(glm::dvec3 p) const {
+        const double e = this->a00 * p.x * p.x + this->a11 * p.y * p.y + this->a22 * p.z * p.z + this->a33
+                       + 2. * (this->a01 * p.x * p.y + this->a02 * p.x * p.z + this->a12 * p.y * p.z + this->a03 * p.x
+                               + this->a13 * p.y + this->a23 * p.z);
+        return std::max(e, 0.);
+    }
+};
+
+// Moving vertex `from` onto vertex `to`. The stamps are those of the two vertices when the collapse was queued; an
+//     entry whose vertices changed since is stale.
+struct Collapse {
+    double cost;
+    uint32_t from, to;
+    uint32_t fromStamp, toStamp;
+
+    bool operator>(const Collapse& other) const { return this->cost > other.cost; }
+};
+
+// Edge collapse simplification of one shape, over its own compact list of vertices
+class Simplifier {
+public:
+    Simplifier(const tinyobj::shape_t& shape, const tinyobj::attrib_t& attribs)
+        : shape(shape) {
+        const size_t triangleCount = shape.mesh.indices.size() / 3;
+        std::vector<uint32_t> local(attribs.vertices.size() / 3, UINT32_MAX);
+        this->triangles.resize(triangleCount);
+        for (size_t t = 0; t < triangleCount; ++t)
+            for (int k = 0; k < 3; ++k) {
+                const int vertex = shape.mesh.indices[3 * t + k].vertex_index;
+                if (local[vertex] == UINT32_MAX) {
+                    local[vertex] = static_cast<uint32_t>(this->positions.size());
+                    this->global.push_back(vertex);
+                    const float* p = &attribs.vertices[3 * size_t(vertex)];
+                    this->positions.emplace_back(p[0], p[1], p[2]);
+                }
+                this->triangles[t][k] = local[vertex];
+            }
+        this->alive.assign(triangleCount, true);
+        this->aliveCount = triangleCount;
+    }
+
+    const std::vector<glm::dvec3>& Positions() const { return this->positions; }
+    size_t AliveCount() const { return this->aliveCount; }
+    double MaxCost() const { return this->maxCost; }
+
+    // Quadrics of all vertices, and every edge queued in both directions
+    void Start() {
+        const size_t vertexCount = this->positions.size();
+        this->quadrics.assign(vertexCount, Quadric());
+        this->vertexTriangles.assign(vertexCount, {});
+        this->stamps.assign(vertexCount, 0);
+        this->removed.assign(vertexCount, false);
+
+        std::unordered_map<uint64_t, uint32_t> edgeUses;
+        auto edgeKey = [](uint32_t a, uint32_t b) {
+            return static_cast<uint64_t>(std::min(a, b)) << 32 | std::max(a, b);
+        };
+        for (uint32_t t = 0; t < this->triangles.size(); ++t) {
+            const auto& tri = this->triangles[t];
+            for (int k = 0; k < 3; ++k) {
+                this->vertexTriangles[tri[k]].push_back(t);
+                ++edgeUses[edgeKey(tri[k], tri[(k + 1) % 3])];
+            }
+            glm::dvec3 n = this->Normal(tri);
+            const double length = glm::length(n);
+            if (length == 0.) continue;
+            n /= length;
+            for (int k = 0; k < 3; ++k) this->quadrics[tri[k]].AddPlane(n, -glm::dot(n, this->positions[tri[0]]), 1.);
+        }
+        // an edge of one triangle only is on a border: a plane through it, across the triangle, keeps it in place
+        for (const auto& tri : this->triangles) {
+            const glm::dvec3 n = this->Normal(tri);
+            for (int k = 0; k < 3; ++k) {
+                const uint32_t a = tri[k], b = tri[(k + 1) % 3];
+                if (edgeUses[edgeKey(a, b)] != 1) continue;
+                glm::dvec3 across = glm::cross(this->positions[b] - this->positions[a], n);
+                const double length = glm::length(across);
+                if (length == 0.) continue;
+                across /= length;
+                const double d = -glm::dot(across, this->positions[a]);
+                this->quadrics[a].AddPlane(across, d, BORDER_WEIGHT);
+                this->quadrics[b].AddPlane(across, d, BORDER_WEIGHT);
+            }
+        }
+
+        for (const auto& tri : this->triangles)
+            for (int k = 0; k < 3; ++k) this->QueueEdge(tri[k], tri[(k + 1) % 3]);
+    }
+
+    // Collapse the cheapest edges until at most `target` triangles are left or no collapse is possible
+    void Reduce(size_t target) {
+        while (this->aliveCount > target && !this->queue.empty()) {
+            const Collapse collapse = this->queue.top();
+            this->queue.pop();
+            if (this->removed[collapse.from] || this->removed[collapse.to]
+                || this->stamps[collapse.from] != collapse.fromStamp || this->stamps[collapse.to] != collapse.toStamp)
+                continue;
+            if (!this->Allowed(collapse.from, collapse.to)) continue;
+            this->Apply(collapse.from, collapse.to);
+            this->maxCost = std::max(this->maxCost, collapse.cost);
+        }
+    }
+
+    // The remaining triangles as a shape, with the normals and tex coords of the corners they started with
+    tinyobj::shape_t Snapshot() const {
+        tinyobj::shape_t level;
+        level.name = this->shape.name;
+        for (size_t t = 0; t < this->triangles.size(); ++t) {
+            if (!this->alive[t]) continue;
+            for (int k = 0; k < 3; ++k) {
+                tinyobj::index_t idx = this->shape.mesh.indices[3 * t + k];
+                idx.vertex_index = this->global[this->triangles[t][k]];
+                level.mesh.indices.push_back(idx);
+            }
+            level.mesh.num_face_vertices.push_back(3);
+            if (t < this->shape.mesh.material_ids.size())
+                level.mesh.material_ids.push_back(this->shape.mesh.material_ids[t]);
+        }
+        return level;
+    }
+
+private:
+    const tinyobj::shape_t& shape;
+    std::vector<glm::dvec3> positions;
+    std::vector<int> global;   // vertex index in the attribute pool of each local vertex
+    std::vector<std::array<uint32_t, 3>> triangles;
+    std::vector<bool> alive;
+    size_t aliveCount = 0;
+    double maxCost = 0.;
+
+    std::vector<Quadric> quadrics;
+    std::vector<std::vector<uint32_t>> vertexTriangles;   // may still list triangles that died since
+    std::vector<uint32_t> stamps;
+    std::vector<bool> removed;
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> queue;
+
+    glm::dvec3 Normal(const std::array<uint32_t, 3>& tri) const {
+        const glm::dvec3& p0 = this->positions[tri[0]];
+        return glm::cross(this->positions[tri[1]] - p0, this->positions[tri[2]] - p0);
+    }
+
+    static bool Contains(const std::array<uint32_t, 3>& tri, uint32_t vertex) {
+        return tri[0] == vertex || tri[1] == vertex || tri[2] == vertex;
+    }
+
+    void QueueEdge(uint32_t a, uint32_t b) {
+        if (a == b) return;
+        const Quadric sum = this->quadrics[a] + this->quadrics[b];
+        this->queue.push({ sum.Error(this->positions[b]), a, b, this->stamps[a], this->stamps[b] });
+        this->queue.push({ sum.Error(this->positions[a]), b, a, this->stamps[b], this->stamps[a] });
+    }
+
+    // Whether moving `from` onto `to` keeps the surface a manifold (the only vertices next to both are the third
+    //     vertices of the triangles on their edge) and turns no remaining triangle by too much
+    bool Allowed(uint32_t from, uint32_t to) const {
+        std::vector<uint32_t> fromNeighbors, toNeighbors, apexes;
+        for (const uint32_t t : this->vertexTriangles[from]) {
+            if (!this->alive[t]) continue;
+            const auto& tri = this->triangles[t];
+            fromNeighbors.insert(fromNeighbors.end(), tri.begin(), tri.end());
+            if (Contains(tri, to)) {
+                for (const uint32_t v : tri)
+                    if (v != from && v != to) apexes.push_back(v);
+                continue;
+            }
+
+            auto moved = tri;
+            std::replace(moved.begin(), moved.end(), from, to);
+            const glm::dvec3 before = this->Normal(tri), after = this->Normal(moved);
+            if (glm::dot(before, after) <= MIN_NORMAL_COS * glm::length(before) * glm::length(after)) return false;
+        }
+        if (apexes.empty()) return false;   // no longer an edge
+        for (const uint32_t t : this->vertexTriangles[to])
+            if (this->alive[t])
+                toNeighbors.insert(toNeighbors.end(), this->triangles[t].begin(), this->triangles[t].end());
+
+        auto unique = [](std::vector<uint32_t>& v) {
+            std::sort(v.begin(), v.end());
+            v.erase(std::unique(v.begin(), v.end()), v.end());
+        };
+        unique(fromNeighbors);
+        unique(toNeighbors);
+        unique(apexes);
+        size_t common = 0;
+        for (const uint32_t v : fromNeighbors)
+            if (v != from && v != to && std::binary_search(toNeighbors.begin(), toNeighbors.end(), v)) ++common;
+        return common == apexes.size();
+    }
+
+    void Apply(uint32_t from, uint32_t to) {
+        for (const uint32_t t : this->vertexTriangles[from]) {
+            if (!this->alive[t]) continue;
+            auto& tri = this->triangles[t];
+            if (Contains(tri, to)) {
+                this->alive[t] = false;
+                --this->aliveCount;
+                continue;
+            }
+            std::replace(tri.begin(), tri.end(), from, to);
+            this->vertexTriangles[to].push_back(t);
+        }
+        this->vertexTriangles[from].clear();
+        std::erase_if(this->vertexTriangles[to], [&](uint32_t t) { return !this->alive[t]; });
+        this->quadrics[to] = this->quadrics[to] + this->quadrics[from];
+        this->removed[from] = true;
+        ++this->stamps[from];
+        ++this->stamps[to];
+
+        // the edges around `to` now cost more
+        for (const uint32_t t : this->vertexTriangles[to])
+            for (const uint32_t v : this->triangles[t])
+                if (v != to) this->QueueEdge(to, v);
+    }
+};
+
+}   // namespace
+
+ShapeLods BuildLods(const tinyobj::shape_t& shape, const tinyobj::attrib_t& attribs, uint32_t count) {
+    ShapeLods lods;
+    Simplifier simplifier(shape, attribs);
+    const std::vector<glm::dvec3>& positions = simplifier.Positions();
+    if (positions.empty()) return lods;
+
+    glm::dvec3 lo(std::numeric_limits<double>::infinity()), hi(-std::numeric_limits<double>::infinity());
+    for (const glm::dvec3& p : positions) {
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+    }
+    const glm::dvec3 center = (lo + hi) * 0.5;
+    double radius = 0.;
+    for (const glm::dvec3& p : positions) radius = std::max(radius, glm::length(p - center));
+    lods.center = glm::vec3(center);
+    lods.radius = static_cast<float>(radius);
+
+    simplifier.Start();
+    size_t previous = simplifier.AliveCount();
+    for (uint32_t level = 0; level < std::min(count, MAX_LODS); ++level) {
+        simplifier.Reduce(static_cast<size_t>(static_cast<float>(previous) * LOD_TRIANGLE_RATIO));
+        if (simplifier.AliveCount() >= previous) break;
+        previous = simplifier.AliveCount();
+        lods.levels.push_back(simplifier.Snapshot());
+        lods.errors.push_back(static_cast<float>(std::sqrt(simplifier.MaxCost())));
+    }
+    return lods;
+}
+
+uint32_t ShapeLods::Select(const glm::mat4& model, const Camera& camera, float pixelsPerUnit, float tolerance) const {
+    if (this->levels.empty() || !(pixelsPerUnit > 0.f)) return 0;
+    const glm::vec3 center = model * glm::vec4(this->center, 1.f);
+    const float scale = std::sqrt(std::max({ glm::dot(glm::vec3(model[0]), glm::vec3(model[0])),
+                                             glm::dot(glm::vec3(model[1]), glm::vec3(model[1])),
+                                             glm::dot(glm::vec3(model[2]), glm::vec3(model[2])) }));
+    const float distance = glm::length(center - camera.pos) - this->radius * scale;
+    if (!(distance > camera.nearClip)) return 0;
+
+    // pixels covered by one model unit at the shape's nearest point; errors grow with the level
+    const float pixels = scale * pixelsPerUnit / distance;
+    uint32_t level = 0;
+    while (level < this->errors.size() && this->errors[level] * pixels <= tolerance) ++level;
+    return level;
+}
@@ -0,0 +1,47 @@
+// Levels of detail: coarser versions of a shape made by quadric-error edge collapses, and the choice of the level to
+//     draw from the size the shape takes on screen
+
+#ifndef LOD_H
+#define LOD_H
+
+#include <cstdint>
+#include <vector>
+
+#include "../thirdparty/glm/glm.hpp"
+#include "../thirdparty/tinyobj/tiny_obj_fwd.h"
+#include "entities.hpp"
+
+// Coarser levels a shape can have besides itself
+constexpr uint32_t MAX_LODS = 4;
+
+// Each level aims at this share of the triangles of the level before it
+constexpr float LOD_TRIANGLE_RATIO = 0.5f;
+
+struct ShapeLods {
+    // Level l + 1 of the shape, level 0 being the shape itself. Levels index into the same attribute pools as the
+    //     shape: the collapses keep one of the two vertices of an edge, so no vertex is created.
+    std::vector<tinyobj::shape_t> levels;
+    std::vector<float> errors;   // of each level in `levels`: how far (model space) it may stray from the shape
+    glm::vec3 center {};         // bounding sphere of the shape, model space
+    float radius = 0.f;
+
+    inline uint32_t LevelCount() const { return static_cast<uint32_t>(this->levels.size()) + 1; }
+
+    // The coarsest level whose error, drawn with `model` and seen from `camera`, stays within `tolerance` pixels;
+    //     `pixelsPerUnit` is the size in pixels of one world unit at distance 1 from the camera (see
+    //     LodPixelsPerUnit). Shapes reaching the near plane are drawn at level 0.
+    uint32_t Select(const glm::mat4& model, const Camera& camera, float pixelsPerUnit, float tolerance) const;
+};
+
+// Build up to `count` levels of `shape`, each with about LOD_TRIANGLE_RATIO of the triangles of the previous one.
+//     Collapses that would flip a triangle are skipped and open borders are kept in place, so simplification
+//     stops early on meshes with too few triangles to lose; levels that would not drop any triangle are left out.
+ShapeLods BuildLods(const tinyobj::shape_t& shape, const tinyobj::attrib_t& attribs, uint32_t count);
+
+// Pixels spanned by one world unit seen from distance 1, for a camera whose near plane, `nearClip` away, is
+//     `camera.height` units tall over `height` pixels
+inline float LodPixelsPerUnit(const Camera& camera, uint32_t height) {
+    return camera.height > 0.f ? static_cast<float>(height) * camera.nearClip / camera.height : 0.f;
+}
+
+#endif
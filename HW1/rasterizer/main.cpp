@@ -1,9 +1,56 @@
+#include <cstring>
 #include <iostream>
+#include <string>
 
+#include "render_client.hpp"
+#include "render_server.hpp"
 #include "renderer.hpp"
 
+// Daemon and load-generator modes, see render_server.hpp:
+//     --serve <socket> [workers]
+//     --load <socket> <config> [requests] [connections] [shm]
+//     --stop <socket>
+// Returns -1 when argv names no such mode
+int RunServerMode(int argc, char** argv)
+{
+    if (argc < 3) return -1;
+    if (std::strcmp(argv[1], "--serve") == 0)
+    {
+        RenderServer server(argv[2], argc > 3 ? std::stoul(argv[3]) : 0);
+        return server.Run() ? 0 : 1;
+    }
+    if (std::strcmp(argv[1], "--load") == 0 && argc > 3)
+    {
+        LoadTestOptions options;
+        options.socketPath = argv[2];
+        options.configPath = argv[3];
+        if (argc > 4) options.requests = std::stoul(argv[4]);
+        if (argc > 5) options.connections = std::stoul(argv[5]);
+        options.sharedMemory = argc > 6 && std::strcmp(argv[6], "shm") == 0;
+        return RunLoadTest(options) ? 0 : 1;
+    }
+    if (std::strcmp(argv[1], "--stop") == 0)
+    {
+        RenderClient client(argv[2]);
+        RenderClient::Reply reply;
+        return client.Request(JobKind::SHUTDOWN, "", false, reply) ? 0 : 1;
+    }
+    return -1;
+}
+
 int main(int argc, char** argv)
 {
+    try
+    {
+        const int status = RunServerMode(argc, argv);
+        if (status >= 0) return status;
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
     std::string configName = "config.yaml";
     if (argc > 1)
         configName = std::string(argv[1]) + ".yaml";
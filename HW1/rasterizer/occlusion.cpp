@@ -0,0 +1,49 @@
+#include "occlusion.hpp"
+
+#include <cmath>
+
+// Margin against the rounding of the interpolated 1 / w planes
+constexpr float OCCLUSION_EPSILON = 1e-5f;
+
+void OcclusionBuffer::Reset(uint32_t width, uint32_t height, float nearClip) {
+    this->width = width;
+    this->height = height;
+    this->tilesX = (width + OCCLUSION_TILE - 1) / OCCLUSION_TILE;
+    this->tilesY = (height + OCCLUSION_TILE - 1) / OCCLUSION_TILE;
+    this->maxInvW = nearClip > 0.f ? 1.f / nearClip : 0.f;
+    this->nearest.assign(static_cast<size_t>(width) * height, 0.f);
+    this->tileFarthest.assign(static_cast<size_t>(this->tilesX) * this->tilesY, 0.f);
+    this->dirty.assign(this->tileFarthest.size(), 0);
+}
+
+bool OcclusionBuffer::Occluded(float xmin, float xmax, float ymin, float ymax, float nearestInvW) {
+    if (!this->Enabled() || !(nearestInvW > 0.f)) return false;
+    // written so that NaN boxes are never occluded
+    if (!(xmax >= 0.f && ymax >= 0.f && xmin < static_cast<float>(this->width)
+          && ymin < static_cast<float>(this->height)))
+        return false;
+    const uint32_t x0 = static_cast<uint32_t>(std::max(xmin, 0.f)) / OCCLUSION_TILE;
+    const uint32_t y0 = static_cast<uint32_t>(std::max(ymin, 0.f)) / OCCLUSION_TILE;
+    const uint32_t x1 = static_cast<uint32_t>(std::min(xmax, static_cast<float>(this->width - 1))) / OCCLUSION_TILE;
+    const uint32_t y1 = static_cast<uint32_t>(std::min(ymax, static_cast<float>(this->height - 1))) / OCCLUSION_TILE;
+
+    const float threshold = nearestInvW * (1.f + OCCLUSION_EPSILON);
+    for (uint32_t ty = y0; ty <= y1; ++ty)
+        for (uint32_t tx = x0; tx <= x1; ++tx) {
+            const size_t tile = static_cast<size_t>(ty) * this->tilesX + tx;
+            if (this->dirty[tile]) {
+                const uint32_t xEnd = std::min((tx + 1) * OCCLUSION_TILE, this->width);
+                const uint32_t yEnd = std::min((ty + 1) * OCCLUSION_TILE, this->height);
+                float farthest = INFINITY;
+                for (uint32_t y = ty * OCCLUSION_TILE; y < yEnd; ++y) {
+                    const float* row = &this->nearest[static_cast<size_t>(y) * this->width];
+                    for (uint32_t x = tx * OCCLUSION_TILE; x < xEnd; ++x) farthest = std::min(farthest, row[x]);
+                }
+                this->tileFarthest[tile] = farthest;
+                this->dirty[tile] = 0;
+            }
+            // a nearer surface has a larger 1 / w
+            if (!(this->tileFarthest[tile] > threshold)) return false;
+        }
+    return true;
+}
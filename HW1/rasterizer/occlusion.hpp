@@ -0,0 +1,53 @@
+// Occlusion buffer for cluster culling: the nearest surface drawn so far at each pixel, and per tile the farthest of
+//     those, a one-level depth hierarchy a cluster's screen box is tested against
+
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "triangle_batch.hpp"
+
+// Pixels per side of an occlusion tile
+constexpr uint32_t OCCLUSION_TILE = 8;
+
+class OcclusionBuffer {
+public:
+    // Track a width x height screen from now on, with nothing drawn. Surfaces closer than `nearClip` are ignored:
+    //     the depth test may still clip them away.
+    void Reset(uint32_t width, uint32_t height, float nearClip);
+    // Stop tracking; Enabled is false until the next Reset
+    inline void Disable() { this->width = 0; }
+    inline bool Enabled() const { return this->width != 0; }
+
+    // Record a span of pixel centers a triangle owns on row `y`, from its 1 / w plane. Depth is compared through
+    //     1 / w rather than the depth buffer, whose convention is up to the depth pass; both order surfaces alike.
+    inline void WriteSpan(uint32_t y, uint32_t xBegin, uint32_t xEnd, const TriangleBatch::Plane& invW) {
+        float* row = &this->nearest[static_cast<size_t>(y) * this->width];
+        const float cy = static_cast<float>(y) + 0.5f;
+        for (uint32_t x = xBegin; x <= xEnd; ++x) {
+            const float value = invW.At(static_cast<float>(x) + 0.5f, cy);
+            if (value <= this->maxInvW) row[x] = std::max(row[x], value);
+        }
+        const size_t tileRow = static_cast<size_t>(y / OCCLUSION_TILE) * this->tilesX;
+        for (uint32_t tile = xBegin / OCCLUSION_TILE; tile <= xEnd / OCCLUSION_TILE; ++tile)
+            this->dirty[tileRow + tile] = 1;
+    }
+
+    // Whether every pixel of the screen box [xmin, xmax] x [ymin, ymax] already has a surface nearer than
+    //     `nearestInvW` (1 / w of the closest point of what is tested); boxes reaching off-screen are only tested
+    //     on-screen
+    bool Occluded(float xmin, float xmax, float ymin, float ymax, float nearestInvW);
+
+private:
+    uint32_t width = 0, height = 0;
+    uint32_t tilesX = 0, tilesY = 0;
+    float maxInvW = 0.f;
+    std::vector<float> nearest;        // 1 / w of the nearest surface per pixel center, 0 where there is none
+    std::vector<float> tileFarthest;   // smallest `nearest` of each tile, stale until the tile is tested
+    std::vector<uint8_t> dirty;        // tiles written since their tileFarthest was computed
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include "parallel.hpp"
+
+WorkerPool& WorkerPool::Shared() {
+    static WorkerPool pool(WorkerCount() - 1);
+    return pool;
+}
+
+WorkerPool::WorkerPool(uint32_t threads) {
+    for (uint32_t i = 0; i < threads; ++i) this->threads.emplace_back(&WorkerPool::Work, this);
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->helperReady.notify_all();
+    for (std::thread& thread : this->threads) thread.join();
+}
+
+void WorkerPool::Run(uint32_t workers, const std::function<void(uint32_t)>& work) {
+    if (workers <= 1 || this->threads.empty()) {
+        if (workers != 0) work(0);
+        return;
+    }
+
+    auto job = std::make_shared<Job>();
+    job->work = &work;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (uint32_t worker = 1; worker < workers; ++worker) this->helpers.push_back({ job, worker });
+    }
+    this->helperReady.notify_all();
+
+    // helpers still queued hold the job but never touch `work` once it is closed
+    auto close = [&] {
+        std::unique_lock<std::mutex> lock(job->mutex);
+        job->open = false;
+        job->finished.wait(lock, [&] { return job->running == 0; });
+    };
+    try {
+        work(0);
+    } catch (...) {
+        close();
+        throw;
+    }
+    close();
+}
+
+void WorkerPool::Work() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        this->helperReady.wait(lock, [this] { return this->stopping || !this->helpers.empty(); });
+        if (this->stopping) return;
+
+        Helper helper = std::move(this->helpers.front());
+        this->helpers.pop_front();
+        lock.unlock();
+
+        Job& job = *helper.job;
+        bool started = false;
+        {
+            std::lock_guard<std::mutex> jobLock(job.mutex);
+            if (job.open) {
+                ++job.running;
+                started = true;
+            }
+        }
+        if (started) {
+            (*job.work)(helper.worker);
+            std::lock_guard<std::mutex> jobLock(job.mutex);
+            if (--job.running == 0) job.finished.notify_all();
+        }
+        lock.lock();
+    }
+}
@@ -0,0 +1,76 @@
+// Fork-join loop over independent work items, for passes that split the screen into tiles
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Threads ParallelFor runs on, the calling thread included
+inline uint32_t WorkerCount() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Threads kept for the whole run, so that a ParallelFor wakes sleeping workers instead of creating threads. Several
+//     threads may run jobs at once (the writer encodes while the renderer draws); their helpers share the pool.
+class WorkerPool {
+public:
+    // The pool behind ParallelFor, started on first use with WorkerCount() - 1 threads
+    static WorkerPool& Shared();
+
+    explicit WorkerPool(uint32_t threads);
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    ~WorkerPool();   // drops helpers that have not started
+
+    // Call work(worker) for every worker in [0, workers), 0 on the calling thread and the others on pool threads,
+    //     and return once they all returned. Helpers a busy pool has not started by the time work(0) returns are
+    //     skipped, so `work` must get its items done on however many workers show up.
+    void Run(uint32_t workers, const std::function<void(uint32_t)>& work);
+
+private:
+    // One Run: helpers only start while it is open, and it waits for those running before it closes
+    struct Job {
+        const std::function<void(uint32_t)>* work;
+        std::mutex mutex;
+        std::condition_variable finished;
+        uint32_t running = 0;
+        bool open = true;
+    };
+    struct Helper {
+        std::shared_ptr<Job> job;
+        uint32_t worker;
+    };
+
+    void Work();
+
+    std::mutex mutex;
+    std::condition_variable helperReady;
+    std::deque<Helper> helpers;
+    bool stopping = false;
+    std::vector<std::thread> threads;
+};
+
+// Call fn(item, worker) for every item in [0, count). Items are handed out one at a time, so uneven items balance
+//     out; `worker` is in [0, WorkerCount()) and no two concurrent calls share it, so it can index per-thread scratch.
+template <typename Fn>
+void ParallelFor(uint32_t count, Fn&& fn) {
+    const uint32_t workers = std::min(WorkerCount(), count);
+    if (workers == 0) return;
+    std::atomic<uint32_t> next { 0 };
+    WorkerPool::Shared().Run(workers, [&](uint32_t worker) {
+        for (uint32_t item = next.fetch_add(1, std::memory_order_relaxed); item < count;
+             item = next.fetch_add(1, std::memory_order_relaxed))
+            fn(item, worker);
+    });
+}
+
+#endif
@@ -1,13 +1,23 @@
 #include "rasterizer.hpp"
 
+#include <algorithm>
 #include <array>
 #include <cmath>
 #include <cstdint>
+#include <cstring>
+#include <limits>
 #include <numbers>
 
 #include "../thirdparty/glm/gtx/quaternion.hpp"
+#include "../thirdparty/tinyobj/tiny_obj_loader.h"
+#include "arena.hpp"
+#include "coverage.hpp"
 #include "image.hpp"
+#include "instancing.hpp"
 #include "loader.hpp"
+#include "parallel.hpp"
+#include "shading.hpp"
+#include "supersample.hpp"
 
 // include standard libraries here if you need any
 
@@ -20,36 +30,102 @@
 //  please add the files to the @includealso tag above. Otherwise, your files will
 //  not be included in grading.
 
-Rasterizer::Rasterizer(Loader& loader)
+namespace {
+
+// A shape's geometry hash (see ModelMeshes::Summarize) mixed with its model matrix a word at a time: equal keys cast
+//     equal shadows. It runs for every caster every frame, so words rather than FNV's bytes.
+uint64_t ShapeKey(uint64_t shapeHash, const glm::mat4& modelMat) {
+    std::array<uint32_t, 16> words;
+    std::memcpy(words.data(), &modelMat, sizeof(words));
+    uint64_t hash = shapeHash;
+    for (const uint32_t word : words) {
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+}   // namespace
+
+ColorHDR Rasterizer::colorBufferDefault = ColorHDR(0.f, 0.f, 0.f, 1.f);
+
+Rasterizer::Rasterizer(const Loader& loader)
     : loader(loader)
     , model()
     , view(glm::mat4(1.f))
     , projection(glm::mat4(1.f))
     , screenspace(glm::mat4(1.f))
-    , ZBuffer(loader.GetWidth(), loader.GetHeight(), loader.GetOutputName())
-    , MSAA_mask(loader.GetWidth(), loader.GetHeight(), loader.GetOutputName())
-    , GBuffer(loader.GetWidth(), loader.GetHeight(), loader.GetOutputName()) {
-    for (size_t i = 0; i != loader.GetHeight(); ++i)
-        for (size_t j = 0; j != loader.GetWidth(); ++j) ZBuffer.Set(j, i, -1.f);
-}
+    , ZBuffer(loader.GetWidth(), loader.GetHeight(), NoInit {}, loader.GetOutputName())
+    , MSAA_mask(loader.GetWidth(), loader.GetHeight(), NoInit {}, loader.GetOutputName())
+    , GBuffer(loader.GetWidth(), loader.GetHeight(), NoInit {}, loader.GetOutputName())
+    , ColorBuffer(loader.GetWidth(), loader.GetHeight(), NoInit {}, loader.GetOutputName())
+    , CoverageHits(0, 0) {}
 
-void Rasterizer::DrawPrimitiveRaw(Image& image, Triangle trig, AntiAliasConfig config, uint32_t spp) {
-    uint32_t xmax = 0, xmin = UINT32_MAX;
-    uint32_t ymax = 0, ymin = UINT32_MAX;
+PixelBounds Rasterizer::ClampedBounds(const Triangle& trig) const {
     const std::array<glm::vec4, 3>& vertices = trig.pos;
+    return ClampBounds(std::min({ vertices[0].x, vertices[1].x, vertices[2].x }),
+                       std::max({ vertices[0].x, vertices[1].x, vertices[2].x }),
+                       std::min({ vertices[0].y, vertices[1].y, vertices[2].y }),
+                       std::max({ vertices[0].y, vertices[1].y, vertices[2].y }), loader.GetWidth(),
+                       loader.GetHeight());
+}
+
+void Rasterizer::DrawPrimitiveRaw(ImageHDR& image, Triangle trig, AntiAliasConfig config, uint32_t spp) {
+    const PixelBounds bounds = this->ClampedBounds(trig);
+    if (bounds.Empty()) return;
+
+    for (uint32_t y = bounds.ymin; y <= bounds.ymax; ++y)
+        for (uint32_t x = bounds.xmin; x <= bounds.xmax; ++x)
+            this->DrawPixel(x, y, trig, config, spp, image, ColorHDR(1.f));
+}
+
+void Rasterizer::DrawSupersampled(const TriangleBatch& batch, const ColorHDR& color, const ColorHDR& background,
+                                  ImageHDR& image) {
+    const uint32_t n = SamplesPerSide(loader.GetSpp());
+    const uint32_t width = image.GetWidth(), height = image.GetHeight();
+    const uint32_t tilesX = (width + SUPERSAMPLE_TILE - 1) / SUPERSAMPLE_TILE;
+    const uint32_t tilesY = (height + SUPERSAMPLE_TILE - 1) / SUPERSAMPLE_TILE;
+    const bool apron = loader.GetSSAAFilter() == SSAAFilter::TENT;
 
-    std::array<glm::vec3, 3> trimmedPos;
-    for (size_t ind = 0; ind != 3; ++ind) {
-        const glm::vec4& v = vertices[ind];
-        if (v.x > xmax) xmax = v.x;
-        if (v.x < xmin) xmin = v.x;
-        if (v.y > ymax) ymax = v.y;
-        if (v.y < ymin) ymin = v.y;
-        trimmedPos[ind] = glm::vec3(v.x, v.y, 0);
+    // bin the triangles by the tiles whose samples they reach (the tent filter reads one pixel around the tile):
+    //     count per tile, prefix-sum into offsets, then fill, all in the frame arena
+    const uint32_t reach = apron ? 1 : 0;
+    auto forEachTile = [&](uint32_t i, auto&& visit) {
+        const PixelBounds& bounds = batch.Bounds(i);
+        const uint32_t x0 = (bounds.xmin / n - std::min(bounds.xmin / n, reach)) / SUPERSAMPLE_TILE;
+        const uint32_t y0 = (bounds.ymin / n - std::min(bounds.ymin / n, reach)) / SUPERSAMPLE_TILE;
+        const uint32_t x1 = std::min((bounds.xmax / n + reach) / SUPERSAMPLE_TILE, tilesX - 1);
+        const uint32_t y1 = std::min((bounds.ymax / n + reach) / SUPERSAMPLE_TILE, tilesY - 1);
+        for (uint32_t ty = y0; ty <= y1; ++ty)
+            for (uint32_t tx = x0; tx <= x1; ++tx) visit(ty * tilesX + tx);
+    };
+    Arena& arena = FrameArena::Local();
+    const std::span<uint32_t> binStart = arena.AllocateArray<uint32_t>(tilesX * tilesY + 1);
+    std::fill(binStart.begin(), binStart.end(), 0u);
+    for (uint32_t i = 0; i < batch.Size(); ++i) forEachTile(i, [&](uint32_t t) { ++binStart[t + 1]; });
+    for (uint32_t t = 0; t < tilesX * tilesY; ++t) binStart[t + 1] += binStart[t];
+    const std::span<uint32_t> binned = arena.AllocateArray<uint32_t>(binStart.back());
+    {
+        const std::span<uint32_t> cursor = arena.AllocateArray<uint32_t>(tilesX * tilesY);
+        std::copy(binStart.begin(), binStart.end() - 1, cursor.begin());
+        for (uint32_t i = 0; i < batch.Size(); ++i) forEachTile(i, [&](uint32_t t) { binned[cursor[t]++] = i; });
     }
 
-    for (uint32_t x = xmin; x <= xmax; ++x)
-        for (uint32_t y = ymin; y <= ymax; ++y) this->DrawPixel(x, y, trig, config, spp, image, Color::White);
+    std::vector<SampleTile> tiles(WorkerCount(), SampleTile(n));
+    ParallelFor(tilesX * tilesY, [&](uint32_t t, uint32_t worker) {
+        if (binStart[t] == binStart[t + 1]) return;
+        const uint32_t tx = t % tilesX, ty = t / tilesX;
+        const PixelBounds pixels = { tx * SUPERSAMPLE_TILE, std::min((tx + 1) * SUPERSAMPLE_TILE, width) - 1,
+                                     ty * SUPERSAMPLE_TILE, std::min((ty + 1) * SUPERSAMPLE_TILE, height) - 1 };
+        SampleTile& tile = tiles[worker];
+        tile.Begin(pixels, width, height, apron, background);
+        // in submission order, so that later triangles still end up on top
+        for (uint32_t i : binned.subspan(binStart[t], binStart[t + 1] - binStart[t]))
+            ForEachCoveredSpan(batch, i, false, tile.SampleBounds(), [&](uint32_t y, uint32_t xBegin, uint32_t xEnd) {
+                tile.Fill(y, xBegin, xEnd, color);
+            });
+        tile.Resolve(loader.GetSSAAFilter(), image);
+    });
 }
 
 void Rasterizer::AddModel(MeshTransform transform) {
@@ -58,8 +134,8 @@ void Rasterizer::AddModel(MeshTransform transform) {
 }
 
 void Rasterizer::InitMSSAMask(ImageGrey& MSSAMask, uint32_t num_samples) {
-    for (size_t i = 0; i != this->loader.GetHeight(); ++i)
-        for (size_t j = 0; j != this->loader.GetWidth(); ++j) MSSAMask.Set(j, i, Rasterizer::msaaMaskDefault);
+    msaaSamples.clear();
+    MSSAMask.Fill(Rasterizer::msaaMaskDefault);
 
     for (uint32_t i = 0; i < num_samples; ++i) {
         msaaSamples.emplace_back(std::cos(num_samples / (2 * std::numbers::pi)) + std::cos(std::numbers::pi / 4),
@@ -69,84 +145,258 @@ void Rasterizer::InitMSSAMask(ImageGrey& MSSAMask, uint32_t num_samples) {
 }
 
 void Rasterizer::InitZBuffer(ImageGrey& ZBuffer) {
-    for (size_t i = 0; i != this->loader.GetHeight(); ++i)
-        for (size_t j = 0; j != this->loader.GetWidth(); ++j) ZBuffer.Set(j, i, Rasterizer::zBufferDefault);
+    ZBuffer.Fill(Rasterizer::zBufferDefault);
 }
 
 void Rasterizer::InitGBuffer(ImageBuffer<gBufferStruct>& GBuffer) {
-    for (size_t i = 0; i != this->loader.GetHeight(); ++i)
-        for (size_t j = 0; j != this->loader.GetWidth(); ++j) GBuffer.Set(j, i, Rasterizer::gBufferDefault);
-}
-
-void Rasterizer::DrawPrimitiveDepth(Triangle transformed, Triangle original, ImageGrey& ZBuffer) {
-    uint32_t xmax = 0, xmin = UINT32_MAX;
-    uint32_t ymax = 0, ymin = UINT32_MAX;
-    const std::array<glm::vec4, 3>& vertices = transformed.pos;
-
-    std::array<glm::vec3, 3> trimmedPos;
-    for (size_t ind = 0; ind != 3; ++ind) {
-        const glm::vec4& v = vertices[ind];
-        if (v.x > xmax) xmax = v.x;
-        if (v.x < xmin) xmin = v.x;
-        if (v.y > ymax) ymax = v.y;
-        if (v.y < ymin) ymin = v.y;
-        trimmedPos[ind] = glm::vec3(v.x, v.y, 0);
+    GBuffer.Fill(Rasterizer::gBufferDefault);
+}
+
+void Rasterizer::InitColorBuffer(ImageHDR& ColorBuffer) {
+    ColorBuffer.Fill(Rasterizer::colorBufferDefault);
+}
+
+template <RasterPass PASS, bool MSAA, typename Target>
+void Rasterizer::RasterizeSpans(const TriangleBatch& batch, uint32_t index, Target& target) {
+    // MSAA spans are conservative and reach pixels whose centers the triangle misses, where the occluder's 1/w is
+    //     extrapolated; the occlusion buffer only takes the pixels the triangle covers
+    if constexpr (PASS == RasterPass::DEPTH && MSAA)
+        if (this->occlusion.Enabled())
+            ForEachCoveredSpan(batch, index, false, [&](uint32_t y, uint32_t xBegin, uint32_t xEnd) {
+                this->occlusion.WriteSpan(y, xBegin, xEnd, batch.InverseW(index));
+            });
+    ForEachCoveredSpan(batch, index, MSAA, [&](uint32_t y, uint32_t xBegin, uint32_t xEnd) {
+        if constexpr (PASS == RasterPass::COVERAGE) {
+            uint32_t* row = target.Row(y);
+            for (uint32_t x = xBegin; x <= xEnd; ++x) ++row[x];
+            return;
+        }
+        if constexpr (PASS == RasterPass::DEPTH && !MSAA)
+            if (this->occlusion.Enabled()) this->occlusion.WriteSpan(y, xBegin, xEnd, batch.InverseW(index));
+        for (uint32_t x = xBegin; x <= xEnd; ++x) {
+            if constexpr (MSAA) this->UpdateMSAAAtPixel(x, y, batch, index, this->MSAA_mask);
+
+            if constexpr (PASS == RasterPass::DEPTH)
+                this->UpdateDepthAtPixel(x, y, batch, index, target);
+            else if constexpr (PASS == RasterPass::GBUFFER)
+                this->UpdateGBufferAtPixel(x, y, batch, index, target);
+            else if constexpr (PASS == RasterPass::SHADED)
+                this->ShadeAtPixel(x, y, batch, index, target);
+        }
+    });
+}
+
+template <RasterPass PASS, bool MSAA>
+void Rasterizer::DrawPass(const TriangleBatch& batch, uint32_t index, ImageHDR& image) {
+    if constexpr (PASS == RasterPass::DEPTH)
+        this->RasterizeSpans<PASS, MSAA>(batch, index, this->ZBuffer);
+    else if constexpr (PASS == RasterPass::GBUFFER)
+        this->RasterizeSpans<PASS, MSAA>(batch, index, this->GBuffer);
+    else if constexpr (PASS == RasterPass::SHADED)
+        this->RasterizeSpans<PASS, MSAA>(batch, index, image);
+    else
+        this->RasterizeSpans<PASS, MSAA>(batch, index, this->CoverageHits);
+}
+
+void Rasterizer::RasterizeGeneric(bool shapePass, const TriangleBatch& batch, uint32_t index, ImageHDR& image) {
+    const bool conservative = shapePass && loader.GetAntiAliasConfig() == AntiAliasConfig::MSAA;
+    ForEachCoveredSpan(batch, index, conservative, [&](uint32_t y, uint32_t xBegin, uint32_t xEnd) {
+        if (!shapePass && loader.GetType() != TestType::WATERTIGHT_TEST && this->occlusion.Enabled())
+            this->occlusion.WriteSpan(y, xBegin, xEnd, batch.InverseW(index));
+        for (uint32_t x = xBegin; x <= xEnd; ++x) {
+            if (loader.GetType() == TestType::WATERTIGHT_TEST) {
+                ++this->CoverageHits.Row(y)[x];
+            } else if (!shapePass) {
+                this->UpdateDepthAtPixel(x, y, batch, index, this->ZBuffer);
+            } else {
+                if (loader.GetAntiAliasConfig() == AntiAliasConfig::MSAA)
+                    this->UpdateMSAAAtPixel(x, y, batch, index, this->MSAA_mask);
+                if (loader.GetType() == TestType::DEFERRED_SHADING)
+                    this->UpdateGBufferAtPixel(x, y, batch, index, this->GBuffer);
+                else
+                    this->ShadeAtPixel(x, y, batch, index, image);
+            }
+        }
+    });
+}
+
+void Rasterizer::DrawGenericTriangle(const TriangleBatch& batch, uint32_t index, ImageHDR& image) {
+    this->RasterizeGeneric(false, batch, index, image);
+}
+
+void Rasterizer::DrawGenericShape(const TriangleBatch& batch, uint32_t index, ImageHDR& image) {
+    this->RasterizeGeneric(true, batch, index, image);
+}
+
+Rasterizer::Pipeline Rasterizer::SelectPipeline() const {
+    if (loader.GetGenericPipeline()) {
+        const TestType type = loader.GetType();
+        const bool shaded = type == TestType::SHADING || type == TestType::DEFERRED_SHADING;
+        if (!shaded && type != TestType::SHADING_DEPTH && type != TestType::WATERTIGHT_TEST) return {};
+        return { &Rasterizer::DrawGenericTriangle, shaded ? &Rasterizer::DrawGenericShape : nullptr, "generic" };
+    }
+    const bool msaa = loader.GetAntiAliasConfig() == AntiAliasConfig::MSAA;
+    switch (loader.GetType()) {
+    case TestType::SHADING_DEPTH:
+        return { &Rasterizer::DrawPass<RasterPass::DEPTH, false>, nullptr, "depth" };
+    case TestType::SHADING:
+        if (msaa)
+            return { &Rasterizer::DrawPass<RasterPass::DEPTH, false>, &Rasterizer::DrawPass<RasterPass::SHADED, true>,
+                     "depth + shaded/MSAA" };
+        return { &Rasterizer::DrawPass<RasterPass::DEPTH, false>, &Rasterizer::DrawPass<RasterPass::SHADED, false>,
+                 "depth + shaded" };
+    case TestType::DEFERRED_SHADING:
+        if (msaa)
+            return { &Rasterizer::DrawPass<RasterPass::DEPTH, false>, &Rasterizer::DrawPass<RasterPass::GBUFFER, true>,
+                     "depth + G-buffer/MSAA" };
+        return { &Rasterizer::DrawPass<RasterPass::DEPTH, false>, &Rasterizer::DrawPass<RasterPass::GBUFFER, false>,
+                 "depth + G-buffer" };
+    case TestType::WATERTIGHT_TEST:
+        return { &Rasterizer::DrawPass<RasterPass::COVERAGE, false>, nullptr, "coverage" };
+    default:
+        return {};
     }
+}
+
+void Rasterizer::DrawPrimitiveDepth(const TriangleBatch& batch, uint32_t index, ImageGrey& ZBuffer) {
+    this->RasterizeSpans<RasterPass::DEPTH, false>(batch, index, ZBuffer);
+}
 
-    for (uint32_t x = xmin; x <= xmax; ++x)
-        for (uint32_t y = ymin; y <= ymax; ++y) this->UpdateDepthAtPixel(x, y, original, transformed, ZBuffer);
+void Rasterizer::DrawPrimitiveGBuffer(const TriangleBatch& batch, uint32_t index,
+                                      ImageBuffer<gBufferStruct>& gBuffer) {
+    if (loader.GetAntiAliasConfig() == AntiAliasConfig::MSAA)
+        this->RasterizeSpans<RasterPass::GBUFFER, true>(batch, index, gBuffer);
+    else
+        this->RasterizeSpans<RasterPass::GBUFFER, false>(batch, index, gBuffer);
 }
 
-void Rasterizer::DrawPrimitiveGBuffer(Triangle transformed, Triangle original, ImageBuffer<gBufferStruct>& gBuffer) {
-    uint32_t xmax = 0, xmin = UINT32_MAX;
-    uint32_t ymax = 0, ymin = UINT32_MAX;
-    const std::array<glm::vec4, 3>& vertices = transformed.pos;
+void Rasterizer::DrawPrimitiveShaded(const TriangleBatch& batch, uint32_t index, ImageHDR& image) {
+    if (loader.GetAntiAliasConfig() == AntiAliasConfig::MSAA)
+        this->RasterizeSpans<RasterPass::SHADED, true>(batch, index, image);
+    else
+        this->RasterizeSpans<RasterPass::SHADED, false>(batch, index, image);
+}
+
+void Rasterizer::CountCoverage(const TriangleBatch& batch, uint32_t index, ImageBuffer<uint32_t>& hits) {
+    this->RasterizeSpans<RasterPass::COVERAGE, false>(batch, index, hits);
+}
 
-    std::array<glm::vec3, 3> trimmedPos;
-    for (size_t ind = 0; ind != 3; ++ind) {
-        const glm::vec4& v = vertices[ind];
-        if (v.x > xmax) xmax = v.x;
-        if (v.x < xmin) xmin = v.x;
-        if (v.y > ymax) ymax = v.y;
-        if (v.y < ymin) ymin = v.y;
-        trimmedPos[ind] = glm::vec3(v.x, v.y, 0);
+void Rasterizer::DrawPrimitiveShaded(ImageHDR& image) {
+    if (loader.GetShaderConfig() == ShaderConfig::BATCHED) {
+        this->ShadeDeferredBatched(image);
+        return;
     }
+    for (uint32_t y = 0; y < loader.GetHeight(); ++y)
+        for (uint32_t x = 0; x < loader.GetWidth(); ++x) this->ShadeAtPixel(x, y, image);
+}
+
+void Rasterizer::ShadeDeferredBatched(ImageHDR& image) {
+    const BlinnPhongKernel kernel(loader.GetLights(), loader.GetAmbientColor(), loader.GetSpecularExponent(),
+                                  loader.GetCamera().pos, this->shadowMaps.Empty() ? nullptr : &this->shadowMaps);
+    const bool textured = !this->mipmap_vector.empty() || this->virtualTexture;
+    constexpr float INV_255 = 1.f / 255.f;
+
+    ShadeBatch batch;
+    ShadeResult result;
+    std::array<uint32_t, SHADE_LANES> columns;
+    std::vector<uint32_t> lights;
+    for (uint32_t y = 0; y < loader.GetHeight(); ++y) {
+        const gBufferStruct* gRow = this->GBuffer.Row(y);
+        ColorHDR* row = image.Row(y);
 
-    for (uint32_t x = xmin; x <= xmax; ++x) {
-        for (uint32_t y = ymin; y <= ymax; ++y) {
-            if (loader.GetAntiAliasConfig() == AntiAliasConfig::MSAA) {
-                this->UpdateMSAAAtPixel(x, y, original, transformed, this->MSAA_mask);
+        auto flush = [&]() {
+            if (batch.count == 0) return;
+            batch.Pad();
+            // neighboring pixels are usually close in world space, so the lights reaching their box are few
+            glm::vec3 boxMin(batch.px[0], batch.py[0], batch.pz[0]), boxMax = boxMin;
+            for (uint32_t i = 1; i != batch.count; ++i) {
+                const glm::vec3 p(batch.px[i], batch.py[i], batch.pz[i]);
+                boxMin = glm::min(boxMin, p);
+                boxMax = glm::max(boxMax, p);
             }
-            this->UpdateGBufferAtPixel(x, y, original, transformed, gBuffer);
+            this->lightGrid.Gather(boxMin, boxMax, lights);
+            kernel.Shade(batch, result, lights);
+            for (uint32_t i = 0; i != batch.count; ++i)
+                row[columns[i]] = ColorHDR(result.r[i], result.g[i], result.b[i], 1.f);
+            batch.count = 0;
+        };
+
+        for (uint32_t x = 0; x < loader.GetWidth(); ++x) {
+            const gBufferStruct& sample = gRow[x];
+            if (sample.norm == glm::vec3(0.f)) continue;   // nothing was drawn here
+
+            const uint32_t i = batch.count++;
+            columns[i] = x;
+            batch.nx[i] = sample.norm.x;
+            batch.ny[i] = sample.norm.y;
+            batch.nz[i] = sample.norm.z;
+            batch.px[i] = sample.pos.x;
+            batch.py[i] = sample.pos.y;
+            batch.pz[i] = sample.pos.z;
+            batch.albedoR[i] = textured ? static_cast<unsigned char>(sample.texel.r) * INV_255 : 1.f;
+            batch.albedoG[i] = textured ? static_cast<unsigned char>(sample.texel.g) * INV_255 : 1.f;
+            batch.albedoB[i] = textured ? static_cast<unsigned char>(sample.texel.b) * INV_255 : 1.f;
+            if (batch.count == SHADE_LANES) flush();
         }
+        flush();
     }
 }
 
-void Rasterizer::DrawPrimitiveShaded(Triangle transformed, Triangle original, Image& image) {
-    uint32_t xmax = 0, xmin = UINT32_MAX;
-    uint32_t ymax = 0, ymin = UINT32_MAX;
-    const std::array<glm::vec4, 3>& vertices = transformed.pos;
+ShadowUpdate Rasterizer::RenderShadowMaps(uint32_t size) {
+    const ModelMeshes& meshes = loader.GetMeshes();
 
-    std::array<glm::vec3, 3> trimmedPos;
-    for (size_t ind = 0; ind != 3; ++ind) {
-        const glm::vec4& v = vertices[ind];
-        if (v.x > xmax) xmax = v.x;
-        if (v.x < xmin) xmin = v.x;
-        if (v.y > ymax) ymax = v.y;
-        if (v.y < ymin) ymin = v.y;
-        trimmedPos[ind] = glm::vec3(v.x, v.y, 0);
+    // instanced shapes only cast the shadows of their instances, which come after all other shapes
+    std::vector<std::pair<size_t, glm::mat4>> draws;
+    std::vector<bool> instanced(meshes.shapes.size(), false);
+    for (const InstanceSet& set : loader.GetInstances()) instanced[set.shape] = true;
+    for (size_t s = 0; s < meshes.shapes.size(); ++s)
+        if (!instanced[s]) draws.emplace_back(s, this->model.size() > s ? this->model[s] : glm::mat4(1.f));
+    for (const InstanceSet& set : loader.GetInstances()) {
+        const glm::mat4 shapeMat = this->model.size() > set.shape ? this->model[set.shape] : glm::mat4(1.f);
+        for (const MeshTransform& transform : set.transforms)
+            draws.emplace_back(set.shape, shapeMat * ComposeTransform(transform));
     }
 
-    for (uint32_t x = xmin; x <= xmax; ++x) {
-        for (uint32_t y = ymin; y <= ymax; ++y) {
-            if (loader.GetAntiAliasConfig() == AntiAliasConfig::MSAA) {
-                this->UpdateMSAAAtPixel(x, y, original, transformed, this->MSAA_mask);
-            }
-            this->ShadeAtPixel(x, y, original, transformed, image);
+    // casters are keyed and bounded from what was computed per shape at load time, so that frames whose faces are
+    //     all kept never touch a vertex
+    std::vector<ShadowCaster> casters;
+    casters.reserve(draws.size());
+    for (const auto& [s, modelMat] : draws) {
+        constexpr float FAR = std::numeric_limits<float>::infinity();
+        ShadowCaster caster { ShapeKey(meshes.shapeHashes[s], modelMat), glm::vec3(FAR), glm::vec3(-FAR) };
+        // the world box of the model box: its center moved, its half extent through the matrix's absolute values
+        const auto& [boundsMin, boundsMax] = meshes.shapeBounds[s];
+        if (boundsMin.x <= boundsMax.x) {
+            const glm::vec3 center = modelMat * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.f);
+            const glm::mat3 spread(glm::abs(glm::vec3(modelMat[0])), glm::abs(glm::vec3(modelMat[1])),
+                                   glm::abs(glm::vec3(modelMat[2])));
+            const glm::vec3 extent = spread * ((boundsMax - boundsMin) * 0.5f);
+            caster.boundsMin = center - extent;
+            caster.boundsMax = center + extent;
         }
+        casters.push_back(caster);
     }
+
+    this->shadowMaps.SetFilter(loader.GetShadowFilter());
+    // every caster triangle in world space, transformed once for all faces of all lights
+    return this->shadowMaps.Update(loader.GetLights(), casters, size, [&](std::vector<glm::vec3>& triangles) {
+        for (const auto& [s, modelMat] : draws)
+            for (const tinyobj::index_t& idx : meshes.shapes[s].mesh.indices) {
+                const float* v = &meshes.attribs.vertices[3 * size_t(idx.vertex_index)];
+                triangles.push_back(modelMat * glm::vec4(v[0], v[1], v[2], 1.f));
+            }
+    });
+}
+
+bool Rasterizer::OpenVirtualTexture(const std::string& texture_filename) {
+    this->virtualTexture = std::make_unique<VirtualTexture>();
+    if (this->virtualTexture->Open(texture_filename)) return true;
+    this->virtualTexture.reset();
+    return false;
+}
+
+Color Rasterizer::SampleTexel(glm::vec2 tex_coord, float depth) {
+    if (this->virtualTexture)
+        return this->virtualTexture->Sample(tex_coord, this->virtualTexture->LevelFromDepth(depth));
+    return this->GetTexel(tex_coord, depth);
 }
-void Rasterizer::DrawPrimitiveShaded(Image& image) {
-    for (uint32_t x = 0; x <= loader.GetWidth(); ++x)
-        for (uint32_t y = 0; y <= loader.GetHeight(); ++y) this->ShadeAtPixel(x, y, image);
-}
\ No newline at end of file
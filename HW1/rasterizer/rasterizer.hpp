@@ -2,13 +2,22 @@
 #define RASTERIZER_H
 
 #include <cstdint>
+#include <memory>
 #include <vector>
 
 #include <_types/_uint32_t.h>
 
 #include "entities.hpp"
 #include "image.hpp"
+#include "light_grid.hpp"
 #include "loader.hpp"
+#include "occlusion.hpp"
+#include "shadow.hpp"
+#include "triangle_batch.hpp"
+#include "virtual_texture.hpp"
+
+// What a raster pass writes for each covered pixel
+enum class RasterPass { DEPTH, GBUFFER, SHADED, COVERAGE };
 
 class Rasterizer {
 public:
@@ -18,11 +27,31 @@ public:
         Color texel;
     };
 
-    Rasterizer(Loader& loader);
+    // The per-triangle raster passes of a frame. Each entry is an instantiation specialized on the pass and the
+    //     anti-aliasing mode, so the pixel loops have no config branches; `Draw` writes shaded pixels to `image` and
+    //     everything else to the rasterizer's own buffers.
+    struct Pipeline {
+        using Draw = void (Rasterizer::*)(const TriangleBatch& batch, uint32_t index, ImageHDR& image);
+
+        Draw perTriangle = nullptr;   // called as soon as a triangle is set up
+        Draw perShape = nullptr;      // called for every triangle of a shape once the shape went through perTriangle
+        const char* name = "none";
+    };
+
+    Rasterizer(const Loader& loader);
 
     /// rasterizer.cpp
+    // Bounding box of a screen-space triangle clamped to the screen, so pixels inside it can use unchecked access
+    PixelBounds ClampedBounds(const Triangle& trig) const;
+
     // Render a single triangle, with no transformations, and possible anti-aliasing, based on config
-    void DrawPrimitiveRaw(Image& image, Triangle trig, AntiAliasConfig config, uint32_t spp);
+    void DrawPrimitiveRaw(ImageHDR& image, Triangle trig, AntiAliasConfig config, uint32_t spp);
+
+    // SSAA for raw triangles: `batch` is set up on a screen SamplesPerSide(spp) times larger than `image` (see
+    //     supersample.hpp), so each of its pixels is a sample. Screen tiles are rasterized into sample grids that
+    //     start out as `background` and filtered into `image`, in parallel; tiles no triangle reaches are left as is.
+    void DrawSupersampled(const TriangleBatch& batch, const ColorHDR& color, const ColorHDR& background,
+                          ImageHDR& image);
 
     // Add a model to the rasterizer. Provide rotation part of the transformation, and dispatch to the impl version
     void AddModel(MeshTransform transform);
@@ -36,35 +65,90 @@ public:
     // Initialize the ZBuffer with the default value specified in impl
     void InitGBuffer(ImageBuffer<gBufferStruct>& GBuffer);
 
-    // Render the depth information of a single triangle.
-    void DrawPrimitiveDepth(Triangle transformed, Triangle original, ImageGrey& ZBuffer);
+    // Clear the float color target to colorBufferDefault
+    void InitColorBuffer(ImageHDR& ColorBuffer);
+
+    // Render the depth information of a single triangle of the batch.
+    void DrawPrimitiveDepth(const TriangleBatch& batch, uint32_t index, ImageGrey& ZBuffer);
+
+    // update the GBuffer with a single triangle of the batch
+    void DrawPrimitiveGBuffer(const TriangleBatch& batch, uint32_t index, ImageBuffer<gBufferStruct>& gBuffer);
 
-    // update the GBuffer with a single triangle
-    void DrawPrimitiveGBuffer(Triangle transformed, Triangle original, ImageBuffer<gBufferStruct>& gBuffer);
+    // Render a single triangle of the batch, with blinn-phong shading
+    void DrawPrimitiveShaded(const TriangleBatch& batch, uint32_t index, ImageHDR& image);
 
-    // Render a single triangle, with blinn-phong shading
-    void DrawPrimitiveShaded(Triangle transformed, Triangle original, Image& image);
+    // Count how many triangles own each pixel center; used to check that closed meshes rasterize watertight
+    void CountCoverage(const TriangleBatch& batch, uint32_t index, ImageBuffer<uint32_t>& hits);
+
+    // Choose the raster passes for the configured task and anti-aliasing once, before drawing the frame; with
+    //     `pipeline: generic` in the config, passes that decide both at every pixel instead
+    Pipeline SelectPipeline() const;
 
     // Render the full image, with blinn-phong shading (via deferred shading)
-    void DrawPrimitiveShaded(Image& image);
+    void DrawPrimitiveShaded(ImageHDR& image);
+
+    // Deferred resolve through `BlinnPhongKernel` (see shading.hpp): G-buffer pixels are gathered SHADE_LANES at a
+    //     time and shaded in float, straight into the float color target, against the lights `lightGrid` finds
+    //     around their positions
+    void ShadeDeferredBatched(ImageHDR& image);
+
+    // Bring the cube shadow map of every light up to date with all shapes and their model matrices; faces that
+    //     neither their light nor a moving shape affects are kept from the previous frame (see shadow.hpp)
+    ShadowUpdate RenderShadowMaps(uint32_t size);
+
+    // Fraction of light `light` reaching `pos` (world space), 0 in full shadow, in between in the penumbrae of the
+    //     config's `shadowfilter`; always 1 without shadow maps, so shading code can multiply every light's
+    //     contribution by it unconditionally
+    inline float ShadowVisibility(size_t light, glm::vec3 pos) const { return this->shadowMaps.Visibility(light, pos); }
+
+    // Replace `lights` with the indices of the lights that reach `pos` (world space), in increasing order: the
+    //     bounded lights whose radius covers it and every unbounded one. Weight each by
+    //     `Light::Attenuation(d2)` rather than 1 / d2 so bounded lights fade out before their radius.
+    inline void LightsNear(glm::vec3 pos, std::vector<uint32_t>& lights) const {
+        this->lightGrid.Gather(pos, pos, lights);
+    }
+
+    // Use a baked tiled texture (see `VirtualTexture::Bake`) instead of a fully resident mipmap
+    bool OpenVirtualTexture(const std::string& texture_filename);
+    // Texel to shade with: from the virtual texture's resident pages when one is open, recording the page in its
+    //     feedback buffer so that the renderer streams it in before the next pass, and from GetTexel otherwise
+    Color SampleTexel(glm::vec2 tex_coord, float depth);
+
+private:
+    // Run `PASS` over the pixels the triangle covers (touches, with MSAA), writing to `target`
+    template <RasterPass PASS, bool MSAA, typename Target>
+    void RasterizeSpans(const TriangleBatch& batch, uint32_t index, Target& target);
+
+    // Pipeline entry point: RasterizeSpans on the buffer that belongs to `PASS`
+    template <RasterPass PASS, bool MSAA>
+    void DrawPass(const TriangleBatch& batch, uint32_t index, ImageHDR& image);
+
+    // Unspecialized pipeline entry points, which read the task and anti-aliasing from the config for every pixel
+    void DrawGenericTriangle(const TriangleBatch& batch, uint32_t index, ImageHDR& image);
+    void DrawGenericShape(const TriangleBatch& batch, uint32_t index, ImageHDR& image);
+    void RasterizeGeneric(bool shapePass, const TriangleBatch& batch, uint32_t index, ImageHDR& image);
 
+public:
     // rasterizer_impl.cpp
 
     /**
      * Given a single pixel in the screen space with the triangle in which the pixel is considered, determine the output
      * color that should be rendered for the pixel. This function will be called for every pixel in the bounding box of
      * the triangle.
+     * Note: (x, y) is always inside the screen, so buffers can be accessed with the unchecked `operator()` of
+     * `ImageBuffer` (compile with IMAGE_BOUNDS_CHECK to validate it while debugging).
      * @param x: x coordinate of the pixel
      * @param y: y coordinate of the pixel
      * @param trig: the triangle in which the pixel is considered; see class `Triangle` in `entities.hpp`
-     * @param config: the anti-aliasing configuration, which can be either `NONE` or `SSAA`
+     * @param config: the anti-aliasing configuration; always `NONE` here, since SSAA triangles are rendered by
+     * `DrawSupersampled` into a supersampled target instead
      * @param spp: the number of samples per pixel. Only useful if config is set to `SSAA`
-     * @param image: the image to render the pixel on. See class `Image` in `image.hpp` for APIs of read/write
-     * operations
+     * @param image: the linear float image to render the pixel on (1 is white, values are not clamped); it is
+     * tonemapped to 8 bits once, after the frame. See `ImageHDR` in `image.hpp`
      * @param color: the color to render the pixel with, if the pixel is completely inside the triangle
      */
-    void DrawPixel(uint32_t x, uint32_t y, Triangle trig, AntiAliasConfig config, uint32_t spp, Image& image,
-                   Color color);
+    void DrawPixel(uint32_t x, uint32_t y, Triangle trig, AntiAliasConfig config, uint32_t spp, ImageHDR& image,
+                   ColorHDR color);
 
 
     /**
@@ -104,28 +188,36 @@ public:
     glm::vec3 BarycentricCoordinate(glm::vec2 pos, Triangle trig);
 
     /**
-     * Update the depth information at a single pixel in the ZBuffer. This function will be called for every pixel in
-     * the bounding box of the triangle.
+     * Update the depth information at a single pixel in the ZBuffer. This function will be called for every pixel
+     * whose center is owned by the triangle (the coverage test and fill rule are already applied).
+     * Note: (x, y) is always inside the screen, so buffers can be accessed with the unchecked `operator()` of
+     * `ImageBuffer` (compile with IMAGE_BOUNDS_CHECK to validate it while debugging).
      * @param x: x coordinate of the pixel
      * @param y: y coordinate of the pixel
-     * @param original: the original triangle in the model space (before MVP transformation)
-     * @param transformed: the transformed triangle in the screen space (after MVP transformation)
+     * @param batch: the set-up triangles of the current shape; see class `TriangleBatch` in `triangle_batch.hpp` for
+     * coverage tests (`Covers`) and perspective-correct interpolation of depth, position, normal and tex_coord
+     * (`Interpolate`)
+     * @param index: index of the triangle in `batch`
      * @param ZBuffer: the ZBuffer to update the depth information in. See spec, or class `Image` in `image.hpp` for
      * APIs of read/write operations
      */
-    void UpdateDepthAtPixel(uint32_t x, uint32_t y, Triangle original, Triangle transformed, ImageGrey& ZBuffer);
+    void UpdateDepthAtPixel(uint32_t x, uint32_t y, const TriangleBatch& batch, uint32_t index, ImageGrey& ZBuffer);
 
     /**
      * Update the sample information at a single pixel in the MSSABuffer. This function will be called for every pixel
-     * in the bounding box of the triangle.
+     * the triangle touches, so the samples still need `Covers` tests.
+     * Note: (x, y) is always inside the screen, so buffers can be accessed with the unchecked `operator()` of
+     * `ImageBuffer` (compile with IMAGE_BOUNDS_CHECK to validate it while debugging).
      * @param x: x coordinate of the pixel
      * @param y: y coordinate of the pixel
-     * @param original: the original triangle in the model space (before MVP transformation)
-     * @param transformed: the transformed triangle in the screen space (after MVP transformation)
+     * @param batch: the set-up triangles of the current shape; see class `TriangleBatch` in `triangle_batch.hpp` for
+     * coverage tests (`Covers`) and perspective-correct interpolation of depth, position, normal and tex_coord
+     * (`Interpolate`)
+     * @param index: index of the triangle in `batch`
      * @param MSAAMask: the MSAAMask to update the coverage information in. See spec, or class `Image` in `image.hpp`
      * for APIs of read/write operations
      */
-    void UpdateMSAAAtPixel(uint32_t x, uint32_t y, Triangle original, Triangle transformed, ImageGrey& MSAAMask);
+    void UpdateMSAAAtPixel(uint32_t x, uint32_t y, const TriangleBatch& batch, uint32_t index, ImageGrey& MSAAMask);
 
     /**
      * @brief Create a vector MipMap levels. This will modify the this->mipmap_vector
@@ -145,43 +237,66 @@ public:
     Color GetTexel(glm::vec2 tex_coord, float depth);
 
     /**
-     * Update the gbuffer information at a single pixel in the ZBuffer. This function will be called for every pixel in
-     * the bounding box of the triangle. This is specifically used for deferred shading.
+     * Update the gbuffer information at a single pixel in the ZBuffer. This function will be called for every pixel
+     * whose center is owned by the triangle (every pixel it touches with MSAA). This is specifically used for deferred
+     * shading.
+     * Note: (x, y) is always inside the screen, so buffers can be accessed with the unchecked `operator()` of
+     * `ImageBuffer` (compile with IMAGE_BOUNDS_CHECK to validate it while debugging).
      * @param x: x coordinate of the pixel
      * @param y: y coordinate of the pixel
-     * @param original: the original triangle in the model space (before MVP transformation)
-     * @param transformed: the transformed triangle in the screen space (after MVP transformation)
+     * @param batch: the set-up triangles of the current shape; see class `TriangleBatch` in `triangle_batch.hpp` for
+     * coverage tests (`Covers`) and perspective-correct interpolation of depth, position, normal and tex_coord
+     * (`Interpolate`)
+     * @param index: index of the triangle in `batch`
      * @param NormBuffer: the NormBuffer to update the normal information in. See spec, or class `Image` in `image.hpp`
      * for APIs of read/write operations
+     * Note: sample textures through `SampleTexel(tex_coord, depth)` rather than `GetTexel`, so that a baked `.vtex`
+     * texture reads its resident pages and streams in the ones this pass asked for
      */
-    void UpdateGBufferAtPixel(uint32_t x, uint32_t y, Triangle original, Triangle transformed,
+    void UpdateGBufferAtPixel(uint32_t x, uint32_t y, const TriangleBatch& batch, uint32_t index,
                               ImageBuffer<gBufferStruct>& gBuffer);
 
     /**
      * Shade the pixel at the given position, using Blinn-Phong shading model. This function will be called for every
      * pixel This function should only be used with deferred shading
+     * Note: (x, y) is always inside the screen, so buffers can be accessed with the unchecked `operator()` of
+     * `ImageBuffer` (compile with IMAGE_BOUNDS_CHECK to validate it while debugging).
      * @param x: x coordinate of the pixel
      * @param y: y coordinate of the pixel
-     * @param image: the image to render the pixel on. See spec, or class `Image` in `image.hpp` for APIs of read/write
-     * operations
+     * @param image: the linear float image to render the pixel on (1 is white, values are not clamped, so lights can
+     * be summed without any conversion); it is tonemapped to 8 bits once, after the frame. See `ImageHDR` in
+     * `image.hpp`
+     * Note: scale each light's contribution by `ShadowVisibility(light, pos)` to get shadows when the config sets
+     * `shadows`; it already includes the soft-shadow filtering of `shadowfilter`. With many lights, loop over
+     * `LightsNear(pos, ...)` instead of all of them
      */
-    void ShadeAtPixel(uint32_t x, uint32_t y, Image& image);
+    void ShadeAtPixel(uint32_t x, uint32_t y, ImageHDR& image);
 
     /**
      * Shade the pixel at the given position, using Blinn-Phong shading model. This function will be called for every
-     * pixel in the bounding box of the triangle.
+     * pixel whose center is owned by the triangle (every pixel it touches with MSAA).
+     * Note: (x, y) is always inside the screen, so buffers can be accessed with the unchecked `operator()` of
+     * `ImageBuffer` (compile with IMAGE_BOUNDS_CHECK to validate it while debugging).
      * @param x: x coordinate of the pixel
      * @param y: y coordinate of the pixel
-     * @param original: the original triangle in the model space (before MVP transformation)
-     * @param transformed: the transformed triangle in the screen space (after MVP transformation)
-     * @param image: the image to render the pixel on. See spec, or class `Image` in `image.hpp` for APIs of read/write
-     * operations
+     * @param batch: the set-up triangles of the current shape; see class `TriangleBatch` in `triangle_batch.hpp` for
+     * coverage tests (`Covers`) and perspective-correct interpolation of depth, position, normal and tex_coord
+     * (`Interpolate`)
+     * @param index: index of the triangle in `batch`
+     * @param image: the linear float image to render the pixel on (1 is white, values are not clamped, so lights can
+     * be summed without any conversion); it is tonemapped to 8 bits once, after the frame. See `ImageHDR` in
+     * `image.hpp`
+     * Note: scale each light's contribution by `ShadowVisibility(light, pos)` to get shadows when the config sets
+     * `shadows`; it already includes the soft-shadow filtering of `shadowfilter`. With many lights, loop over
+     * `LightsNear(pos, ...)` instead of all of them
+     * Note: sample textures through `SampleTexel(tex_coord, depth)` rather than `GetTexel`, so that a baked `.vtex`
+     * texture reads its resident pages and streams in the ones this pass asked for
      */
-    void ShadeAtPixel(uint32_t x, uint32_t y, Triangle original, Triangle transformed, Image& image);
+    void ShadeAtPixel(uint32_t x, uint32_t y, const TriangleBatch& batch, uint32_t index, ImageHDR& image);
 
 public:
     // Configs
-    Loader& loader;
+    const Loader& loader;
     std::vector<glm::mat4x4> model;
     glm::mat4x4 view;
     glm::mat4x4 projection;
@@ -191,8 +306,16 @@ public:
     ImageGrey ZBuffer;
     ImageGrey MSAA_mask;
     ImageBuffer<gBufferStruct> GBuffer;
+    ImageHDR ColorBuffer;                 // shading target of the color tasks, resolved into the output image
+    ImageBuffer<uint32_t> CoverageHits;   // only sized for the watertight test
+    ShadowMaps shadowMaps;                // empty unless the config asks for shadows; kept by the renderer across
+                                          //     configs so that static faces are reused
+    LightGrid lightGrid;                  // over the config's lights, built by the renderer before shading
+    OcclusionBuffer occlusion;            // nearest surface of the depth pass per pixel, enabled by the renderer
+                                          //     when it culls clusters
 
     std::vector<Image> mipmap_vector;
+    std::unique_ptr<VirtualTexture> virtualTexture;
 
     // Configurations
     /**
@@ -201,6 +324,7 @@ public:
     static float zBufferDefault;
     static bool msaaMaskDefault;
     static gBufferStruct gBufferDefault;
+    static ColorHDR colorBufferDefault;   // opaque black, set by the framework
 
     std::vector<glm::vec2> msaaSamples;
 };
@@ -29,8 +29,8 @@ void printMat4(glm::mat4 mat) {
 
 bool sampleIsInsideTriangle(glm::vec3 sample_pos, Triangle trig) {}
 
-void Rasterizer::DrawPixel(uint32_t x, uint32_t y, Triangle trig, AntiAliasConfig config, uint32_t spp, Image& image,
-                           Color color) {}
+void Rasterizer::DrawPixel(uint32_t x, uint32_t y, Triangle trig, AntiAliasConfig config, uint32_t spp,
+                           ImageHDR& image, ColorHDR color) {}
 
 // TODO
 void Rasterizer::AddModel(MeshTransform transform, glm::mat4 rotation) {}
@@ -48,29 +48,30 @@ void Rasterizer::SetScreenSpace() {}
 glm::vec3 Rasterizer::BarycentricCoordinate(glm::vec2 pos, Triangle trig) {}
 
 float Rasterizer::zBufferDefault = -1.0F;
-void Rasterizer::UpdateDepthAtPixel(uint32_t x, uint32_t y, Triangle original, Triangle transformed,
+void Rasterizer::UpdateDepthAtPixel(uint32_t x, uint32_t y, const TriangleBatch& batch, uint32_t index,
                                     ImageGrey& ZBuffer) {}
 
 bool Rasterizer::msaaMaskDefault = false;
-void Rasterizer::UpdateMSAAAtPixel(uint32_t x, uint32_t y, Triangle original, Triangle transformed,
+void Rasterizer::UpdateMSAAAtPixel(uint32_t x, uint32_t y, const TriangleBatch& batch, uint32_t index,
                                    ImageGrey& MSAAMask) {}
 
 Rasterizer::gBufferStruct Rasterizer::gBufferDefault { glm::vec3(), glm::vec3() };
-void Rasterizer::UpdateGBufferAtPixel(uint32_t x, uint32_t y, Triangle original, Triangle transformed,
+void Rasterizer::UpdateGBufferAtPixel(uint32_t x, uint32_t y, const TriangleBatch& batch, uint32_t index,
                                       ImageBuffer<gBufferStruct>& gBuffer) {}
 
 void readImageIn(const std::string& filename, Image& target, const std::string& output_file) {
     int width, height, nrChannels;
     auto img = stbi_load(filename.c_str(), &width, &height, &nrChannels, 0);
     target = Image(width, height, output_file);
-    for (int x = 0; x < width; ++x) {
-        for (int y = 0; y < height; ++y) {
+    for (int y = 0; y < height; ++y) {
+        Color* row = target.Row(y);
+        for (int x = 0; x < width; ++x) {
             int index = (x + y * width) * nrChannels;
             if (nrChannels == 4) {
-                target.Set(x, y, Color(img[index], img[index + 1], img[index + 2], img[index + 3]));
+                row[x] = Color(img[index], img[index + 1], img[index + 2], img[index + 3]);
             } else if (nrChannels == 3) {
                 glm::vec3 color_vec(img[index], img[index + 1], img[index + 2]);
-                target.Set(x, y, Color(color_vec));
+                row[x] = Color(color_vec);
             }
         }
     }
@@ -88,6 +89,6 @@ void Rasterizer::CreateMipMap(const std::string& texture_filename) {
 
 Color Rasterizer::GetTexel(glm::vec2 tex_coord, float depth) {}
 
-void Rasterizer::ShadeAtPixel(uint32_t x, uint32_t y, Image& image) {}
+void Rasterizer::ShadeAtPixel(uint32_t x, uint32_t y, ImageHDR& image) {}
 
-void Rasterizer::ShadeAtPixel(uint32_t x, uint32_t y, Triangle original, Triangle transformed, Image& image) {}
+void Rasterizer::ShadeAtPixel(uint32_t x, uint32_t y, const TriangleBatch& batch, uint32_t index, ImageHDR& image) {}
@@ -0,0 +1,213 @@
+#include "render_client.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+bool ReadAll(int fd, void* data, size_t bytes) {
+    unsigned char* p = static_cast<unsigned char*>(data);
+    while (bytes != 0) {
+        const ssize_t got = recv(fd, p, bytes, 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        p += got;
+        bytes -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+bool WriteAll(int fd, const void* data, size_t bytes) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    while (bytes != 0) {
+        const ssize_t sent = send(fd, p, bytes, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        p += sent;
+        bytes -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+// Latency below which a share `q` of the sorted samples fall
+double Percentile(const std::vector<double>& sorted, double q) {
+    if (sorted.empty()) return 0.;
+    const size_t rank = static_cast<size_t>(q * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+std::string FormatMs(double ms) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.2f", ms);
+    return text;
+}
+
+const char* PixelFormatName(uint32_t format) {
+    switch (static_cast<StreamPixelFormat>(format)) {
+    case StreamPixelFormat::R32F: return "R32F";
+    case StreamPixelFormat::RGBA32F: return "RGBA32F";
+    default: return "RGBA8";
+    }
+}
+
+}   // namespace
+
+RenderClient::RenderClient(const std::string& socketPath) {
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) return;
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+    this->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (this->fd >= 0 && connect(this->fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        close(this->fd);
+        this->fd = -1;
+    }
+}
+
+RenderClient::~RenderClient() {
+    if (this->segment) munmap(this->segment, this->segmentSize);
+    if (this->fd >= 0) close(this->fd);
+}
+
+bool RenderClient::Request(JobKind kind, const std::string& payload, bool sharedMemory, Reply& reply) {
+    if (this->fd < 0) return false;
+    JobHeader header {};
+    std::memcpy(header.magic, "RJOB", 4);
+    header.version = RENDER_PROTOCOL_VERSION;
+    header.kind = static_cast<uint32_t>(kind);
+    header.flags = sharedMemory ? JOB_REPLY_SHM : 0;
+    header.bytes = payload.size();
+    if (!WriteAll(this->fd, &header, sizeof(header)) || !WriteAll(this->fd, payload.data(), payload.size()))
+        return false;
+
+    reply = Reply();
+    if (!ReadAll(this->fd, &reply.header, sizeof(reply.header))
+        || std::memcmp(reply.header.magic, "RRES", 4) != 0)
+        return false;
+    if (reply.header.status != 0 || (reply.header.flags & REPLY_SHM)) {
+        // an error message or the segment name
+        std::string text(reply.header.bytes, '\0');
+        if (!ReadAll(this->fd, text.data(), text.size())) return false;
+        if (reply.header.status != 0) {
+            reply.error = std::move(text);
+            return true;
+        }
+        if (!this->MapSegment(text, reply.header.pixelBytes)) return false;
+        reply.pixels = this->segment;
+        return true;
+    }
+    this->buffer.resize(reply.header.bytes);
+    if (!ReadAll(this->fd, this->buffer.data(), this->buffer.size())) return false;
+    reply.pixels = this->buffer.data();
+    return true;
+}
+
+bool RenderClient::MapSegment(const std::string& name, size_t bytes) {
+    if (name == this->segmentName && bytes <= this->segmentSize) return true;
+
+    // first reply through the segment, or the server grew it for a larger frame
+    if (this->segment) munmap(this->segment, this->segmentSize);
+    this->segment = nullptr;
+    this->segmentSize = 0;
+    const int segmentFd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (segmentFd < 0) return false;
+    struct stat info;
+    void* mapping = MAP_FAILED;
+    if (fstat(segmentFd, &info) == 0 && static_cast<size_t>(info.st_size) >= bytes && info.st_size > 0)
+        mapping = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, segmentFd, 0);
+    close(segmentFd);
+    if (mapping == MAP_FAILED) return false;
+    this->segment = static_cast<unsigned char*>(mapping);
+    this->segmentSize = static_cast<size_t>(info.st_size);
+    this->segmentName = name;
+    return true;
+}
+
+std::string RenderClient::DeltaPayload(const std::string& configPath, std::span<const SceneDelta> deltas) {
+    SceneDeltaHeader header { static_cast<uint32_t>(configPath.size()), static_cast<uint32_t>(deltas.size()) };
+    std::string payload(reinterpret_cast<const char*>(&header), sizeof(header));
+    payload += configPath;
+    payload.append(reinterpret_cast<const char*>(deltas.data()), deltas.size_bytes());
+    return payload;
+}
+
+bool RunLoadTest(const LoadTestOptions& options) {
+    const uint32_t connections = std::max(1u, std::min(options.connections, std::max(options.requests, 1u)));
+    std::vector<std::vector<double>> latencies(connections);
+    std::vector<double> renderMs(connections, 0.);
+    std::vector<ReplyHeader> lastReply(connections);
+    std::atomic<uint32_t> next { 0 };
+    std::atomic<bool> failed { false };
+
+    // Every connection takes the next request as soon as its previous reply is in, so the server sees
+    //     `connections` jobs in flight at all times
+    auto run = [&](uint32_t connection) {
+        RenderClient client(options.socketPath);
+        if (!client.IsOpen()) {
+            std::cerr << "Load test: cannot connect to " + options.socketPath + "\n";
+            failed = true;
+            return;
+        }
+        RenderClient::Reply reply;
+        while (!failed && next.fetch_add(1, std::memory_order_relaxed) < options.requests) {
+            const auto start = std::chrono::steady_clock::now();
+            if (!client.Request(JobKind::CONFIG_PATH, options.configPath, options.sharedMemory, reply)
+                || reply.header.status != 0) {
+                std::cerr << "Load test: " + (reply.error.empty() ? std::string("connection lost") : reply.error)
+                               + "\n";
+                failed = true;
+                return;
+            }
+            latencies[connection].push_back(
+              std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            renderMs[connection] += static_cast<double>(reply.header.renderMicros) / 1000.;
+        }
+        lastReply[connection] = reply.header;
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (uint32_t connection = 0; connection < connections; ++connection) threads.emplace_back(run, connection);
+    for (std::thread& thread : threads) thread.join();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (failed) return false;
+
+    std::vector<double> all;
+    double renderTotal = 0.;
+    for (uint32_t connection = 0; connection < connections; ++connection) {
+        all.insert(all.end(), latencies[connection].begin(), latencies[connection].end());
+        renderTotal += renderMs[connection];
+    }
+    std::sort(all.begin(), all.end());
+    const double count = static_cast<double>(std::max<size_t>(all.size(), 1));
+    ReplyHeader frame {};
+    for (const ReplyHeader& header : lastReply)
+        if (header.width != 0) frame = header;
+
+    std::string sephead = "=====================Load Test====================\n";
+    std::string sep = "==================================================\n";
+    std::string msg = sephead + "Requests: " + std::to_string(all.size()) + " over " + std::to_string(connections)
+                    + " connections, replies " + (options.sharedMemory ? "in shared memory" : "in-band") + "\n"
+                    + "Frame: " + std::to_string(frame.width) + "x" + std::to_string(frame.height) + " "
+                    + PixelFormatName(frame.pixelFormat) + ", " + std::to_string(frame.pixelBytes / 1024) + " KiB\n"
+                    + "Throughput: " + FormatMs(static_cast<double>(all.size()) / seconds) + " requests/s\n"
+                    + "Latency (ms): p50 " + FormatMs(Percentile(all, 0.5)) + ", p90 " + FormatMs(Percentile(all, 0.9))
+                    + ", p99 " + FormatMs(Percentile(all, 0.99)) + ", max " + FormatMs(all.empty() ? 0. : all.back())
+                    + "\n" + "Server render (ms): mean " + FormatMs(renderTotal / count) + "\n" + sep;
+    std::cout << msg;
+    return true;
+}
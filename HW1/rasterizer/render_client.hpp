@@ -0,0 +1,62 @@
+// Client side of the render server (see render_server.hpp), and a load generator measuring it
+
+#ifndef RENDER_CLIENT_H
+#define RENDER_CLIENT_H
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "render_server.hpp"
+
+class RenderClient {
+public:
+    // Connects right away; see IsOpen
+    explicit RenderClient(const std::string& socketPath);
+    RenderClient(const RenderClient&) = delete;
+    RenderClient& operator=(const RenderClient&) = delete;
+    ~RenderClient();
+
+    inline bool IsOpen() const { return this->fd >= 0; }
+
+    // A finished job. The pixels are in the client's buffer or in the connection's shared-memory segment, and stay
+    //     valid until the next request.
+    struct Reply {
+        ReplyHeader header {};
+        std::string error;   // of a failed job
+        const void* pixels = nullptr;
+    };
+
+    // Send a job and wait for its reply; false if the connection failed. A job the server could not render still
+    //     returns true, with a non-zero status and the error.
+    bool Request(JobKind kind, const std::string& payload, bool sharedMemory, Reply& reply);
+
+    // Payload of a SCENE_DELTA job rendering `configPath` with `deltas` applied
+    static std::string DeltaPayload(const std::string& configPath, std::span<const SceneDelta> deltas);
+
+private:
+    int fd = -1;
+    std::vector<unsigned char> buffer;   // pixels of the latest in-band reply
+
+    // mapping of the connection's segment, remapped when the server grows it
+    std::string segmentName;
+    unsigned char* segment = nullptr;
+    size_t segmentSize = 0;
+
+    bool MapSegment(const std::string& name, size_t bytes);
+};
+
+struct LoadTestOptions {
+    std::string socketPath;
+    std::string configPath;
+    uint32_t requests = 200;
+    uint32_t connections = 4;
+    bool sharedMemory = false;
+};
+
+// Render `configPath` over parallel connections as fast as the server answers, then print the requests per second
+//     and the latency percentiles seen by the clients; false if a connection or a job failed
+bool RunLoadTest(const LoadTestOptions& options);
+
+#endif
@@ -0,0 +1,479 @@
+#include "render_server.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "parallel.hpp"
+
+namespace {
+
+// Larger jobs are refused; a config or a delta list is a few KiB
+constexpr uint64_t MAX_JOB_BYTES = 64ull << 20;
+// Distinct config texts kept parsed; the cache starts over once it holds more
+constexpr size_t MAX_CACHED_TEXTS = 64;
+
+void ReportError(const std::string& what) {
+    std::cerr << "Render server: " + what + " (" + std::strerror(errno) + ")\n";
+}
+
+bool ReadAll(int fd, void* data, size_t bytes) {
+    unsigned char* p = static_cast<unsigned char*>(data);
+    while (bytes != 0) {
+        const ssize_t got = recv(fd, p, bytes, 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        p += got;
+        bytes -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+// Header and payload in as few calls as the socket takes, without raising SIGPIPE when the client went away
+bool SendAll(int fd, const void* header, size_t headerBytes, const void* payload, size_t payloadBytes) {
+    iovec parts[2] = { { const_cast<void*>(header), headerBytes }, { const_cast<void*>(payload), payloadBytes } };
+    iovec* part = parts;
+    size_t remaining = payloadBytes == 0 ? 1 : 2;
+    while (remaining != 0) {
+        msghdr message {};
+        message.msg_iov = part;
+        message.msg_iovlen = remaining;
+        const ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        size_t done = static_cast<size_t>(sent);
+        while (remaining != 0 && done >= part->iov_len) {
+            done -= part->iov_len;
+            ++part;
+            --remaining;
+        }
+        if (remaining != 0) {
+            part->iov_base = static_cast<unsigned char*>(part->iov_base) + done;
+            part->iov_len -= done;
+        }
+    }
+    return true;
+}
+
+ReplyHeader MakeReply(uint32_t status) {
+    ReplyHeader reply {};
+    std::memcpy(reply.magic, "RRES", 4);
+    reply.version = RENDER_PROTOCOL_VERSION;
+    reply.status = status;
+    return reply;
+}
+
+bool SendError(int fd, const std::string& message) {
+    ReplyHeader reply = MakeReply(1);
+    reply.bytes = message.size();
+    return SendAll(fd, &reply, sizeof(reply), message.data(), message.size());
+}
+
+// Shared-memory segment of one connection, grown to the largest reply so far and reused for every reply, so that
+//     a steady stream of frames maps nothing new
+class SharedSegment {
+public:
+    SharedSegment() = default;
+    SharedSegment(const SharedSegment&) = delete;
+    SharedSegment& operator=(const SharedSegment&) = delete;
+    ~SharedSegment() {
+        if (this->data) munmap(this->data, this->size);
+        if (this->fd >= 0) {
+            close(this->fd);
+            shm_unlink(this->name.c_str());
+        }
+    }
+
+    // Room for `bytes` at the start of the segment, or nullptr
+    unsigned char* Reserve(size_t bytes) {
+        if (bytes <= this->size) return this->data;
+        if (this->fd < 0) {
+            static std::atomic<uint64_t> segments { 0 };
+            this->name = "/rasterizer-" + std::to_string(getpid()) + "-" + std::to_string(segments++);
+            this->fd = shm_open(this->name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+            if (this->fd < 0) {
+                ReportError("cannot create shared memory " + this->name);
+                return nullptr;
+            }
+        }
+        if (this->data) munmap(this->data, this->size);
+        this->data = nullptr;
+        this->size = 0;
+        void* mapping = MAP_FAILED;
+        if (ftruncate(this->fd, static_cast<off_t>(bytes)) == 0)
+            mapping = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+        if (mapping == MAP_FAILED) {
+            ReportError("cannot size shared memory " + this->name);
+            return nullptr;
+        }
+        this->data = static_cast<unsigned char*>(mapping);
+        this->size = bytes;
+        return this->data;
+    }
+
+    inline const std::string& GetName() const { return this->name; }
+
+private:
+    std::string name;
+    int fd = -1;
+    unsigned char* data = nullptr;
+    size_t size = 0;
+};
+
+inline StreamPixelFormat PixelFormat(const Image&) { return StreamPixelFormat::RGBA8; }
+inline StreamPixelFormat PixelFormat(const ImageGrey&) { return StreamPixelFormat::R32F; }
+inline StreamPixelFormat PixelFormat(const ImageHDR&) { return StreamPixelFormat::RGBA32F; }
+
+std::filesystem::file_time_type ModifiedTime(const std::string& path) {
+    std::error_code error;
+    const std::filesystem::file_time_type time = std::filesystem::last_write_time(path, error);
+    return error ? std::filesystem::file_time_type::min() : time;
+}
+
+bool HasModel(const Scene& scene) {
+    const TestType type = scene.GetLoader().GetType();
+    return type != TestType::TEXTURE_TEST && type != TestType::TEXTURE_BAKE;
+}
+
+void ApplyDelta(Scene& scene, const SceneDelta& delta) {
+    const float* v = delta.values;
+    switch (static_cast<SceneDeltaOp>(delta.op)) {
+    case SceneDeltaOp::TRANSFORM:
+        scene.SetTransform(delta.index, MeshTransform(glm::quat(v[0], v[1], v[2], v[3]), glm::vec3(v[4], v[5], v[6]),
+                                                      glm::vec3(v[7], v[8], v[9])));
+        break;
+    case SceneDeltaOp::LIGHT: {
+        const Color color(static_cast<unsigned char>(glm::clamp(v[4], 0.f, 255.f)),
+                          static_cast<unsigned char>(glm::clamp(v[5], 0.f, 255.f)),
+                          static_cast<unsigned char>(glm::clamp(v[6], 0.f, 255.f)), 255);
+        const float radius = v[7] > 0.f ? v[7] : std::numeric_limits<float>::infinity();
+        scene.SetLight(delta.index, Light(glm::vec3(v[0], v[1], v[2]), v[3], color, radius));
+        break;
+    }
+    case SceneDeltaOp::CAMERA: {
+        Camera camera = scene.GetLoader().GetCamera();
+        camera.pos = glm::vec3(v[0], v[1], v[2]);
+        camera.lookAt = glm::vec3(v[3], v[4], v[5]);
+        camera.up = glm::vec3(v[6], v[7], v[8]);
+        scene.SetCamera(camera);
+        break;
+    }
+    default: throw std::invalid_argument("unknown scene delta op " + std::to_string(delta.op));
+    }
+}
+
+}   // namespace
+
+RenderServer::RenderServer(std::string socketPath, uint32_t workers)
+    : socketPath(socketPath)
+    , workerCount(workers == 0 ? WorkerCount() : workers) {}
+
+bool RenderServer::Run() {
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    if (this->socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Render server: socket path " + this->socketPath + " is too long\n";
+        return false;
+    }
+    std::memcpy(address.sun_path, this->socketPath.c_str(), this->socketPath.size() + 1);
+
+    // Only a socket nobody listens on, left behind by a server that did not shut down cleanly, is removed; a live
+    //     server or anything that is not a socket keeps the path
+    const int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe < 0) {
+        ReportError("cannot create a socket");
+        return false;
+    }
+    const bool live = connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+    const int probeError = errno;
+    close(probe);
+    if (live) {
+        std::cerr << "Render server: another server is listening on " + this->socketPath + "\n";
+        return false;
+    }
+    // connecting to a file that is not a socket is refused as well
+    struct stat status {};
+    if (probeError == ECONNREFUSED
+        && !(lstat(this->socketPath.c_str(), &status) == 0 && S_ISSOCK(status.st_mode))) {
+        std::cerr << "Render server: " + this->socketPath + " exists and is not a socket\n";
+        return false;
+    }
+    if (probeError == ECONNREFUSED)
+        unlink(this->socketPath.c_str());
+    else if (probeError != ENOENT) {
+        errno = probeError;
+        ReportError("cannot use " + this->socketPath);
+        return false;
+    }
+    this->listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (this->listenFd < 0 || bind(this->listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+        || listen(this->listenFd, SOMAXCONN) != 0) {
+        ReportError("cannot listen on " + this->socketPath);
+        if (this->listenFd >= 0) close(this->listenFd);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < this->workerCount; ++i) this->workers.emplace_back(&RenderServer::Work, this);
+    std::cout << "Serving on " + this->socketPath + " with " + std::to_string(this->workerCount) + " workers"
+              << std::endl;
+
+    while (!this->stopping) {
+        const int fd = accept4(this->listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (!this->stopping) ReportError("accept failed");
+            break;
+        }
+        std::lock_guard<std::mutex> lock(this->connectionMutex);
+        this->connections.insert(fd);
+        std::thread(&RenderServer::Serve, this, fd).detach();
+    }
+    this->stopping = true;
+
+    // Connections stop reading but still get the reply of the job they wait for; the workers finish the queue first
+    {
+        std::unique_lock<std::mutex> lock(this->connectionMutex);
+        for (const int fd : this->connections) shutdown(fd, SHUT_RD);
+        this->connectionsClosed.wait(lock, [this] { return this->connections.empty(); });
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->queueMutex);
+        this->draining = true;
+    }
+    this->jobReady.notify_all();
+    for (std::thread& worker : this->workers) worker.join();
+    this->workers.clear();
+
+    close(this->listenFd);
+    unlink(this->socketPath.c_str());
+    std::cout << "Served " + std::to_string(this->jobsServed) + " jobs" << std::endl;
+    return true;
+}
+
+void RenderServer::Serve(int fd) {
+    SharedSegment segment;
+    JobHeader header;
+    while (ReadAll(fd, &header, sizeof(header))) {
+        if (std::memcmp(header.magic, "RJOB", 4) != 0 || header.version != RENDER_PROTOCOL_VERSION) {
+            SendError(fd, "not a render job of protocol version " + std::to_string(RENDER_PROTOCOL_VERSION));
+            break;
+        }
+        if (header.bytes > MAX_JOB_BYTES) {
+            SendError(fd, "job of " + std::to_string(header.bytes) + " bytes is too large");
+            break;
+        }
+        auto job = std::make_shared<Job>();
+        job->kind = static_cast<JobKind>(header.kind);
+        job->payload.resize(header.bytes);
+        if (!ReadAll(fd, job->payload.data(), job->payload.size())) break;
+
+        if (job->kind == JobKind::SHUTDOWN) {
+            this->stopping = true;
+            shutdown(this->listenFd, SHUT_RDWR);   // wakes up accept
+            const ReplyHeader reply = MakeReply(0);
+            SendAll(fd, &reply, sizeof(reply), nullptr, 0);
+            break;
+        }
+
+        std::future<Result> future = job->result.get_future();
+        {
+            std::lock_guard<std::mutex> lock(this->queueMutex);
+            this->queue.push_back(std::move(job));
+        }
+        this->jobReady.notify_one();
+        const Result result = future.get();
+        if (!result.error.empty()) {
+            if (!SendError(fd, result.error)) break;
+            continue;
+        }
+
+        ReplyHeader reply = MakeReply(0);
+        reply.width = result.width;
+        reply.height = result.height;
+        reply.pixelFormat = static_cast<uint32_t>(result.format);
+        reply.flags = FrameStream::FRAME_BOTTOM_UP;
+        reply.pixelBytes = result.pixelBytes;
+        reply.renderMicros = result.renderMicros;
+        bool sent;
+        if (header.flags & JOB_REPLY_SHM) {
+            unsigned char* pixels = segment.Reserve(std::max<size_t>(result.pixelBytes, 1));
+            if (!pixels) {
+                sent = SendError(fd, "cannot reply through shared memory");
+            } else {
+                std::memcpy(pixels, result.pixels, result.pixelBytes);
+                reply.flags |= REPLY_SHM;
+                reply.bytes = segment.GetName().size();
+                sent = SendAll(fd, &reply, sizeof(reply), segment.GetName().data(), segment.GetName().size());
+            }
+        } else {
+            reply.bytes = result.pixelBytes;
+            sent = SendAll(fd, &reply, sizeof(reply), result.pixels, result.pixelBytes);
+        }
+        if (!sent) break;
+        ++this->jobsServed;
+    }
+
+    close(fd);
+    std::lock_guard<std::mutex> lock(this->connectionMutex);
+    this->connections.erase(fd);
+    this->connectionsClosed.notify_all();
+}
+
+void RenderServer::Work() {
+    // Each worker renders with its own Renderer, so its shadow maps and textures stay warm for the jobs it takes
+    Renderer renderer;
+    for (;;) {
+        std::shared_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(this->queueMutex);
+            this->jobReady.wait(lock, [this] { return this->draining || !this->queue.empty(); });
+            if (this->queue.empty()) return;
+            job = std::move(this->queue.front());
+            this->queue.pop_front();
+        }
+        Result result;
+        try {
+            result = this->Execute(renderer, *job);
+        } catch (const std::exception& e) {
+            result = Result();
+            result.error = e.what();
+        }
+        job->result.set_value(std::move(result));
+    }
+}
+
+RenderServer::Result RenderServer::Execute(Renderer& renderer, const Job& job) {
+    const auto start = std::chrono::steady_clock::now();
+    Result result;
+
+    std::shared_ptr<const Scene> scene;
+    std::optional<Scene> edited;   // a copy of the cached scene with this job's deltas applied
+    switch (job.kind) {
+    case JobKind::CONFIG_PATH: scene = this->ConfigScene(job.payload); break;
+    case JobKind::CONFIG_TEXT: scene = this->TextScene(job.payload); break;
+    case JobKind::SCENE_DELTA: {
+        SceneDeltaHeader header;
+        if (job.payload.size() < sizeof(header)) throw std::invalid_argument("scene delta without a header");
+        std::memcpy(&header, job.payload.data(), sizeof(header));
+        const size_t deltaBytes = static_cast<size_t>(header.deltaCount) * sizeof(SceneDelta);
+        if (job.payload.size() != sizeof(header) + header.pathBytes + deltaBytes)
+            throw std::invalid_argument("scene delta size does not match its header");
+        scene = this->ConfigScene(job.payload.substr(sizeof(header), header.pathBytes));
+        if (!scene) break;
+        edited = *scene;
+        const char* records = job.payload.data() + sizeof(header) + header.pathBytes;
+        for (uint32_t i = 0; i < header.deltaCount; ++i) {
+            SceneDelta delta;
+            std::memcpy(&delta, records + i * sizeof(SceneDelta), sizeof(delta));
+            ApplyDelta(*edited, delta);
+        }
+        break;
+    }
+    default: throw std::invalid_argument("unknown job kind " + std::to_string(static_cast<uint32_t>(job.kind)));
+    }
+    if (!scene) throw std::runtime_error("cannot load config");
+
+    const Scene& target = edited ? *edited : *scene;
+    const Loader& loader = target.GetLoader();
+    if (loader.GetType() == TestType::TRANSFORM_TEST || !HasModel(target))
+        throw std::invalid_argument("task has no image to reply with");
+
+    result.frame = renderer.RenderFrame(target);
+    VisitOutput(result.frame, loader, [&](const auto& buffer) {
+        result.format = PixelFormat(buffer);
+        result.pixels = buffer.Pixels().data();
+        result.pixelBytes = buffer.Pixels().size_bytes();
+        result.width = buffer.GetWidth();
+        result.height = buffer.GetHeight();
+    });
+    result.renderMicros = static_cast<uint64_t>(
+      std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    return result;
+}
+
+bool RenderServer::ModelCurrent(const CachedScene& entry) {
+    if (!HasModel(*entry.scene)) return true;
+    return entry.modelTime == ModifiedTime(entry.scene->GetLoader().GetModelName() + ".obj");
+}
+
+std::shared_ptr<const Scene> RenderServer::ConfigScene(const std::string& path) {
+    const std::filesystem::file_time_type configTime = ModifiedTime(path);
+    {
+        std::lock_guard<std::mutex> lock(this->cacheMutex);
+        auto cached = this->configs.find(path);
+        if (cached != this->configs.end() && cached->second.configTime == configTime && ModelCurrent(cached->second))
+            return cached->second.scene;
+    }
+
+    // Parsed outside the lock; two jobs missing the same config at once both parse it
+    std::ifstream file(path);
+    if (!file) return nullptr;
+    std::stringstream text;
+    text << file.rdbuf();
+    std::optional<Scene> scene = Scene::Parse(text.str(), path);
+    CachedScene entry { nullptr, configTime, {} };
+    if (!scene || !this->ShareMeshes(*scene, entry.modelTime)) return nullptr;
+    entry.scene = std::make_shared<const Scene>(std::move(*scene));
+
+    std::lock_guard<std::mutex> lock(this->cacheMutex);
+    this->configs[path] = entry;
+    return entry.scene;
+}
+
+std::shared_ptr<const Scene> RenderServer::TextScene(const std::string& text) {
+    {
+        std::lock_guard<std::mutex> lock(this->cacheMutex);
+        auto cached = this->texts.find(text);
+        if (cached != this->texts.end() && ModelCurrent(cached->second)) return cached->second.scene;
+    }
+
+    std::optional<Scene> scene = Scene::Parse(text);
+    CachedScene entry;
+    if (!scene || !this->ShareMeshes(*scene, entry.modelTime)) return nullptr;
+    entry.scene = std::make_shared<const Scene>(std::move(*scene));
+
+    std::lock_guard<std::mutex> lock(this->cacheMutex);
+    if (this->texts.size() >= MAX_CACHED_TEXTS) this->texts.clear();
+    this->texts[text] = entry;
+    return entry.scene;
+}
+
+bool RenderServer::ShareMeshes(Scene& scene, std::filesystem::file_time_type& modelTime) {
+    if (!HasModel(scene)) return true;
+    const std::string modelName = scene.GetLoader().GetModelName();
+    modelTime = ModifiedTime(modelName + ".obj");
+    // levels of detail and clusters are built once per model, level count and cluster size
+    const std::string meshKey = modelName + "#" + std::to_string(scene.GetLoader().GetLodCount()) + "#"
+                              + std::to_string(scene.GetLoader().GetClusterSize());
+    {
+        std::lock_guard<std::mutex> lock(this->cacheMutex);
+        auto cached = this->meshes.find(meshKey);
+        if (cached != this->meshes.end() && cached->second.modelTime == modelTime) {
+            scene.CopyMeshes(*cached->second.scene);
+            return true;
+        }
+    }
+
+    if (!scene.LoadMeshes()) return false;
+    std::lock_guard<std::mutex> lock(this->cacheMutex);
+    this->meshes[meshKey] = CachedScene { std::make_shared<const Scene>(scene), {}, modelTime };
+    return true;
+}
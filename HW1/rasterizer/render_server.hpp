@@ -0,0 +1,152 @@
+// Long-lived renderer behind a Unix domain socket: configs and their meshes stay parsed and every worker keeps its
+//     textures and shadow maps resident, so a job costs one render instead of a process start and a reload
+
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "frame_stream.hpp"
+#include "renderer.hpp"
+#include "scene.hpp"
+
+constexpr uint32_t RENDER_PROTOCOL_VERSION = 1;
+
+// Every message on the socket is one of these headers followed by `bytes` of payload; one job is in flight per
+//     connection, and a connection may send any number of them
+enum class JobKind : uint32_t {
+    CONFIG_PATH = 1,   // payload: path of a YAML config, relative to the server's working directory
+    CONFIG_TEXT = 2,   // payload: the text of a YAML config
+    SCENE_DELTA = 3,   // payload: a SceneDeltaHeader, the base config path, then SceneDelta records
+    SHUTDOWN = 4       // no payload; the server finishes the jobs in flight and exits
+};
+
+struct JobHeader {
+    char magic[4];   // "RJOB"
+    uint32_t version;
+    uint32_t kind;   // a JobKind
+    uint32_t flags;  // JOB_REPLY_SHM
+    uint64_t bytes;
+};
+// Reply with the pixels in a shared-memory segment of the connection instead of on the socket
+constexpr uint32_t JOB_REPLY_SHM = 1;
+
+// Changes applied to the cached scene of a config for one job only, so that animating a transform, a light or the
+//     camera does not need a config of its own. The values are, by op:
+//     TRANSFORM rotation quaternion wxyz, translation xyz, scale xyz
+//     LIGHT     position xyz, intensity, color rgb in 0..255, radius (0 for an unbounded light)
+//     CAMERA    position xyz, look-at xyz, up xyz (the frustum stays the config's)
+enum class SceneDeltaOp : uint32_t { TRANSFORM = 1, LIGHT = 2, CAMERA = 3 };
+
+struct SceneDeltaHeader {
+    uint32_t pathBytes;   // the config path follows, then `deltaCount` records
+    uint32_t deltaCount;
+};
+
+struct SceneDelta {
+    uint32_t op;      // a SceneDeltaOp
+    uint32_t index;   // of the transform or light; unused for the camera
+    float values[12];
+};
+
+// Pixels follow as rows of `width` pixels in host byte order, the bottom row first, in the same buffer and format
+//     the command line would write out for the config (see `VisitOutput`). With REPLY_SHM, the payload is instead
+//     the name of the connection's shared-memory segment, holding `pixelBytes` of pixels from its start; it is
+//     overwritten by the next reply of the connection and unlinked when the connection closes. A failed job has a
+//     non-zero status and an error message as payload.
+struct ReplyHeader {
+    char magic[4];   // "RRES"
+    uint32_t version;
+    uint32_t status;   // 0 on success
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixelFormat;   // a StreamPixelFormat
+    uint32_t flags;         // FrameStream::FRAME_BOTTOM_UP, REPLY_SHM
+    uint32_t reserved;
+    uint64_t bytes;   // payload size
+    uint64_t pixelBytes;
+    uint64_t renderMicros;   // spent by the worker, from taking the job to the finished frame
+};
+constexpr uint32_t REPLY_SHM = 2;
+
+class RenderServer {
+public:
+    // `workers` jobs render at once, each worker with its own Renderer (0 picks one per core)
+    RenderServer(std::string socketPath, uint32_t workers = 0);
+    RenderServer(const RenderServer&) = delete;
+    RenderServer& operator=(const RenderServer&) = delete;
+
+    // Serve until a SHUTDOWN job arrives; false if the socket cannot be opened
+    bool Run();
+
+private:
+    // What a worker hands back to the connection that queued the job
+    struct Result {
+        std::string error;   // empty on success
+        Frame frame;
+        StreamPixelFormat format = StreamPixelFormat::RGBA8;
+        const void* pixels = nullptr;   // into `frame`
+        size_t pixelBytes = 0;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint64_t renderMicros = 0;
+    };
+    struct Job {
+        JobKind kind;
+        std::string payload;
+        std::promise<Result> result;
+    };
+
+    // A parsed config and its meshes, valid while its files keep the recorded modification times
+    struct CachedScene {
+        std::shared_ptr<const Scene> scene;
+        std::filesystem::file_time_type configTime;
+        std::filesystem::file_time_type modelTime;
+    };
+
+    std::string socketPath;
+    uint32_t workerCount;
+    int listenFd = -1;
+    std::atomic<bool> stopping = false;
+
+    std::mutex queueMutex;
+    std::condition_variable jobReady;
+    std::deque<std::shared_ptr<Job>> queue;
+    bool draining = false;   // under queueMutex: set once no connection is left to queue a job, so workers may exit
+    std::vector<std::thread> workers;
+
+    std::mutex connectionMutex;
+    std::unordered_set<int> connections;   // open sockets, each served by a detached thread until it closes
+    std::condition_variable connectionsClosed;
+    std::atomic<uint64_t> jobsServed = 0;
+
+    std::mutex cacheMutex;
+    std::unordered_map<std::string, CachedScene> configs;   // by path
+    std::unordered_map<std::string, CachedScene> texts;     // by config text, meshes shared with `configs`
+    std::unordered_map<std::string, CachedScene> meshes;    // by model name, level of detail count and cluster size
+
+    void Serve(int fd);
+    void Work();
+    Result Execute(Renderer& renderer, const Job& job);
+
+    // Scenes are shared read-only by the jobs rendering them; nothing when the config or its OBJ file fails to load
+    std::shared_ptr<const Scene> ConfigScene(const std::string& path);
+    std::shared_ptr<const Scene> TextScene(const std::string& text);
+    // The meshes of `scene`'s model, loaded once; false when the OBJ file fails to load
+    bool ShareMeshes(Scene& scene, std::filesystem::file_time_type& modelTime);
+    static bool ModelCurrent(const CachedScene& entry);   // the OBJ file is unchanged since the entry was made
+};
+
+#endif
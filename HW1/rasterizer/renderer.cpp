@@ -1,13 +1,34 @@
 #include "renderer.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
+#include <filesystem>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <system_error>
+#include <utility>
 
+#include "../thirdparty/glm/gtx/quaternion.hpp"
+#include "../thirdparty/glm/gtx/transform.hpp"
+#include "arena.hpp"
+#include "async_writer.hpp"
 #include "entities.hpp"
+#include "frame_stream.hpp"
 #include "image.hpp"
+#include "instancing.hpp"
 #include "loader.hpp"
 #include "rasterizer.hpp"
+#include "scene.hpp"
+#include "supersample.hpp"
+#include "triangle_batch.hpp"
+#include "virtual_texture.hpp"
+
+// One pass to collect virtual texture feedback, one to render with the streamed pages
+const uint32_t MAX_FEEDBACK_PASSES = 2;
 
 void PrintTask(const Loader& loader) {
     std::string sephead = "======================Config======================\n";
@@ -36,116 +57,374 @@ void PrintTaskTransformTest(const glm::vec3 input, const glm::vec4 output, const
     std::cout << msg;
 }
 
-void Renderer::Render(int argc, char** argv) {
-    std::string modelName;
-    std::string yamlConfigName = "config.yaml";
-
-    if (argc != 1) {
-        yamlConfigName = argv[1];
-        std::cout << "using customized config name" << yamlConfigName << std::endl;
+// Every pixel center inside the silhouette of a closed mesh is owned by as many front faces as back faces, so an odd
+//     count means a crack (no owner) or a double hit (two owners) along a shared edge. Odd pixels are drawn red in
+//     `image`, the rest in grey levels by count; the counts are only printed when `verbose`.
+void PrintTaskWatertightTest(const ImageBuffer<uint32_t>& hits, Image& image, bool verbose) {
+    size_t covered = 0, odd = 0;
+    uint32_t maxHits = 0;
+    for (uint32_t y = 0; y < hits.GetHeight(); ++y) {
+        for (uint32_t x = 0; x < hits.GetWidth(); ++x) {
+            uint32_t count = hits(x, y);
+            covered += count != 0;
+            odd += count % 2;
+            maxHits = std::max(maxHits, count);
+        }
+    }
+    for (uint32_t y = 0; y < hits.GetHeight(); ++y) {
+        for (uint32_t x = 0; x < hits.GetWidth(); ++x) {
+            uint32_t count = hits(x, y);
+            unsigned char level = static_cast<unsigned char>(maxHits == 0 ? 0 : 255 * count / maxHits);
+            image(x, y) = (count % 2) ? Color(255, 0, 0, 255) : Color(level, level, level, 255);
+        }
     }
 
-    Loader loader(yamlConfigName);
-    bool success = loader.Load();
+    if (!verbose) return;
+    std::string sephead = "==============Task: Watertight Test===============\n";
+    std::string sep = "==================================================\n";
+    std::string msg = sephead + "Covered pixels: " + std::to_string(covered) + "\n"
+                    + "Max hits per pixel: " + std::to_string(maxHits) + "\n"
+                    + "Pixels with odd hits: " + std::to_string(odd) + "\n" + (odd == 0 ? "PASSED" : "FAILED") + "\n"
+                    + sep;
+    std::cout << msg;
+}
 
-    if (success) {
-        PrintTask(loader);
-        Image image(loader.GetWidth(), loader.GetHeight(), loader.GetOutputName());
+void PrintStats(const RenderStats& stats) {
+    std::string sephead = "======================Stats=======================\n";
+    std::string sep = "==================================================\n";
+    std::cout << sephead + stats.Info() + sep;
+}
+
+void PrintVirtualTextureStats(const VirtualTexture& texture) {
+    std::string msg = "Virtual texture: " + std::to_string(texture.GetResidentPageCount()) + " pages resident ("
+                    + std::to_string(texture.GetResidentBytes() / 1024) + " KiB), peak "
+                    + std::to_string(texture.GetPeakResidentBytes() / 1024) + " KiB\n";
+    std::cout << msg;
+}
 
-        Rasterizer rasterizer(loader);
+void PrintWriterStats(const WriterStats& stats) {
+    std::string sephead = "======================Output======================\n";
+    std::string sep = "==================================================\n";
+    std::cout << sephead + stats.Info() + sep;
+}
 
-        if (!loader.GetTextureName().empty()) {
-            rasterizer.CreateMipMap(loader.GetTextureName());
-            if (loader.GetType() == TestType::TEXTURE_TEST) {
-                return;
-            }
+void Renderer::Render(int argc, char** argv) {
+    // Configs are rendered in order; each frame is encoded in the background while the next one renders
+    if (argc == 1) this->RenderConfig("config.yaml", false);
+    for (int i = 1; i < argc; ++i) this->RenderConfig(argv[i], true);
+
+    this->writer.Flush();
+    const WriterStats writerStats = this->writer.GetStats();
+    if (writerStats.imagesWritten + writerStats.imagesFailed != 0) PrintWriterStats(writerStats);
+}
+
+void Renderer::RenderConfig(const std::string& yamlConfigName, bool customized) {
+    // The command line renders through the same scene path as embedding programs, with the scene read from YAML
+    std::optional<Scene> scene = Scene::Load(yamlConfigName);
+    const bool success = scene.has_value();
+
+    // Opened before anything is printed: streaming to stdout sends all further logs to stderr
+    const std::string streamTarget = success ? scene->GetLoader().GetStreamTarget() : std::string();
+    if (success && !streamTarget.empty() && (!this->stream || this->stream->GetTarget() != streamTarget)) {
+        this->writer.Flush();   // frames queued for the previous stream
+        this->stream = std::make_unique<FrameStream>(streamTarget);
+        if (this->stream->IsStdout()) {
+            std::cout.flush();
+            std::cout.rdbuf(std::cerr.rdbuf());
         }
+    }
+    if (customized) std::cout << "using customized config name" << yamlConfigName << std::endl;
+    if (!success) return;
+
+    Loader& loader = scene->GetLoader();
+    PrintTask(loader);
+    if (loader.GetType() == TestType::TEXTURE_BAKE) {
+        VirtualTexture::Bake(loader.GetTextureName(), loader.GetOutputName() + ".vtex", loader.GetTileSize());
+        return;
+    }
+    std::optional<Frame> frame = this->RenderScene(loader, true);
+    if (!frame) return;
+
+    // The finished buffer is moved to the writer, which encodes it to a file or sends it to the stream. PFM keeps
+    //     the float color target as is, before the tonemap (streamed as RGBA32F).
+    const WriteOptions& writeOptions = loader.GetWriteOptions();
+    VisitOutput(*frame, loader, [&](auto& buffer) {
+        this->stats.outputQueueDepth = streamTarget.empty() ? this->writer.Submit(std::move(buffer), writeOptions)
+                                                            : this->writer.Submit(std::move(buffer), *this->stream);
+    });
+    PrintStats(this->stats);
+}
 
+Frame Renderer::RenderFrame(const Scene& scene) {
+    std::optional<Frame> frame = this->RenderScene(scene.GetLoader(), false);
+    if (!frame) throw std::runtime_error("cannot open texture " + scene.GetLoader().GetTextureName());
+    return std::move(*frame);
+}
+
+std::optional<Frame> Renderer::RenderScene(const Loader& loader, bool verbose) {
+    this->stats = RenderStats();
+    this->stats.configMs = loader.GetConfigMs();
+    this->stats.modelMs = loader.GetModelMs();
+    auto renderStart = std::chrono::steady_clock::now();
+    Image image(loader.GetWidth(), loader.GetHeight(), loader.GetOutputName());
+
+    Rasterizer rasterizer(loader);
+
+    // The texture test writes out the levels it builds, so it always builds them
+    const std::string& textureName = loader.GetTextureName();
+    if (loader.GetType() != TestType::TEXTURE_TEST && this->TakeCachedTexture(textureName, rasterizer)) {
+        // resident since an earlier frame
+    } else if (textureName.size() > 5 && textureName.compare(textureName.size() - 5, 5, ".vtex") == 0) {
+        if (!rasterizer.OpenVirtualTexture(textureName)) return std::nullopt;
+    } else if (!textureName.empty()) {
+        rasterizer.CreateMipMap(textureName);
+        if (loader.GetType() == TestType::TEXTURE_TEST) {
+            return std::nullopt;
+        }
+    }
 
-        glm::mat4x4 viewxprojection { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
 
-        if (loader.GetType() == TestType::TRIANGLE) {
-            // notice that glm::mat4x4 is column-major, so the actual matrix is the transpose of the matrix read off
-            uint32_t halfWidth = loader.GetWidth() / 2;
-            uint32_t halfHeight = loader.GetHeight() / 2;
-            viewxprojection
-              = glm::mat4x4 { halfWidth, 0,          0, 0, 0, halfHeight, 0, 0, 0, 0, 0, 0,   // discard z values
-                              halfWidth, halfHeight, 0, 1 };
+    glm::mat4x4 viewxprojection { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+
+    if (loader.GetType() == TestType::TRIANGLE || loader.GetType() == TestType::WATERTIGHT_TEST) {
+        // notice that glm::mat4x4 is column-major, so the actual matrix is the transpose of the matrix read off
+        uint32_t halfWidth = loader.GetWidth() / 2;
+        uint32_t halfHeight = loader.GetHeight() / 2;
+        viewxprojection
+          = glm::mat4x4 { halfWidth, 0,          0, 0, 0, halfHeight, 0, 0, 0, 0, 0, 0,   // discard z values
+                          halfWidth, halfHeight, 0, 1 };
+        if (loader.GetType() == TestType::TRIANGLE)
             rasterizer.model.push_back(
               glm::mat4x4(1.0f));   // Add an identity model matrix to avoid special judgement below
-        } else {
-            // First load the matrices to the rasterizer
-            for (size_t index = 0; index != loader.GetTransforms().size(); ++index) {
-                MeshTransform transform = loader.GetTransforms()[index];
-                rasterizer.AddModel(transform);
-            }
+        else
+            // Composed here rather than through AddModel so that the test only depends on the framework
+            for (const MeshTransform& transform : loader.GetTransforms())
+                rasterizer.model.push_back(glm::translate(glm::mat4(1.f), transform.translation)
+                                           * glm::toMat4(transform.rotation)
+                                           * glm::scale(glm::mat4(1.f), transform.scale));
+    } else {
+        // First load the matrices to the rasterizer
+        for (size_t index = 0; index != loader.GetTransforms().size(); ++index) {
+            MeshTransform transform = loader.GetTransforms()[index];
+            rasterizer.AddModel(transform);
+        }
+
+        rasterizer.SetView();
+        rasterizer.SetProjection();
+        rasterizer.SetScreenSpace();
 
-            rasterizer.SetView();
-            rasterizer.SetProjection();
-            rasterizer.SetScreenSpace();
+        // Compose the matrices
+        viewxprojection = rasterizer.screenspace * rasterizer.projection * rasterizer.view;
+    }
 
-            // Compose the matrices
-            viewxprojection = rasterizer.screenspace * rasterizer.projection * rasterizer.view;
+    // Set when the frame was shaded into the float color target
+    bool hdrFrame = false;
+
+    // If this is test on transforms, then do not need to iterate over the meshes
+    if (loader.GetType() == TestType::TRANSFORM_TEST) {
+        glm::vec3 input = loader.GetTestInput();
+        glm::vec3 expected = loader.GetTestExpected();
+        glm::vec4 input4(input, 1);
+
+        if (rasterizer.model.size() == 0) throw std::runtime_error("No model matrix specified for transform test");
+
+        glm::vec4 output = viewxprojection * rasterizer.model[0] * input4;
+        PrintTaskTransformTest(input, output, expected);
+    } else {
+        auto& shapes = loader.GetShapes();
+        auto& attribs = loader.GetAttribs();
+
+        // Decided once per frame, so that the face loop below does not re-check the config
+        const bool rawTriangles
+          = loader.GetType() == TestType::TRIANGLE || loader.GetType() == TestType::TRANSFORM;
+        const bool msaa = loader.GetAntiAliasConfig() == AntiAliasConfig::MSAA;
+        // Color tasks shade into the rasterizer's float target, which is tonemapped into `image` once at the end
+        const bool colorTarget = rawTriangles || loader.GetType() == TestType::SHADING
+                              || loader.GetType() == TestType::DEFERRED_SHADING;
+        hdrFrame = colorTarget;
+        const Rasterizer::Pipeline pipeline = rasterizer.SelectPipeline();
+        // SSAA triangles are set up on a screen with one pixel per sample and drawn once all of them are known
+        const bool supersampled = rawTriangles && loader.GetAntiAliasConfig() == AntiAliasConfig::SSAA;
+        const uint32_t samplesPerSide = supersampled ? SamplesPerSide(loader.GetSpp()) : 1;
+        if (supersampled)
+            this->stats.pipeline = "supersampled " + std::to_string(samplesPerSide) + "x"
+                                 + std::to_string(samplesPerSide);
+        else
+            this->stats.pipeline = rawTriangles ? "raw" : pipeline.name;
+
+        // Levels of detail are picked per shape and per instance; shadows always use the shapes themselves
+        const std::vector<ShapeLods>& lods = loader.GetLods();
+        const float pixelsPerUnit = LodPixelsPerUnit(loader.GetCamera(), loader.GetHeight());
+        const bool useLods = !lods.empty() && !rawTriangles && pixelsPerUnit > 0.f;
+        auto selectLevel = [&](size_t s, const glm::mat4& modelMat) -> uint32_t {
+            return useLods && s < lods.size()
+                     ? lods[s].Select(modelMat, loader.GetCamera(), pixelsPerUnit, loader.GetLodPixels())
+                     : 0;
+        };
+        auto levelShape = [&](size_t s, uint32_t level) -> const tinyobj::shape_t& {
+            return level == 0 ? shapes[s] : lods[s].levels[level - 1];
+        };
+        this->stats.lodLevels = useLods ? loader.GetLodCount() : 0;
+
+        // Clusters are tested as units before their faces are transformed: against their normal cone, the screen
+        //     and, through the occlusion buffer the depth pass fills, the surfaces drawn before them
+        const bool depthTested = loader.GetType() == TestType::SHADING_DEPTH || loader.GetType() == TestType::SHADING
+                              || loader.GetType() == TestType::DEFERRED_SHADING;
+        const std::vector<std::vector<ShapeClusters>>& clusters = loader.GetClusters();
+        const bool useClusters = !clusters.empty() && depthTested;
+        auto clusterView = [&](const glm::mat4& modelMat, const glm::mat4& modelViewProjection) {
+            // the normal cones are in model space, so the eye is brought there
+            const glm::vec3 eye = loader.GetCullBackFaces()
+                                    ? glm::vec3(glm::inverse(modelMat) * glm::vec4(loader.GetCamera().pos, 1.f))
+                                    : glm::vec3(0.f);
+            return ClusterView { modelViewProjection, eye, loader.GetWidth(), loader.GetHeight(),
+                                 loader.GetCullBackFaces(), &rasterizer.occlusion };
+        };
+
+        // Shapes with instances are only drawn through them; their vertices are gathered once per frame and level
+        const std::vector<InstanceSet>& instanceSets = loader.GetInstances();
+        std::vector<std::vector<InstancedMesh>> instancedMeshes;
+        std::vector<bool> instanced(shapes.size(), false);
+        for (const InstanceSet& set : instanceSets) {
+            if (set.shape >= shapes.size())
+                throw std::runtime_error("instances: model has no shape " + std::to_string(set.shape));
+            std::vector<InstancedMesh>& levels = instancedMeshes.emplace_back();
+            const uint32_t levelCount = useLods && set.shape < lods.size() ? lods[set.shape].LevelCount() : 1;
+            for (uint32_t level = 0; level < levelCount; ++level)
+                levels.emplace_back(levelShape(set.shape, level), attribs,
+                                    useClusters ? &clusters[set.shape][level] : nullptr);
+            instanced[set.shape] = true;
         }
 
-        // If this is test on transforms, then do not need to iterate over the meshes
-        if (loader.GetType() == TestType::TRANSFORM_TEST) {
-            glm::vec3 input = loader.GetTestInput();
-            glm::vec3 expected = loader.GetTestExpected();
-            glm::vec4 input4(input, 1);
+        // Shadow maps only depend on the lights and the model matrices, so they are rendered once for all passes
+        const bool shaded
+          = loader.GetType() == TestType::SHADING || loader.GetType() == TestType::DEFERRED_SHADING;
+        if (shaded) {
+            rasterizer.lightGrid.Build(loader.GetLights());
+            this->stats.lights = rasterizer.lightGrid.LightCount();
+            this->stats.boundedLights = rasterizer.lightGrid.BoundedCount();
+        }
+        if (shaded && loader.GetShadowMapSize() != 0) {
+            auto shadowStart = std::chrono::steady_clock::now();
+            rasterizer.shadowMaps = std::move(this->shadowCache);
+            const ShadowUpdate update = rasterizer.RenderShadowMaps(loader.GetShadowMapSize());
+            this->stats.shadowMaps = rasterizer.shadowMaps.LightCount();
+            this->stats.shadowFacesRendered = update.facesRendered;
+            this->stats.shadowFacesReused = update.facesReused;
+            this->stats.shadowMs
+              = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - shadowStart).count();
+        }
 
-            if (rasterizer.model.size() == 0) throw std::runtime_error("No model matrix specified for transform test");
+        // Number of triangles owning each pixel center, for the watertight test
+        if (loader.GetType() == TestType::WATERTIGHT_TEST)
+            rasterizer.CoverageHits = ImageBuffer<uint32_t>(loader.GetWidth(), loader.GetHeight());
 
-            glm::vec4 output = viewxprojection * rasterizer.model[0] * input4;
-            PrintTaskTransformTest(input, output, expected);
-        } else {
-            auto& shapes = loader.GetShapes();
-            auto& attribs = loader.GetAttribs();
+        // A virtual texture only knows which pages are needed after a pass has sampled it; when that pass had
+        //   to fall back to coarser levels, stream the requested pages in and render once more.
+        for (uint32_t pass = 0;; ++pass) {
+            if (colorTarget) rasterizer.InitColorBuffer(rasterizer.ColorBuffer);
             if (loader.GetType() == TestType::SHADING_DEPTH || loader.GetType() == TestType::SHADING
                 || loader.GetType() == TestType::DEFERRED_SHADING) {
                 rasterizer.InitZBuffer(rasterizer.ZBuffer);
-                if (loader.GetAntiAliasConfig() == AntiAliasConfig::MSAA) {
+                if (msaa) {
                     rasterizer.InitMSSAMask(rasterizer.MSAA_mask, loader.GetSpp());
                 }
                 if (loader.GetType() == TestType::DEFERRED_SHADING) {
                     rasterizer.InitGBuffer(rasterizer.GBuffer);
                 }
             }
+            if (useClusters)
+                rasterizer.occlusion.Reset(loader.GetWidth(), loader.GetHeight(), loader.GetCamera().nearClip);
+
+            // Per-shape triangle setup lives in the frame arena, which is rewound at the end of the pass
+            TriangleBatch batch;
+            if (supersampled) {
+                size_t frameFaces = 0;
+                for (const tinyobj::shape_t& shape : shapes) frameFaces += shape.mesh.num_face_vertices.size();
+                for (size_t i = 0; i < instanceSets.size(); ++i)
+                    frameFaces += instancedMeshes[i][0].FaceCount() * instanceSets[i].transforms.size();
+                batch.Reset(frameFaces, loader.GetWidth() * samplesPerSide, loader.GetHeight() * samplesPerSide,
+                            FrameArena::Local());
+            }
 
-            std::vector<Triangle> transformedTrigs;
-            std::vector<Triangle> originalTrigs;
+            // Set up a triangle of the current shape (or run of instances) and run the per-triangle pass on it
+            auto submit = [&](Triangle& transformed, const Triangle& original) {
+#if defined PRINT_TRIG_DETAIL
+                Triangle homogenized = transformed;
+                homogenized.Homogenize();
+                PrintTaskTriangle(homogenized);
+#endif
+
+                if (supersampled) {
+                    for (glm::vec4& pos : transformed.pos) {
+                        pos.x *= samplesPerSide;
+                        pos.y *= samplesPerSide;
+                    }
+                    if (batch.Add(transformed, original) && pass == 0) {
+                        ++this->stats.trianglesSetUp;
+                        if (batch.Bounds(batch.Size() - 1).FitsStamp()) ++this->stats.stampTriangles;
+                    }
+                } else if (rawTriangles) {
+                    transformed.Homogenize();
+                    rasterizer.DrawPrimitiveRaw(rasterizer.ColorBuffer, transformed, loader.GetAntiAliasConfig(),
+                                                loader.GetSpp());
+                } else if (batch.Add(transformed, original)) {
+                    // the batch does the perspective divide and drops triangles that cannot be visible
+                    const uint32_t added = batch.Size() - 1;
+                    if (pass == 0) {
+                        ++this->stats.trianglesSetUp;
+                        if (batch.Bounds(added).FitsStamp()) ++this->stats.stampTriangles;
+                    }
+                    if (pipeline.perTriangle) (rasterizer.*pipeline.perTriangle)(batch, added, rasterizer.ColorBuffer);
+                }
+            };
+            auto finishShape = [&]() {
+                if (pipeline.perShape)
+                    for (uint32_t i = 0; i < batch.Size(); ++i)
+                        (rasterizer.*pipeline.perShape)(batch, i, rasterizer.ColorBuffer);
+            };
+            auto testCluster = [&](const Cluster& cluster, const ClusterView& view) {
+                const ClusterCull result = TestCluster(cluster, view);
+                if (pass == 0) {
+                    ++this->stats.clusters;
+                    if (result == ClusterCull::OFF_SCREEN) ++this->stats.clustersOffScreen;
+                    if (result == ClusterCull::BACK_FACING) ++this->stats.clustersBackFacing;
+                    if (result == ClusterCull::OCCLUDED) ++this->stats.clustersOccluded;
+                }
+                return result == ClusterCull::VISIBLE;
+            };
 
             const size_t fv = 3;
             for (size_t s = 0; s < shapes.size(); s++) {
-                if (loader.GetType() == TestType::SHADING || loader.GetType() == TestType::DEFERRED_SHADING) {
-                    transformedTrigs.clear();
-                    originalTrigs.clear();
-                    transformedTrigs.reserve(shapes.size());
-                    originalTrigs.reserve(shapes.size());
+                if (instanced[s]) continue;
+                // init to identity so that the program will no crash even without model matrices being added
+                const glm::mat4 modelMat = rasterizer.model.size() > s ? rasterizer.model[s] : glm::mat4(1.f);
+                const glm::mat4 modelViewProjection = viewxprojection * modelMat;
+
+                const uint32_t level = selectLevel(s, modelMat);
+                const tinyobj::shape_t& shape = levelShape(s, level);
+                const size_t faceCount = shape.mesh.num_face_vertices.size();
+                if (pass == 0) {
+                    this->stats.trianglesSubmitted += faceCount;
+                    this->stats.trianglesFullDetail += shapes[s].mesh.num_face_vertices.size();
+                    ++this->stats.lodDraws[level];
                 }
+                if (!supersampled)
+                    batch.Reset(faceCount, loader.GetWidth(), loader.GetHeight(), FrameArena::Local(), msaa);
 
-                // Loop over faces(polygon)
-                size_t index_offset = 0;
-                for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
+                auto drawFace = [&](size_t f) {
                     // Loop over vertices in the face.
+                    const size_t index_offset = fv * f;
                     Triangle transformed, original;
                     for (size_t v = 0; v < fv; v++) {
                         // access to vertex
-                        tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
+                        tinyobj::index_t idx = shape.mesh.indices[index_offset + v];
                         tinyobj::real_t vx = attribs.vertices[3 * size_t(idx.vertex_index) + 0];
                         tinyobj::real_t vy = attribs.vertices[3 * size_t(idx.vertex_index) + 1];
                         tinyobj::real_t vz = attribs.vertices[3 * size_t(idx.vertex_index) + 2];
                         glm::vec4 vec(vx, vy, vz, 1);
 
-                        // init to identity so that the program will no crash even without model matrices being added
-                        glm::mat4 modelMat = glm::mat4(1.f);
-                        if (rasterizer.model.size() > s) modelMat = rasterizer.model[s];
-
-                        if (loader.GetType() == TestType::TRIANGLE)
-                            transformed.pos[v] = viewxprojection * vec;
-                        else
-                            transformed.pos[v] = viewxprojection * modelMat * vec;
-
+                        transformed.pos[v] = modelViewProjection * vec;
                         original.pos[v] = modelMat * vec;
 
                         if (idx.normal_index >= 0) {
@@ -161,39 +440,129 @@ void Renderer::Render(int argc, char** argv) {
                             transformed.tex_coord = original.tex_coord;
                         }
                     }
+                    submit(transformed, original);
+                };
+
+                // Loop over faces(polygon), cluster after cluster when they are on
+                if (useClusters) {
+                    const ShapeClusters& shapeClusters = clusters[s][level];
+                    const ClusterView view = clusterView(modelMat, modelViewProjection);
+                    for (const Cluster& cluster : shapeClusters.clusters) {
+                        if (!testCluster(cluster, view)) continue;
+                        for (uint32_t i = cluster.firstFace; i < cluster.firstFace + cluster.faceCount; ++i)
+                            drawFace(shapeClusters.faces[i]);
+                    }
+                } else {
+                    for (size_t f = 0; f < faceCount; f++) drawFace(f);
+                }
 
-                    transformed.Homogenize();
-
-#if defined PRINT_TRIG_DETAIL
-                    PrintTaskTriangle(transformed);
-#endif
+                finishShape();
+            }
 
-                    if (loader.GetType() == TestType::TRIANGLE || loader.GetType() == TestType::TRANSFORM)
-                        rasterizer.DrawPrimitiveRaw(image, transformed, loader.GetAntiAliasConfig(), loader.GetSpp());
-                    else if (loader.GetType() == TestType::SHADING_DEPTH || loader.GetType() == TestType::SHADING
-                             || loader.GetType() == TestType::DEFERRED_SHADING)
-                        rasterizer.DrawPrimitiveDepth(transformed, original, rasterizer.ZBuffer);
-                    if (loader.GetType() == TestType::SHADING || loader.GetType() == TestType::DEFERRED_SHADING) {
-                        transformedTrigs.push_back(transformed);
-                        originalTrigs.push_back(original);
+            // Instances go through the same setup and passes; the triangles of consecutive instances share a
+            //     batch of about INSTANCE_BATCH_TRIANGLES, and the per-shape pass runs whenever it fills up
+            for (size_t i = 0; i < instanceSets.size(); ++i) {
+                const InstanceSet& set = instanceSets[i];
+                std::vector<InstancedMesh>& levels = instancedMeshes[i];
+                // coarser levels have fewer faces, so a batch sized for level 0 holds as many instances of any
+                const size_t fullFaces = levels[0].FaceCount();
+                if (fullFaces == 0) continue;
+                const size_t capacity = fullFaces * std::max<size_t>(1, INSTANCE_BATCH_TRIANGLES / fullFaces);
+                if (!supersampled)
+                    batch.Reset(capacity, loader.GetWidth(), loader.GetHeight(), FrameArena::Local(), msaa);
+
+                // instance transforms apply on top of the shape's own
+                const glm::mat4 shapeMat
+                  = rasterizer.model.size() > set.shape ? rasterizer.model[set.shape] : glm::mat4(1.f);
+                for (const MeshTransform& transform : set.transforms) {
+                    const glm::mat4 modelMat = shapeMat * ComposeTransform(transform);
+                    const glm::mat4 modelViewProjection = viewxprojection * modelMat;
+                    const uint32_t level = selectLevel(set.shape, modelMat);
+                    InstancedMesh& mesh = levels[level];
+                    const size_t faceCount = mesh.FaceCount();
+                    if (pass == 0) ++this->stats.instances;
+                    if (!mesh.Visible(modelViewProjection, loader.GetWidth(), loader.GetHeight())) {
+                        if (pass == 0) ++this->stats.instancesCulled;
+                        continue;
+                    }
+                    if (pass == 0) {
+                        this->stats.trianglesSubmitted += faceCount;
+                        this->stats.trianglesFullDetail += fullFaces;
+                        ++this->stats.lodDraws[level];
                     }
 
-                    index_offset += fv;
-                }
+                    // without clusters the mesh is a single one, drawn whole
+                    const ClusterView view = useClusters ? clusterView(modelMat, modelViewProjection) : ClusterView {};
+                    for (uint32_t c = 0; c < mesh.ClusterCount(); ++c) {
+                        if (useClusters && !testCluster(clusters[set.shape][level].clusters[c], view)) continue;
+                        const uint32_t firstFace = mesh.ClusterFirstFace(c);
+                        const uint32_t clusterFaces = mesh.ClusterFaceCount(c);
+                        if (!supersampled && batch.Size() + clusterFaces > capacity) {
+                            finishShape();
+                            batch.Clear();
+                        }
 
-                if (loader.GetType() == TestType::SHADING)
-                    for (size_t i = 0; i < transformedTrigs.size(); ++i)
-                        rasterizer.DrawPrimitiveShaded(transformedTrigs[i], originalTrigs[i], image);
-                else if (loader.GetType() == TestType::DEFERRED_SHADING)
-                    for (size_t i = 0; i < transformedTrigs.size(); ++i)
-                        rasterizer.DrawPrimitiveGBuffer(transformedTrigs[i], originalTrigs[i], rasterizer.GBuffer);
+                        mesh.Transform(modelMat, modelViewProjection, c);
+                        for (uint32_t f = firstFace; f < firstFace + clusterFaces; ++f) {
+                            Triangle transformed, original;
+                            mesh.Face(f, transformed, original);
+                            submit(transformed, original);
+                        }
+                    }
+                }
+                if (!supersampled) finishShape();
             }
-            if (loader.GetType() == TestType::DEFERRED_SHADING) rasterizer.DrawPrimitiveShaded(image);
+            if (supersampled)
+                rasterizer.DrawSupersampled(batch, ColorHDR(1.f), Rasterizer::colorBufferDefault,
+                                            rasterizer.ColorBuffer);
+            if (loader.GetType() == TestType::DEFERRED_SHADING)
+                rasterizer.DrawPrimitiveShaded(rasterizer.ColorBuffer);
+            this->stats.arenaPeakBytes = std::max(this->stats.arenaPeakBytes, FrameArena::Local().GetPeakBytes());
+            FrameArena::Reset();
+
+            if (!rasterizer.virtualTexture || pass + 1 >= MAX_FEEDBACK_PASSES) break;
+            if (rasterizer.virtualTexture->StreamRequestedPages() == 0) break;
+        }
+
+        if (colorTarget) ResolveHDR(rasterizer.ColorBuffer, image, loader.GetToneMap());
+        // handed back for the next config, which re-renders only the faces that changed
+        if (!rasterizer.shadowMaps.Empty()) this->shadowCache = std::move(rasterizer.shadowMaps);
+
+        if (rasterizer.virtualTexture && verbose) PrintVirtualTextureStats(*rasterizer.virtualTexture);
+        if (!rasterizer.mipmap_vector.empty() || rasterizer.virtualTexture) {
+            std::error_code error;
+            this->textureCache.name = textureName;
+            this->textureCache.modified = std::filesystem::last_write_time(textureName, error);
+            this->textureCache.mipmaps = std::move(rasterizer.mipmap_vector);
+            this->textureCache.virtualTexture = std::move(rasterizer.virtualTexture);
         }
+        if (loader.GetType() == TestType::WATERTIGHT_TEST)
+            PrintTaskWatertightTest(rasterizer.CoverageHits, image, verbose);
+    }
+
+    Frame frame;
+    frame.image = std::move(image);
+    if (loader.GetType() == TestType::SHADING_DEPTH) frame.depth = std::move(rasterizer.ZBuffer);
+    if (hdrFrame) frame.color = std::move(rasterizer.ColorBuffer);
+    if (loader.GetType() == TestType::TRANSFORM_TEST) frame.image = Image(0, 0, loader.GetOutputName());
+
+    this->stats.renderMs
+      = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - renderStart).count();
+    return frame;
+}
+
+bool Renderer::TakeCachedTexture(const std::string& textureName, Rasterizer& rasterizer) {
+    TextureCache& cache = this->textureCache;
+    if (textureName.empty() || cache.name != textureName) return false;
+    if (cache.mipmaps.empty() && !cache.virtualTexture) return false;
 
-        if (loader.GetType() == TestType::SHADING_DEPTH)
-            rasterizer.ZBuffer.Write();
-        else if (loader.GetType() != TestType::TRANSFORM_TEST)
-            image.Write();
+    std::error_code error;
+    if (std::filesystem::last_write_time(textureName, error) != cache.modified || error) {
+        cache = TextureCache();   // rewritten (or rebaked) since it was read
+        return false;
     }
+    rasterizer.mipmap_vector = std::move(cache.mipmaps);
+    rasterizer.virtualTexture = std::move(cache.virtualTexture);
+    cache.mipmaps.clear();
+    return true;
 }
@@ -1,19 +1,79 @@
 #ifndef RENDERER_H
 #define RENDERER_H
 
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "async_writer.hpp"
 #include "entities.hpp"
+#include "frame_stream.hpp"
+#include "image.hpp"
 #include "loader.hpp"
 #include "rasterizer.hpp"
+#include "scene.hpp"
+#include "stats.hpp"
+#include "virtual_texture.hpp"
+
+// What rendering a scene leaves in memory
+struct Frame {
+    Image image { 0, 0 };       // the 8-bit result, named after the scene's output; empty for the transform test
+    ImageHDR color { 0, 0 };    // float color target of the color tasks before the tonemap, empty for the others
+    ImageGrey depth { 0, 0 };   // depth buffer of shading-depth, empty for the others
+};
+
+// Call `visit` with the buffer of `frame` that is written out for `loader`'s task: the depth buffer of shading-depth,
+//     the float color target for PFM output (before the tonemap), the 8-bit image otherwise, and nothing for the
+//     transform test
+template <typename Visit>
+void VisitOutput(Frame& frame, const Loader& loader, Visit&& visit) {
+    if (loader.GetType() == TestType::SHADING_DEPTH)
+        visit(frame.depth);
+    else if (loader.GetWriteOptions().format == ImageFormat::PFM && frame.color.GetWidth() != 0)
+        visit(frame.color);
+    else if (loader.GetType() != TestType::TRANSFORM_TEST)
+        visit(frame.image);
+}
 
 class Renderer {
 public:
-    Renderer(std::string configName)
+    Renderer(std::string configName = "config.yaml")
         : configName(configName) {};
 
-    void Render(int argc, char** argv);   // main render call
+    void Render(int argc, char** argv);   // main render call, one frame per config named on the command line
+
+    // Render `scene` into memory, without printing or writing anything. Frames rendered by the same Renderer share
+    //     its shadow map cache, so a scene that changed a little re-renders only the faces it affects. Throws if
+    //     the scene's texture cannot be opened.
+    Frame RenderFrame(const Scene& scene);
+
+    inline const RenderStats& GetStats() const { return this->stats; }
 
 private:
     std::string configName;
+    RenderStats stats;                     // of the latest config
+    std::unique_ptr<FrameStream> stream;   // of the latest config that streams; declared first so that the writer
+                                           //     drains into it before it closes
+    AsyncWriter writer;                    // shared by all configs so that writes overlap the next render
+    ShadowMaps shadowCache;                // shadow maps of the latest config that had them, see `ShadowMaps::Update`
+
+    // Texture of the latest config that sampled one, kept resident so that the next frame sampling the same,
+    //     unmodified file neither decodes it nor streams its pages again
+    struct TextureCache {
+        std::string name;
+        std::filesystem::file_time_type modified;
+        std::vector<Image> mipmaps;
+        std::unique_ptr<VirtualTexture> virtualTexture;
+    } textureCache;
+
+    void RenderConfig(const std::string& yamlConfigName, bool customized);
+    // Shared by both entry points; nothing comes back for tasks without an image (texture-test) or a texture that
+    //     failed to open. `verbose` prints the diagnostics of the virtual texture and the watertight test.
+    std::optional<Frame> RenderScene(const Loader& loader, bool verbose);
+    // Move the cached texture into `rasterizer` if it is still the one named `textureName`; false otherwise
+    bool TakeCachedTexture(const std::string& textureName, Rasterizer& rasterizer);
 };
 
 #endif
@@ -0,0 +1,211 @@
+#include "scene.hpp"
+
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+
+#include "../thirdparty/tinyobj/tiny_obj_loader.h"
+
+namespace {
+
+constexpr uint64_t FNV_OFFSET = 14695981039346656037ull;
+constexpr uint64_t FNV_PRIME = 1099511628211ull;
+
+uint64_t HashBytes(uint64_t hash, const void* data, size_t bytes) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < bytes; ++i) hash = (hash ^ p[i]) * FNV_PRIME;
+    return hash;
+}
+
+template <typename T>
+uint64_t HashSpan(uint64_t hash, std::span<const T> values) {
+    const uint64_t size = values.size();
+    hash = HashBytes(hash, &size, sizeof(size));
+    return HashBytes(hash, values.data(), values.size_bytes());
+}
+
+}   // namespace
+
+Scene::Scene(TestType task, uint32_t width, uint32_t height)
+    : geometryHash(FNV_OFFSET) {
+    if (task == TestType::TRANSFORM_TEST || task == TestType::TEXTURE_TEST || task == TestType::TEXTURE_BAKE
+        || task == TestType::ERROR)
+        throw std::invalid_argument("scene: task is only available through a config file");
+    if (width == 0 || height == 0 || width > 4096 || height > 4096)
+        throw std::invalid_argument("scene: width/height must be within 1..4096");
+    this->loader.type = task;
+    this->loader.width = width;
+    this->loader.height = height;
+    this->loader.specularExponent = 1.f;
+    this->loader.ambientColor = Color(0, 0, 0, 255);
+    this->loader.modelName = "<memory>";
+    this->loader.outputName = "output";
+}
+
+std::optional<Scene> Scene::Load(const std::string& configName) {
+    Scene scene;
+    scene.loader = Loader(configName);
+    if (!scene.loader.Load()) return std::nullopt;
+    return scene;
+}
+
+std::optional<Scene> Scene::Parse(const std::string& yaml, const std::string& name) {
+    Scene scene;
+    scene.loader = Loader(name);
+    if (!scene.loader.LoadYaml(yaml)) return std::nullopt;
+    return scene;
+}
+
+bool Scene::LoadMeshes() {
+    // texture tasks have no model
+    if (this->loader.type == TestType::TEXTURE_TEST || this->loader.type == TestType::TEXTURE_BAKE) return true;
+    if (this->loader.LoadObj()) return true;
+    std::cerr << "fail loading obj. Quit.\n";
+    return false;
+}
+
+void Scene::CopyMeshes(const Scene& other) {
+    // shared, not copied: no scene changes meshes another one holds
+    this->loader.meshes = other.loader.meshes;
+    // the levels only match when both configs ask for as many, and the clusters when they also agree on the size
+    const bool sameLods = this->loader.lodCount == other.loader.lodCount;
+    if (sameLods)
+        this->loader.lods = other.loader.lods;
+    else
+        this->loader.BuildLods();
+    if (sameLods && this->loader.clusterSize == other.loader.clusterSize)
+        this->loader.clusters = other.loader.clusters;
+    else
+        this->loader.BuildClusters();
+    this->loader.modelName = other.loader.modelName;
+    this->geometryHash = other.geometryHash;
+}
+
+uint32_t Scene::AddMesh(std::span<const float> positions, std::span<const uint32_t> indices,
+                        std::span<const float> normals, std::span<const float> texCoords) {
+    const size_t vertexCount = positions.size() / 3;
+    if (positions.size() % 3 != 0 || indices.size() % 3 != 0)
+        throw std::invalid_argument("scene: positions and indices must come in triples");
+    if (!normals.empty() && normals.size() != positions.size())
+        throw std::invalid_argument("scene: one normal per vertex expected");
+    if (!texCoords.empty() && texCoords.size() != 2 * vertexCount)
+        throw std::invalid_argument("scene: one tex coord per vertex expected");
+    for (const uint32_t index : indices)
+        if (index >= vertexCount) throw std::out_of_range("scene: vertex index out of range");
+
+    // appended to the same pools an OBJ file would fill, with indices offset past the earlier meshes
+    ModelMeshes& meshes = Loader::Unshare(this->loader.meshes);
+    tinyobj::attrib_t& attribs = meshes.attribs;
+    const int vertexBase = static_cast<int>(attribs.vertices.size() / 3);
+    const int normalBase = static_cast<int>(attribs.normals.size() / 3);
+    const int texBase = static_cast<int>(attribs.texcoords.size() / 2);
+    attribs.vertices.insert(attribs.vertices.end(), positions.begin(), positions.end());
+    attribs.normals.insert(attribs.normals.end(), normals.begin(), normals.end());
+    attribs.texcoords.insert(attribs.texcoords.end(), texCoords.begin(), texCoords.end());
+
+    tinyobj::shape_t shape;
+    shape.name = "mesh" + std::to_string(meshes.shapes.size());
+    shape.mesh.indices.reserve(indices.size());
+    for (const uint32_t index : indices) {
+        const int i = static_cast<int>(index);
+        shape.mesh.indices.push_back({ vertexBase + i, normals.empty() ? -1 : normalBase + i,
+                                       texCoords.empty() ? -1 : texBase + i });
+    }
+    shape.mesh.num_face_vertices.assign(indices.size() / 3, 3);
+    meshes.shapes.push_back(std::move(shape));
+    meshes.Summarize();
+    if (this->loader.lodCount != 0)
+        Loader::Unshare(this->loader.lods).push_back(BuildLods(meshes.shapes.back(), attribs, this->loader.lodCount));
+    if (this->loader.clusterSize != 0)
+        Loader::Unshare(this->loader.clusters).push_back(this->loader.ClustersOf(meshes.shapes.size() - 1));
+
+    // shadow casters are keyed by model name, so different geometry must never share one
+    this->geometryHash = HashSpan(this->geometryHash, positions);
+    this->geometryHash = HashSpan(this->geometryHash, indices);
+    char name[32];
+    std::snprintf(name, sizeof(name), "<memory %016llx>", static_cast<unsigned long long>(this->geometryHash));
+    this->loader.modelName = name;
+    return static_cast<uint32_t>(meshes.shapes.size() - 1);
+}
+
+void Scene::AddTransform(const MeshTransform& transform) {
+    this->loader.transforms.push_back(transform);
+}
+
+void Scene::AddInstances(uint32_t shape, std::span<const MeshTransform> transforms) {
+    if (shape >= this->loader.GetShapes().size()) throw std::out_of_range("scene: no shape " + std::to_string(shape));
+    this->loader.instances.push_back({ shape, std::vector<MeshTransform>(transforms.begin(), transforms.end()) });
+}
+
+void Scene::AddLight(const Light& light) {
+    this->loader.lights.push_back(light);
+}
+
+void Scene::SetTransform(uint32_t index, const MeshTransform& transform) {
+    if (index >= this->loader.transforms.size())
+        throw std::out_of_range("scene: no transform " + std::to_string(index));
+    this->loader.transforms[index] = transform;
+}
+
+void Scene::SetLight(uint32_t index, const Light& light) {
+    if (index >= this->loader.lights.size()) throw std::out_of_range("scene: no light " + std::to_string(index));
+    this->loader.lights[index] = light;
+}
+
+void Scene::SetCamera(const Camera& camera) {
+    this->loader.camera = camera;
+}
+
+void Scene::SetMaterial(float specularExponent, Color ambient) {
+    this->loader.specularExponent = specularExponent;
+    this->loader.ambientColor = ambient;
+}
+
+void Scene::SetAntiAlias(AntiAliasConfig config, uint32_t samples, SSAAFilter filter) {
+    this->loader.AAConfig = config;
+    this->loader.AASpp = config == AntiAliasConfig::NONE ? 0 : samples;
+    this->loader.ssaaFilter = filter;
+}
+
+void Scene::SetShader(ShaderConfig shader) {
+    this->loader.shader = shader;
+}
+
+void Scene::SetLevelsOfDetail(uint32_t count, float pixelError) {
+    if (count > MAX_LODS) throw std::invalid_argument("scene: at most 4 levels of detail");
+    if (!(pixelError > 0.f)) throw std::invalid_argument("scene: level of detail error must be positive");
+    this->loader.lodPixels = pixelError;
+    if (count == this->loader.lodCount) return;
+    this->loader.lodCount = count;
+    this->loader.BuildLods();
+    this->loader.BuildClusters();
+}
+
+void Scene::SetClusters(uint32_t maxTriangles, bool cullBackFaces) {
+    if (maxTriangles > MAX_CLUSTER_TRIANGLES) throw std::invalid_argument("scene: at most 256 triangles per cluster");
+    this->loader.cullBackFaces = cullBackFaces;
+    if (maxTriangles == this->loader.clusterSize) return;
+    this->loader.clusterSize = maxTriangles;
+    this->loader.BuildClusters();
+}
+
+void Scene::SetToneMap(ToneMap toneMap) {
+    this->loader.toneMap = toneMap;
+}
+
+void Scene::SetShadows(uint32_t size, const ShadowFilterOptions& filter) {
+    if (size > 4096) throw std::invalid_argument("scene: shadow map size exceeding 4096");
+    if (filter.kernel % 2 == 0 || filter.kernel > SHADOW_MAX_KERNEL)
+        throw std::invalid_argument("scene: shadow kernel must be odd and at most 15");
+    this->loader.shadowMapSize = size;
+    this->loader.shadowFilter = filter;
+}
+
+void Scene::SetTexture(const std::string& filename) {
+    this->loader.textureName = filename;
+}
+
+void Scene::SetOutput(const std::string& name, const WriteOptions& options) {
+    this->loader.outputName = name;
+    this->loader.writeOptions = options;
+}
@@ -0,0 +1,76 @@
+// Programmatic scene description: everything a YAML config and its OBJ file provide, filled in from memory so that
+//     an embedding program can render without touching the disk (see `Renderer::RenderFrame`)
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+
+#include "entities.hpp"
+#include "image_writer.hpp"
+#include "loader.hpp"
+#include "shadow.hpp"
+
+class Scene {
+public:
+    // An empty scene for one of the rendering tasks (triangle, transform, shading-depth, shading, deferred-shading
+    //     or watertight-test); the rest of the test tasks need their YAML fields and stay config-only
+    Scene(TestType task, uint32_t width, uint32_t height);
+
+    // Append a shape: `positions` and the optional `normals` are xyz per vertex, `texCoords` uv per vertex, and
+    //     `indices` three vertex indices per triangle, shared by all attributes. Returns the shape's index, which
+    //     is also the index of the transform applied to it.
+    uint32_t AddMesh(std::span<const float> positions, std::span<const uint32_t> indices,
+                     std::span<const float> normals = {}, std::span<const float> texCoords = {});
+
+    void AddTransform(const MeshTransform& transform);
+    // Draw shape `shape` once per transform, on top of its own transform, instead of once; throws std::out_of_range
+    //     for a shape that was not added
+    void AddInstances(uint32_t shape, std::span<const MeshTransform> transforms);
+    void AddLight(const Light& light);
+    // Replace an existing transform or light; throws std::out_of_range past the last one
+    void SetTransform(uint32_t index, const MeshTransform& transform);
+    void SetLight(uint32_t index, const Light& light);
+    void SetCamera(const Camera& camera);
+    void SetMaterial(float specularExponent, Color ambient);
+
+    void SetAntiAlias(AntiAliasConfig config, uint32_t samples = 0, SSAAFilter filter = SSAAFilter::BOX);
+    void SetShader(ShaderConfig shader);
+    // Simplify every mesh, including those added later, into `count` coarser levels (at most MAX_LODS, see lod.hpp);
+    //     each shape and instance is drawn at the coarsest level whose error stays within `pixelError` on screen
+    void SetLevelsOfDetail(uint32_t count, float pixelError = 1.f);
+    // Split every mesh and level into clusters of up to `maxTriangles` (0 turns them off), each skipped whole when it
+    //     is off-screen or hidden behind what was drawn before it, and with `cullBackFaces` when it faces away. Only
+    //     cull back faces of closed meshes wound counter-clockwise seen from outside.
+    void SetClusters(uint32_t maxTriangles = DEFAULT_CLUSTER_TRIANGLES, bool cullBackFaces = false);
+    void SetToneMap(ToneMap toneMap);
+    // 0 disables shadows
+    void SetShadows(uint32_t size, const ShadowFilterOptions& filter = {});
+    // Mipmapped image or baked `.vtex`, read from disk when the scene is rendered
+    void SetTexture(const std::string& filename);
+    // Only used when the frame is written out, e.g. by the command line renderer
+    void SetOutput(const std::string& name, const WriteOptions& options = {});
+
+    // The scene of a YAML config and the OBJ file it names, for any task; reports parse errors and returns nothing
+    //     when the config cannot be loaded
+    static std::optional<Scene> Load(const std::string& configName);
+    // The same from the text of a config, without reading its OBJ file yet: `LoadMeshes` reads it, `CopyMeshes`
+    //     shares the geometry of a scene that already did. `name` stands for the file in parse errors.
+    static std::optional<Scene> Parse(const std::string& yaml, const std::string& name = "<config>");
+    bool LoadMeshes();
+    void CopyMeshes(const Scene& other);
+
+    inline const Loader& GetLoader() const { return this->loader; }
+    inline Loader& GetLoader() { return this->loader; }
+
+private:
+    Scene() = default;
+
+    Loader loader;
+    uint64_t geometryHash = 0;   // over all meshes added so far, names the model for the shadow map cache
+};
+
+#endif
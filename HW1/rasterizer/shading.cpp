@@ -0,0 +1,95 @@
+#include "shading.hpp"
+
+#include <algorithm>
+
+void ShadeBatch::Pad() {
+    if (this->count == 0 || this->count == SHADE_LANES) return;
+    const uint32_t last = this->count - 1;
+    for (Lanes<float>* lanes : { &nx, &ny, &nz, &px, &py, &pz, &albedoR, &albedoG, &albedoB })
+        std::fill(lanes->begin() + this->count, lanes->end(), (*lanes)[last]);
+}
+
+BlinnPhongKernel::BlinnPhongKernel(const std::vector<Light>& lights, Color ambient, float specularExponent,
+                                   glm::vec3 eye, const ShadowMaps* shadows)
+    : shadows(shadows)
+    , ambientR(static_cast<unsigned char>(ambient.r) / 255.f)
+    , ambientG(static_cast<unsigned char>(ambient.g) / 255.f)
+    , ambientB(static_cast<unsigned char>(ambient.b) / 255.f)
+    , specularExponent(specularExponent)
+    , eye(eye) {
+    for (const Light& light : lights) {
+        this->allLights.push_back(static_cast<uint32_t>(this->allLights.size()));
+        this->lightX.push_back(light.pos.x);
+        this->lightY.push_back(light.pos.y);
+        this->lightZ.push_back(light.pos.z);
+        this->lightR.push_back(static_cast<unsigned char>(light.color.r) / 255.f * light.intensity);
+        this->lightG.push_back(static_cast<unsigned char>(light.color.g) / 255.f * light.intensity);
+        this->lightB.push_back(static_cast<unsigned char>(light.color.b) / 255.f * light.intensity);
+        const float r2 = light.radius * light.radius;
+        this->lightInvR4.push_back(1.f / (r2 * r2));
+    }
+}
+
+void BlinnPhongKernel::Shade(const ShadeBatch& batch, ShadeResult& result) const {
+    this->Shade(batch, result, this->allLights);
+}
+
+void BlinnPhongKernel::Shade(const ShadeBatch& batch, ShadeResult& result, std::span<const uint32_t> lights) const {
+    // accumulate in locals: `result` could alias `batch` as far as the compiler knows, which would keep the lane
+    //     loops scalar
+    ShadeBatch::Lanes<float> nx, ny, nz, vx, vy, vz, r, g, b;
+    for (uint32_t i = 0; i != SHADE_LANES; ++i) {
+        const float n2 = batch.nx[i] * batch.nx[i] + batch.ny[i] * batch.ny[i] + batch.nz[i] * batch.nz[i];
+        const float invN = FastInvSqrt(n2 + 1e-24f);   // background lanes (zero normal) stay zero
+        nx[i] = batch.nx[i] * invN;
+        ny[i] = batch.ny[i] * invN;
+        nz[i] = batch.nz[i] * invN;
+
+        const float dx = this->eye.x - batch.px[i], dy = this->eye.y - batch.py[i], dz = this->eye.z - batch.pz[i];
+        const float invV = FastInvSqrt(dx * dx + dy * dy + dz * dz + 1e-12f);
+        vx[i] = dx * invV;
+        vy[i] = dy * invV;
+        vz[i] = dz * invV;
+
+        r[i] = this->ambientR * batch.albedoR[i];
+        g[i] = this->ambientG * batch.albedoG[i];
+        b[i] = this->ambientB * batch.albedoB[i];
+    }
+
+    ShadeBatch::Lanes<float> visibility;
+    visibility.fill(1.f);
+    for (const uint32_t l : lights) {
+        const float lx = this->lightX[l], ly = this->lightY[l], lz = this->lightZ[l];
+        const float lr = this->lightR[l], lg = this->lightG[l], lb = this->lightB[l];
+        const float invR4 = this->lightInvR4[l];
+        // shadow lookups are gathers, so they stay a scalar loop ahead of the vector one
+        if (this->shadows)
+            for (uint32_t i = 0; i != SHADE_LANES; ++i)
+                visibility[i] = this->shadows->Visibility(l, glm::vec3(batch.px[i], batch.py[i], batch.pz[i]));
+        for (uint32_t i = 0; i != SHADE_LANES; ++i) {
+            float dx = lx - batch.px[i], dy = ly - batch.py[i], dz = lz - batch.pz[i];
+            const float d2 = dx * dx + dy * dy + dz * dz + 1e-12f;
+            const float invD = FastInvSqrt(d2);
+            dx *= invD;
+            dy *= invD;
+            dz *= invD;
+            const float diffuse = MaxF(nx[i] * dx + ny[i] * dy + nz[i] * dz, 0.f);
+
+            const float hx = dx + vx[i], hy = dy + vy[i], hz = dz + vz[i];
+            const float invH = FastInvSqrt(hx * hx + hy * hy + hz * hz + 1e-12f);
+            const float cosH = (nx[i] * hx + ny[i] * hy + nz[i] * hz) * invH;
+            const float specular = FastPow(cosH, this->specularExponent);
+
+            // Light::Attenuation, with the window clamped on its result
+            const float fade = MaxF(1.f - d2 * d2 * invR4, 0.f);
+            const float attenuation = visibility[i] * fade * fade / d2;
+            r[i] += lr * attenuation * (batch.albedoR[i] * diffuse + specular);
+            g[i] += lg * attenuation * (batch.albedoG[i] * diffuse + specular);
+            b[i] += lb * attenuation * (batch.albedoB[i] * diffuse + specular);
+        }
+    }
+
+    result.r = r;
+    result.g = g;
+    result.b = b;
+}
@@ -0,0 +1,112 @@
+// Blinn-Phong shading of several pixels at once, for the deferred resolve
+
+#ifndef SHADING_H
+#define SHADING_H
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "../thirdparty/glm/glm.hpp"
+#include "entities.hpp"
+#include "image.hpp"
+#include "shadow.hpp"
+
+// Pixels shaded together; every per-light step is a loop over this many lanes, which the compiler vectorizes
+constexpr uint32_t SHADE_LANES = 16;
+
+// G-buffer samples in structure-of-arrays form; colors are linear floats in [0, 1]
+struct ShadeBatch {
+    template <typename T>
+    using Lanes = std::array<T, SHADE_LANES>;
+
+    Lanes<float> nx, ny, nz;   // normals, not necessarily normalized
+    Lanes<float> px, py, pz;   // world space positions
+    Lanes<float> albedoR, albedoG, albedoB;
+    uint32_t count = 0;        // lanes in use; the rest hold copies that are computed but ignored
+
+    // Duplicate the last valid lane into the unused ones so that they never produce NaNs
+    void Pad();
+};
+
+// Linear float colors, 1 being white (and above for over-exposed lights), one per lane
+struct ShadeResult {
+    ShadeBatch::Lanes<float> r, g, b;
+};
+
+// The helpers below are branch-free and avoid libm calls (std::sqrt and std::floor may set errno or need SSE4.1),
+//     so that the lane loops using them vectorize at plain -O2. Their inputs should not come straight out of a
+//     float min/max: GCC then fails to if-convert the bit casts, so clamping is done on the results or in integers.
+
+// max by value: std::max returns a reference, which becomes a conditional load that blocks if-conversion
+inline float MaxF(float a, float b) {
+    return a > b ? a : b;
+}
+
+// 1 / sqrt(x) for x > 0, to about 5e-6 relative error (two Newton steps from the bit-level estimate)
+inline float FastInvSqrt(float x) {
+    float y = std::bit_cast<float>(0x5F375A86 - (std::bit_cast<int32_t>(x) >> 1));
+    y *= 1.5f - 0.5f * x * y * y;
+    y *= 1.5f - 0.5f * x * y * y;
+    return y;
+}
+
+// 2^x for |x| < 2^31, to about 1e-6 relative error; flushes to 0 below 2^-127 and saturates above 2^127
+inline float FastExp2(float x) {
+    int32_t whole = static_cast<int32_t>(x);
+    whole -= static_cast<float>(whole) > x;   // round towards -inf
+    const float f = x - static_cast<float>(whole);
+    // 2^f on [0, 1), Taylor series of e^(f ln 2) with slightly adjusted coefficients
+    const float p = 1.f + f * (0.6931472f + f * (0.2402265f + f * (0.0555041f + f * (0.0096181f + f * 0.0013334f))));
+    int32_t exponent = whole + 127;
+    exponent = exponent < 0 ? 0 : exponent;
+    exponent = exponent > 254 ? 254 : exponent;
+    return std::bit_cast<float>(exponent << 23) * p;
+}
+
+// log2(x) for x > 0, to about 1e-6 absolute error
+inline float FastLog2(float x) {
+    const int32_t bits = std::bit_cast<int32_t>(x);
+    const float exponent = static_cast<float>(((bits >> 23) & 0xFF) - 127);
+    const float m = std::bit_cast<float>((bits & 0x007FFFFF) | 0x3F800000);   // mantissa in [1, 2)
+    // log2(m) = 2 / ln 2 * atanh(t) with t = (m - 1) / (m + 1) in [0, 1/3]
+    const float t = (m - 1.f) / (m + 1.f), t2 = t * t;
+    return exponent + t * (2.8853901f + t2 * (0.9617967f + t2 * (0.5770780f + t2 * 0.4121986f)));
+}
+
+// x^p for p > 0, through FastExp2(p * FastLog2(x)); 0 for x <= 0
+inline float FastPow(float x, float p) {
+    const float y = FastExp2(p * FastLog2(x + 1e-30f));
+    // zeroed through an integer mask: `?:` or a bool-to-float multiply would become a branch around the computation
+    return std::bit_cast<float>(std::bit_cast<int32_t>(y) & -static_cast<int32_t>(x > 0.f));
+}
+
+class BlinnPhongKernel {
+public:
+    // Lights are converted once into SoA form, with color / 255 * intensity folded into a single float3 per light.
+    //     With `shadows`, each light's term is scaled by its shadow map visibility.
+    BlinnPhongKernel(const std::vector<Light>& lights, Color ambient, float specularExponent, glm::vec3 eye,
+                     const ShadowMaps* shadows = nullptr);
+
+    // ambient * albedo + sum over lights of color * intensity * Light::Attenuation(d^2)
+    //     * (albedo * max(n.l, 0) + max(n.h, 0)^exponent)
+    void Shade(const ShadeBatch& batch, ShadeResult& result) const;
+
+    // Same, summing only over `lights` (indices into the constructor's lights, e.g. from `LightGrid::Gather`); the
+    //     lights left out must not reach any lane
+    void Shade(const ShadeBatch& batch, ShadeResult& result, std::span<const uint32_t> lights) const;
+
+private:
+    const ShadowMaps* shadows;
+    std::vector<uint32_t> allLights;
+    std::vector<float> lightX, lightY, lightZ;
+    std::vector<float> lightR, lightG, lightB;
+    std::vector<float> lightInvR4;   // 1 / radius^4 for the attenuation window, 0 for unbounded lights
+    float ambientR, ambientG, ambientB;
+    float specularExponent;
+    glm::vec3 eye;
+};
+
+#endif
@@ -0,0 +1,328 @@
+#include "shadow.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+#include "../thirdparty/glm/gtc/matrix_transform.hpp"
+#include "coverage.hpp"
+#include "parallel.hpp"
+#include "triangle_batch.hpp"
+
+namespace {
+
+// View direction and up vector of each cube face, in SHADOW_FACES order
+const std::array<glm::vec3, SHADOW_FACES> FACE_DIRECTIONS = { glm::vec3(1, 0, 0),  glm::vec3(-1, 0, 0),
+                                                              glm::vec3(0, 1, 0),  glm::vec3(0, -1, 0),
+                                                              glm::vec3(0, 0, 1),  glm::vec3(0, 0, -1) };
+const std::array<glm::vec3, SHADOW_FACES> FACE_UPS = { glm::vec3(0, -1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1),
+                                                       glm::vec3(0, 0, -1), glm::vec3(0, -1, 0), glm::vec3(0, -1, 0) };
+
+// The face a direction from the light falls into: its major axis, and the sign along it
+uint32_t FaceOf(glm::vec3 direction) {
+    const glm::vec3 a = glm::abs(direction);
+    if (a.x >= a.y && a.x >= a.z) return direction.x >= 0.f ? 0 : 1;
+    if (a.y >= a.z) return direction.y >= 0.f ? 2 : 3;
+    return direction.z >= 0.f ? 4 : 5;
+}
+
+// Distance along the face axis of a point whose NDC depth is `depth`, inverting the perspective projection
+float LinearDepth(float depth) {
+    return 2.f * SHADOW_FAR * SHADOW_NEAR / ((SHADOW_FAR + SHADOW_NEAR) - depth * (SHADOW_FAR - SHADOW_NEAR));
+}
+
+// Inverse of LinearDepth
+float NdcDepth(float distance) {
+    return ((SHADOW_FAR + SHADOW_NEAR) - 2.f * SHADOW_FAR * SHADOW_NEAR / distance) / (SHADOW_FAR - SHADOW_NEAR);
+}
+
+// Poisson disk of unit radius: points at least ~0.3 apart, so few taps cover the disk without clumping
+const std::array<glm::vec2, SHADOW_POISSON_TAPS> POISSON_DISK = {
+    glm::vec2(-0.94201624f, -0.39906216f), glm::vec2(0.94558609f, -0.76890725f),
+    glm::vec2(-0.09418410f, -0.92938870f), glm::vec2(0.34495938f, 0.29387760f),
+    glm::vec2(-0.91588581f, 0.45771432f),  glm::vec2(-0.81544232f, -0.87912464f),
+    glm::vec2(-0.38277543f, 0.27676845f),  glm::vec2(0.97484398f, 0.75648379f),
+    glm::vec2(0.44323325f, -0.97511554f),  glm::vec2(0.53742981f, -0.47373420f),
+    glm::vec2(-0.26496911f, -0.41893023f), glm::vec2(0.79197514f, 0.19090188f),
+    glm::vec2(-0.24188840f, 0.99706507f),  glm::vec2(-0.81409955f, 0.91437590f),
+    glm::vec2(0.19984126f, 0.78641367f),   glm::vec2(0.14383161f, -0.14100790f)
+};
+
+// (cos, sin) of a rotation that changes from texel to texel, trading the banding of a fixed disk for noise; the
+//     angles come from a table, sin and cos per lookup would cost more than the taps
+constexpr uint32_t DISK_ROTATIONS = 64;
+const std::array<glm::vec2, DISK_ROTATIONS> ROTATIONS = [] {
+    std::array<glm::vec2, DISK_ROTATIONS> rotations;
+    for (uint32_t i = 0; i < DISK_ROTATIONS; ++i) {
+        const float angle = static_cast<float>(i) * (2.f * std::numbers::pi_v<float> / DISK_ROTATIONS);
+        rotations[i] = { std::cos(angle), std::sin(angle) };
+    }
+    return rotations;
+}();
+
+glm::vec2 DiskRotation(float u, float v) {
+    uint32_t hash = static_cast<uint32_t>(static_cast<int32_t>(u)) * 73856093u
+                  ^ static_cast<uint32_t>(static_cast<int32_t>(v)) * 19349663u;
+    hash ^= hash >> 13;
+    hash *= 0x5BD1E995u;
+    return ROTATIONS[(hash >> 16) % DISK_ROTATIONS];
+}
+
+// Texels of the rotated and scaled disk around (u, v), clamped to the face
+void TapPositions(float u, float v, glm::vec2 rotation, uint32_t size, std::array<uint32_t, SHADOW_POISSON_TAPS>& x,
+                  std::array<uint32_t, SHADOW_POISSON_TAPS>& y) {
+    const int32_t last = static_cast<int32_t>(size) - 1;
+    for (uint32_t t = 0; t != SHADOW_POISSON_TAPS; ++t) {
+        const glm::vec2 p = POISSON_DISK[t];
+        const float tu = u + rotation.x * p.x - rotation.y * p.y;
+        const float tv = v + rotation.y * p.x + rotation.x * p.y;
+        x[t] = static_cast<uint32_t>(std::clamp(static_cast<int32_t>(tu), 0, last));
+        y[t] = static_cast<uint32_t>(std::clamp(static_cast<int32_t>(tv), 0, last));
+    }
+}
+
+// Whether any part of the box can be in the face's frustum: false only if all corners are beyond one of its planes
+//     (the four sides, in texel units, and the near plane)
+bool FaceReaches(const glm::mat4& viewProjection, float size, glm::vec3 boundsMin, glm::vec3 boundsMax) {
+    std::array<uint32_t, 5> outside {};
+    for (int corner = 0; corner != 8; ++corner) {
+        const glm::vec3 p((corner & 1) ? boundsMax.x : boundsMin.x, (corner & 2) ? boundsMax.y : boundsMin.y,
+                          (corner & 4) ? boundsMax.z : boundsMin.z);
+        const glm::vec4 clip = viewProjection * glm::vec4(p, 1.f);
+        outside[0] += clip.x < 0.f;
+        outside[1] += clip.x > size * clip.w;
+        outside[2] += clip.y < 0.f;
+        outside[3] += clip.y > size * clip.w;
+        outside[4] += clip.z + clip.w < 0.f;
+    }
+    return std::find(outside.begin(), outside.end(), 8u) == outside.end();
+}
+
+}   // namespace
+
+ShadowUpdate ShadowMaps::Update(const std::vector<Light>& lights, const std::vector<ShadowCaster>& casters,
+                                uint32_t size, const std::function<void(std::vector<glm::vec3>&)>& triangles) {
+    this->size = size;
+    this->cubes.resize(lights.size());
+
+    const float half = static_cast<float>(size) / 2.f;
+    const glm::mat4 toTexels = glm::translate(glm::mat4(1.f), glm::vec3(half, half, 0.f))
+                             * glm::scale(glm::mat4(1.f), glm::vec3(half, half, 1.f));
+    const glm::mat4 projection = glm::perspective(std::numbers::pi_v<float> / 2.f, 1.f, SHADOW_NEAR, SHADOW_FAR);
+    for (size_t l = 0; l < lights.size(); ++l) {
+        Cube& cube = this->cubes[l];
+        if (cube.size == size && cube.center == lights[l].pos) continue;
+        cube.center = lights[l].pos;
+        cube.size = size;
+        for (uint32_t face = 0; face < SHADOW_FACES; ++face) {
+            const glm::mat4 view = glm::lookAt(cube.center, cube.center + FACE_DIRECTIONS[face], FACE_UPS[face]);
+            cube.viewProjection[face] = toTexels * projection * view;
+            if (cube.faces[face].GetWidth() != size)
+                cube.faces[face] = ImageGrey(size, size, NoInit {}, "shadow");
+            cube.valid[face] = false;
+        }
+    }
+
+    // shapes are matched by position in the list; any difference dirties the faces that see either box
+    std::vector<std::pair<glm::vec3, glm::vec3>> changed;
+    for (size_t s = 0; s < std::max(casters.size(), this->casters.size()); ++s) {
+        const bool before = s < this->casters.size(), after = s < casters.size();
+        if (before && after && this->casters[s].key == casters[s].key) continue;
+        if (before) changed.emplace_back(this->casters[s].boundsMin, this->casters[s].boundsMax);
+        if (after) changed.emplace_back(casters[s].boundsMin, casters[s].boundsMax);
+    }
+    this->casters = casters;
+
+    ShadowUpdate update;
+    std::vector<uint32_t> dirty;
+    for (size_t l = 0; l < this->cubes.size(); ++l) {
+        Cube& cube = this->cubes[l];
+        for (uint32_t face = 0; face < SHADOW_FACES; ++face) {
+            for (const auto& [boundsMin, boundsMax] : changed) {
+                if (!cube.valid[face]) break;
+                if (FaceReaches(cube.viewProjection[face], static_cast<float>(size), boundsMin, boundsMax))
+                    cube.valid[face] = false;
+            }
+            if (cube.valid[face])
+                ++update.facesReused;
+            else
+                dirty.push_back(static_cast<uint32_t>(l * SHADOW_FACES + face));
+        }
+    }
+    update.facesRendered = dirty.size();
+    if (dirty.empty()) return update;
+    std::vector<glm::vec3> vertices;
+    triangles(vertices);
+
+    // every face is an independent item; each worker rewinds its own arena between items
+    std::vector<Arena> arenas(WorkerCount());
+    ParallelFor(static_cast<uint32_t>(dirty.size()), [&](uint32_t item, uint32_t worker) {
+        arenas[worker].Reset();
+        Cube& cube = this->cubes[dirty[item] / SHADOW_FACES];
+        const uint32_t face = dirty[item] % SHADOW_FACES;
+        this->RenderFace(cube, face, vertices, arenas[worker]);
+        cube.valid[face] = true;
+    });
+    return update;
+}
+
+void ShadowMaps::RenderFace(Cube& cube, uint32_t face, std::span<const glm::vec3> triangles, Arena& arena) {
+    ImageGrey& target = cube.faces[face];
+    target.Fill(1.f);
+    const glm::mat4& viewProjection = cube.viewProjection[face];
+
+    // Clip planes in clip space, positive on the kept side: the near plane, then a guard band half as wide as the
+    //     one TriangleBatch::Add accepts, so that casters far to the side of the light are cut rather than dropped
+    constexpr uint32_t PLANES = 5;
+    constexpr float GUARD = GUARD_BAND / 2.f;
+
+    // triangles are drawn as soon as they are added, so the batch only holds the fan of one clipped triangle
+    TriangleBatch batch;
+    batch.Reset(3 + PLANES - 2, this->size, this->size, arena, false, true);
+
+    auto add = [&](const glm::vec4& a, const glm::vec4& b, const glm::vec4& c) {
+        Triangle trig;
+        trig.pos = { a, b, c };
+        if (!batch.Add(trig, trig)) return;
+        const uint32_t index = batch.Size() - 1;
+        ForEachCoveredSpan(batch, index, false, [&](uint32_t y, uint32_t xBegin, uint32_t xEnd) {
+            float* row = target.Row(y);
+            const float yCenter = static_cast<float>(y) + 0.5f;
+            for (uint32_t x = xBegin; x <= xEnd; ++x) {
+                const float depth = batch.Depth(index, static_cast<float>(x) + 0.5f, yCenter);
+                row[x] = depth < row[x] ? depth : row[x];
+            }
+        });
+    };
+
+    auto distanceTo = [&](uint32_t plane, const glm::vec4& p) {
+        switch (plane) {
+        case 0: return p.z + p.w;
+        case 1: return GUARD * p.w - p.x;
+        case 2: return GUARD * p.w + p.x;
+        case 3: return GUARD * p.w - p.y;
+        default: return GUARD * p.w + p.y;
+        }
+    };
+
+    for (size_t t = 0; t < triangles.size() / 3; ++t) {
+        // Sutherland-Hodgman: every plane adds at most one corner, and the result is drawn as a fan
+        std::array<glm::vec4, 3 + PLANES> polygon, clipped;
+        uint32_t corners = 3;
+        for (int v = 0; v != 3; ++v) polygon[v] = viewProjection * glm::vec4(triangles[3 * t + v], 1.f);
+        for (uint32_t plane = 0; plane < PLANES && corners >= 3; ++plane) {
+            std::array<float, 3 + PLANES> distance;
+            bool inside = true;
+            for (uint32_t v = 0; v < corners; ++v) {
+                distance[v] = distanceTo(plane, polygon[v]);
+                inside = inside && distance[v] >= 0.f;
+            }
+            if (inside) continue;
+
+            uint32_t kept = 0;
+            for (uint32_t v = 0; v < corners; ++v) {
+                const uint32_t next = (v + 1) % corners;
+                if (distance[v] >= 0.f) clipped[kept++] = polygon[v];
+                if ((distance[v] >= 0.f) != (distance[next] >= 0.f)) {
+                    const float s = distance[v] / (distance[v] - distance[next]);
+                    clipped[kept++] = polygon[v] + s * (polygon[next] - polygon[v]);
+                }
+            }
+            polygon = clipped;
+            corners = kept;
+        }
+        batch.Clear();
+        for (uint32_t k = 2; k < corners; ++k) add(polygon[0], polygon[k - 1], polygon[k]);
+    }
+}
+
+float ShadowMaps::Visibility(size_t light, glm::vec3 pos) const {
+    if (light >= this->cubes.size()) return 1.f;
+    const Cube& cube = this->cubes[light];
+    const uint32_t face = FaceOf(pos - cube.center);
+
+    const glm::vec4 clip = cube.viewProjection[face] * glm::vec4(pos, 1.f);
+    const float distance = clip.w;   // along the face axis
+    if (!(distance > SHADOW_NEAR && distance < SHADOW_FAR)) return 1.f;
+
+    // a texel spans 2 * distance / size on the face plane at this distance; the biased receiver depth is moved to
+    //     NDC once, so every tap is a single float compare
+    const float texelsPerUnit = static_cast<float>(this->size) / (2.f * distance);
+    const float bias = SHADOW_BIAS_TEXELS / texelsPerUnit;
+    const float threshold = NdcDepth(distance - bias);
+    const float u = clip.x / distance, v = clip.y / distance;
+    const ImageGrey& map = cube.faces[face];
+
+    switch (this->filter.filter) {
+    case ShadowFilter::PCF: return this->FilterBox(map, u, v, threshold);
+    case ShadowFilter::POISSON:
+        return this->FilterPoisson(map, u, v, static_cast<float>(this->filter.kernel) / 2.f, threshold);
+    case ShadowFilter::PCSS: {
+        // blockers that can hide part of the light are within the light's width of the receiver's texel
+        const float minRadius = static_cast<float>(this->filter.kernel) / 2.f;
+        const float searchRadius =
+            std::clamp(this->filter.lightSize * texelsPerUnit, minRadius, SHADOW_PCSS_MAX_RADIUS);
+        const float blocker = this->SearchBlockers(map, u, v, searchRadius, threshold);
+        if (blocker == 0.f) return 1.f;
+        // similar triangles: the penumbra grows with the receiver's distance behind the blocker
+        const float penumbra = this->filter.lightSize * (distance - blocker) / blocker;
+        const float radius = std::clamp(penumbra * texelsPerUnit, minRadius, SHADOW_PCSS_MAX_RADIUS);
+        return this->FilterPoisson(map, u, v, radius, threshold);
+    }
+    default: {
+        const int32_t last = static_cast<int32_t>(this->size) - 1;
+        const uint32_t x = static_cast<uint32_t>(std::clamp(static_cast<int32_t>(u), 0, last));
+        const uint32_t y = static_cast<uint32_t>(std::clamp(static_cast<int32_t>(v), 0, last));
+        return map(x, y) >= threshold ? 1.f : 0.f;
+    }
+    }
+}
+
+float ShadowMaps::FilterBox(const ImageGrey& map, float u, float v, float threshold) const {
+    const int32_t kernel = static_cast<int32_t>(this->filter.kernel), size = static_cast<int32_t>(this->size);
+    const int32_t x0 = static_cast<int32_t>(std::floor(u)) - kernel / 2;
+    const int32_t y0 = static_cast<int32_t>(std::floor(v)) - kernel / 2;
+
+    int32_t lit = 0;
+    if (x0 >= 0 && y0 >= 0 && x0 + static_cast<int32_t>(SHADOW_PCF_LANES) <= size && y0 + kernel <= size) {
+        // whole rows of lanes, so the compares are a fixed-length loop; lanes past the kernel are dropped at the end
+        std::array<int32_t, SHADOW_PCF_LANES> lanes {};
+        for (int32_t j = 0; j < kernel; ++j) {
+            const float* depths = map.Row(static_cast<uint32_t>(y0 + j)) + x0;
+            for (uint32_t i = 0; i != SHADOW_PCF_LANES; ++i) lanes[i] += static_cast<int32_t>(depths[i] >= threshold);
+        }
+        for (int32_t i = 0; i < kernel; ++i) lit += lanes[i];
+    } else {
+        // at the face borders the taps are clamped to the face
+        for (int32_t j = 0; j < kernel; ++j) {
+            const float* depths = map.Row(static_cast<uint32_t>(std::clamp(y0 + j, 0, size - 1)));
+            for (int32_t i = 0; i < kernel; ++i) lit += depths[std::clamp(x0 + i, 0, size - 1)] >= threshold;
+        }
+    }
+    return static_cast<float>(lit) / static_cast<float>(kernel * kernel);
+}
+
+float ShadowMaps::FilterPoisson(const ImageGrey& map, float u, float v, float radius, float threshold) const {
+    const glm::vec2 rotation = DiskRotation(u, v) * radius;
+    std::array<uint32_t, SHADOW_POISSON_TAPS> x, y;
+    TapPositions(u, v, rotation, this->size, x, y);
+    int32_t lit = 0;
+    for (uint32_t t = 0; t != SHADOW_POISSON_TAPS; ++t) lit += map(x[t], y[t]) >= threshold;
+    return static_cast<float>(lit) / static_cast<float>(SHADOW_POISSON_TAPS);
+}
+
+float ShadowMaps::SearchBlockers(const ImageGrey& map, float u, float v, float radius, float threshold) const {
+    const glm::vec2 rotation = DiskRotation(u, v) * radius;
+    std::array<uint32_t, SHADOW_POISSON_TAPS> x, y;
+    TapPositions(u, v, rotation, this->size, x, y);
+    float sum = 0.f;
+    uint32_t count = 0;
+    for (uint32_t t = 0; t != SHADOW_POISSON_TAPS; ++t) {
+        const float depth = map(x[t], y[t]);
+        if (depth < threshold) {
+            sum += LinearDepth(depth);
+            ++count;
+        }
+    }
+    return count == 0 ? 0.f : sum / static_cast<float>(count);
+}
@@ -0,0 +1,102 @@
+// Shadow maps for the point lights: a cube of depth faces per light, rendered with the depth-only triangle setup
+
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
+
+#include "../thirdparty/glm/glm.hpp"
+#include "arena.hpp"
+#include "entities.hpp"
+#include "image.hpp"
+
+constexpr uint32_t SHADOW_FACES = 6;   // +X, -X, +Y, -Y, +Z, -Z
+constexpr float SHADOW_NEAR = 0.01f;
+constexpr float SHADOW_FAR = 1000.f;
+// Depth bias in texels at the receiver's distance, against self-shadowing from the depth quantization
+constexpr float SHADOW_BIAS_TEXELS = 2.f;
+
+// How Visibility turns depth compares into a light fraction
+enum class ShadowFilter {
+    HARD,      // one compare: fully lit or fully shadowed
+    PCF,       // average of a kernel x kernel box of compares around the texel
+    POISSON,   // SHADOW_POISSON_TAPS compares on a rotated Poisson disk of radius kernel / 2
+    PCSS       // Poisson taps whose radius follows the blocker distance and the light size (contact-hardening)
+};
+
+struct ShadowFilterOptions {
+    ShadowFilter filter = ShadowFilter::HARD;
+    uint32_t kernel = 5;       // odd, at most SHADOW_MAX_KERNEL texels
+    float lightSize = 0.1f;    // world-space width of the lights, for PCSS penumbrae
+};
+
+// Box kernels are evaluated a row at a time over this many lanes, which the compiler vectorizes
+constexpr uint32_t SHADOW_PCF_LANES = 16;
+constexpr uint32_t SHADOW_MAX_KERNEL = SHADOW_PCF_LANES - 1;
+constexpr uint32_t SHADOW_POISSON_TAPS = 16;
+// PCSS radii are clamped to this many texels
+constexpr float SHADOW_PCSS_MAX_RADIUS = 16.f;
+
+// One shape as seen by the shadow maps: shapes with the same key cast the same shadows (same mesh, same transform)
+struct ShadowCaster {
+    uint64_t key;
+    glm::vec3 boundsMin, boundsMax;   // world space
+};
+
+// What an Update did, counted in cube faces
+struct ShadowUpdate {
+    size_t facesRendered = 0;
+    size_t facesReused = 0;
+};
+
+class ShadowMaps {
+public:
+    // Bring a size x size cube for each light up to date with the casters. Faces are kept from the previous Update
+    //     unless their light moved, the size changed, or a caster that was added, removed or moved has its old or
+    //     new bounds in the face's frustum. Only when some face is to be rendered, `triangles` is called to append
+    //     the caster triangles as world-space vertices, three per triangle. The faces to render are independent and
+    //     rendered in parallel (see parallel.hpp); triangles are clipped to a face's near plane and guard band.
+    ShadowUpdate Update(const std::vector<Light>& lights, const std::vector<ShadowCaster>& casters, uint32_t size,
+                        const std::function<void(std::vector<glm::vec3>&)>& triangles);
+
+    inline bool Empty() const { return this->cubes.empty(); }
+    inline size_t LightCount() const { return this->cubes.size(); }
+    inline uint32_t GetSize() const { return this->size; }
+
+    inline void SetFilter(const ShadowFilterOptions& options) { this->filter = options; }
+
+    // Fraction of light `light` that reaches `pos` (world space), from 0 in full shadow to 1, filtered as set by
+    //     SetFilter. Positions beyond SHADOW_FAR and lights without a map are lit.
+    float Visibility(size_t light, glm::vec3 pos) const;
+
+    // Face `face` of the cube of light `light`: NDC depth of the closest caster per texel, 1 where there is none
+    inline const ImageGrey& Face(size_t light, uint32_t face) const { return this->cubes[light].faces[face]; }
+
+private:
+    struct Cube {
+        uint32_t size = 0;   // 0 until the faces were placed for a light
+        glm::vec3 center;
+        std::array<glm::mat4, SHADOW_FACES> viewProjection;   // world to texel coordinates, depth in NDC
+        std::array<ImageGrey, SHADOW_FACES> faces;
+        std::array<bool, SHADOW_FACES> valid {};
+    };
+
+    void RenderFace(Cube& cube, uint32_t face, std::span<const glm::vec3> triangles, Arena& arena);
+
+    // Filters over one face around texel position (u, v); a tap is lit when its stored depth is at least `threshold`
+    float FilterBox(const ImageGrey& map, float u, float v, float threshold) const;
+    float FilterPoisson(const ImageGrey& map, float u, float v, float radius, float threshold) const;
+    // Mean linear depth of the taps closer than `threshold` within `radius`, or 0 if there is none
+    float SearchBlockers(const ImageGrey& map, float u, float v, float radius, float threshold) const;
+
+    std::vector<Cube> cubes;
+    std::vector<ShadowCaster> casters;   // of the last Update
+    uint32_t size = 0;
+    ShadowFilterOptions filter;
+};
+
+#endif
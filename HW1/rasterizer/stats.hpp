@@ -0,0 +1,102 @@
+// Counters and timings collected while rendering a frame
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <array>
+#include <cstddef>
+#include <string>
+
+#include "entities.hpp"
+#include "lod.hpp"
+
+struct RenderStats {
+    std::string pipeline = "none";   // raster passes chosen for the frame, see `Rasterizer::SelectPipeline`
+    size_t trianglesSubmitted = 0;
+    size_t trianglesSetUp = 0;   // survived culling and reached the raster stage
+    size_t stampTriangles = 0;   // of those, handled by the small-triangle stamp path
+    size_t instances = 0;         // shape copies of the config's `instances`
+    size_t instancesCulled = 0;   // of those, dropped off-screen before their vertices were transformed
+    uint32_t lodLevels = 0;                       // coarser levels per shape, 0 when levels of detail are off
+    std::array<size_t, MAX_LODS + 1> lodDraws {};   // shapes and instances drawn at each level, finest first
+    size_t trianglesFullDetail = 0;               // what `trianglesSubmitted` would be without levels of detail
+    size_t clusters = 0;             // tested, over all draws
+    size_t clustersOffScreen = 0;    // of those, culled by the screen bounds,
+    size_t clustersBackFacing = 0;   //     by their normal cone
+    size_t clustersOccluded = 0;     //     and by the occlusion buffer
+    size_t lights = 0;
+    size_t boundedLights = 0;         // with a radius, culled through the light grid
+    size_t shadowMaps = 0;            // lights with a cube shadow map
+    size_t shadowFacesRendered = 0;   // cube faces drawn this frame
+    size_t shadowFacesReused = 0;     // cube faces kept from the previous frame
+    double shadowMs = 0;              // updating all cubes, in parallel
+    double configMs = 0;   // parsing the config, before the frame; 0 for scenes built in memory
+    double modelMs = 0;    // loading its OBJ file
+    size_t arenaPeakBytes = 0;
+    size_t outputQueueDepth = 0;   // earlier frames still being written when this one was handed to the writer
+    double renderMs = 0;           // up to the hand-off, encoding is not included
+
+    inline double ShadowHitRate() const {
+        const size_t faces = shadowFacesRendered + shadowFacesReused;
+        return faces == 0 ? 0.0 : static_cast<double>(shadowFacesReused) / faces;
+    }
+
+    inline std::string ClusterInfo() const {
+        const size_t culled = clustersOffScreen + clustersBackFacing + clustersOccluded;
+        return "Clusters: " + std::to_string(clusters) + " tested, " + std::to_string(clustersOffScreen)
+             + " off-screen, " + std::to_string(clustersBackFacing) + " facing away, "
+             + std::to_string(clustersOccluded) + " occluded (" + ToStr(100.0 * culled / clusters, 1)
+             + "% culled)\n";
+    }
+
+    inline std::string LodInfo() const {
+        std::string draws;
+        for (uint32_t level = 0; level <= lodLevels; ++level)
+            draws += (level == 0 ? "" : " / ") + std::to_string(lodDraws[level]);
+        return "Levels of detail: " + draws + " draws by level, " + std::to_string(trianglesSubmitted) + " of "
+             + std::to_string(trianglesFullDetail) + " full-detail triangles submitted\n";
+    }
+
+    inline std::string Info() const {
+        return "Pipeline: " + pipeline + "\n" + "Triangles submitted: " + std::to_string(trianglesSubmitted) + "\n"
+             + "Triangles set up: " + std::to_string(trianglesSetUp) + " (" + std::to_string(stampTriangles)
+             + " as stamps)\n"
+             + (instances == 0 ? ""
+                               : "Instances: " + std::to_string(instances) + " (" + std::to_string(instancesCulled)
+                                     + " culled)\n")
+             + (lodLevels == 0 ? "" : LodInfo())
+             + (clusters == 0 ? "" : ClusterInfo())
+             + (lights == 0 ? ""
+                            : "Lights: " + std::to_string(lights) + " (" + std::to_string(boundedLights)
+                                  + " bounded)\n")
+             + (shadowMaps == 0 ? "" : "Shadow maps: " + std::to_string(shadowMaps) + " cubes in " + ToStr(shadowMs, 2)
+                                             + " ms, " + std::to_string(shadowFacesReused) + " of "
+                                             + std::to_string(shadowFacesRendered + shadowFacesReused)
+                                             + " faces cached (" + ToStr(ShadowHitRate() * 100.0, 1) + "%)\n")
+             + "Load time: " + ToStr(configMs, 2) + " ms config, " + ToStr(modelMs, 2) + " ms model\n"
+             + "Frame arena peak: " + ToStr(arenaPeakBytes / 1024.0, 1) + " KiB\n"
+             + "Render time: " + ToStr(renderMs, 2) + " ms\n"
+             + "Output queue: " + std::to_string(outputQueueDepth) + " frames ahead\n";
+    }
+};
+
+// Totals of the background writer over all frames, see `AsyncWriter`
+struct WriterStats {
+    size_t imagesWritten = 0;
+    size_t imagesFailed = 0;    // frames that never reached their file or stream
+    size_t maxQueueDepth = 0;   // frames queued or being written at once, the newest included
+    double encodeMs = 0;        // summed over images
+    double maxEncodeMs = 0;
+    double blockedMs = 0;       // time the renderer waited for room in the queue
+
+    inline std::string Info() const {
+        const double meanMs = imagesWritten + imagesFailed == 0 ? 0 : encodeMs / (imagesWritten + imagesFailed);
+        return "Images written: " + std::to_string(imagesWritten) + "\n"
+             + (imagesFailed != 0 ? "Images failed: " + std::to_string(imagesFailed) + "\n" : "")
+             + "Max queue depth: " + std::to_string(maxQueueDepth) + "\n"
+             + "Encode time: " + ToStr(meanMs, 2) + " ms mean, " + ToStr(maxEncodeMs, 2) + " ms max\n"
+             + "Renderer blocked: " + ToStr(blockedMs, 2) + " ms\n";
+    }
+};
+
+#endif
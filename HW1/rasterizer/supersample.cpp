@@ -0,0 +1,85 @@
+#include "supersample.hpp"
+
+#include <cmath>
+
+uint32_t SamplesPerSide(uint32_t spp) {
+    const uint32_t n = static_cast<uint32_t>(std::lround(std::sqrt(static_cast<double>(spp))));
+    return std::clamp(n, 1u, MAX_SAMPLES_PER_SIDE);
+}
+
+SampleTile::SampleTile(uint32_t samplesPerSide)
+    : n(samplesPerSide)
+    , pixels { 1, 0, 1, 0 }
+    , samples { 1, 0, 1, 0 }
+    , buffer((SUPERSAMPLE_TILE + 2) * samplesPerSide, (SUPERSAMPLE_TILE + 2) * samplesPerSide, NoInit {}) {
+    // sample k of the 3n around a pixel is (k + 0.5 - 1.5n) / n pixels away from the pixel's center
+    for (uint32_t k = 0; k != 3 * this->n; ++k) {
+        const float distance = std::abs((static_cast<float>(k) + 0.5f - 1.5f * this->n) / this->n);
+        this->tentWeights.push_back(std::max(1.f - distance, 0.f));
+    }
+}
+
+void SampleTile::Begin(const PixelBounds& pixels, uint32_t width, uint32_t height, bool apron,
+                       const ColorHDR& background) {
+    const uint32_t reach = apron ? this->n : 0;
+    this->pixels = pixels;
+    this->samples.xmin = pixels.xmin * this->n - std::min(pixels.xmin * this->n, reach);
+    this->samples.ymin = pixels.ymin * this->n - std::min(pixels.ymin * this->n, reach);
+    this->samples.xmax = std::min((pixels.xmax + 1) * this->n - 1 + reach, width * this->n - 1);
+    this->samples.ymax = std::min((pixels.ymax + 1) * this->n - 1 + reach, height * this->n - 1);
+
+    const uint32_t rowLength = this->samples.xmax - this->samples.xmin + 1;
+    for (uint32_t y = 0; y <= this->samples.ymax - this->samples.ymin; ++y)
+        std::fill_n(this->buffer.Row(y), rowLength, background);
+}
+
+void SampleTile::Resolve(SSAAFilter filter, ImageHDR& image) const {
+    if (filter == SSAAFilter::TENT)
+        this->ResolveTent(image);
+    else
+        this->ResolveBox(image);
+}
+
+void SampleTile::ResolveBox(ImageHDR& image) const {
+    const float scale = 1.f / static_cast<float>(this->n * this->n);
+    for (uint32_t py = this->pixels.ymin; py <= this->pixels.ymax; ++py) {
+        ColorHDR* row = image.Row(py);
+        for (uint32_t px = this->pixels.xmin; px <= this->pixels.xmax; ++px) {
+            const uint32_t column = px * this->n - this->samples.xmin;
+            ColorHDR sum(0.f);
+            for (uint32_t sy = py * this->n; sy != (py + 1) * this->n; ++sy) {
+                const ColorHDR* samples = this->buffer.Row(sy - this->samples.ymin) + column;
+                for (uint32_t i = 0; i != this->n; ++i) sum += samples[i];
+            }
+            row[px] = sum * scale;
+        }
+    }
+}
+
+void SampleTile::ResolveTent(ImageHDR& image) const {
+    for (uint32_t py = this->pixels.ymin; py <= this->pixels.ymax; ++py) {
+        ColorHDR* row = image.Row(py);
+        // the tent reaches one pixel beyond this one, except where the screen ends
+        const uint32_t firstY = py * this->n - this->n;   // may wrap around; only used for differences
+        const uint32_t y0 = std::max(py * this->n - std::min(py * this->n, this->n), this->samples.ymin);
+        const uint32_t y1 = std::min(py * this->n + 2 * this->n - 1, this->samples.ymax);
+        for (uint32_t px = this->pixels.xmin; px <= this->pixels.xmax; ++px) {
+            const uint32_t firstX = px * this->n - this->n;
+            const uint32_t x0 = std::max(px * this->n - std::min(px * this->n, this->n), this->samples.xmin);
+            const uint32_t x1 = std::min(px * this->n + 2 * this->n - 1, this->samples.xmax);
+
+            ColorHDR sum(0.f);
+            float weightSum = 0.f;
+            for (uint32_t sy = y0; sy <= y1; ++sy) {
+                const ColorHDR* samples = this->buffer.Row(sy - this->samples.ymin);
+                const float weightY = this->tentWeights[sy - firstY];
+                for (uint32_t sx = x0; sx <= x1; ++sx) {
+                    const float weight = weightY * this->tentWeights[sx - firstX];
+                    sum += samples[sx - this->samples.xmin] * weight;
+                    weightSum += weight;
+                }
+            }
+            row[px] = sum / weightSum;
+        }
+    }
+}
@@ -0,0 +1,57 @@
+// Supersampled rendering for SSAA: triangles are rasterized into a grid of samples per pixel one screen tile at a
+//     time, and each tile is filtered down to pixels as soon as all of its triangles are drawn
+
+#ifndef SUPERSAMPLE_H
+#define SUPERSAMPLE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "image.hpp"
+#include "loader.hpp"
+#include "triangle_batch.hpp"
+
+// Pixels per side of a screen tile; tiles are the unit of parallel work
+constexpr uint32_t SUPERSAMPLE_TILE = 32;
+
+// Largest sample grid, 16 x 16 per pixel
+constexpr uint32_t MAX_SAMPLES_PER_SIDE = 16;
+
+// Samples are an n x n grid per pixel (a stratified pattern that the rasterizer covers exactly like pixels on an n
+//     times larger screen); `spp` is rounded to the nearest square
+uint32_t SamplesPerSide(uint32_t spp);
+
+// The samples of one tile, plus the samples of the pixels around it when the filter reaches into them
+class SampleTile {
+public:
+    explicit SampleTile(uint32_t samplesPerSide);
+
+    // Start the tile over the inclusive pixel range `pixels` of a width x height screen, with every sample set to
+    //     `background`. With `apron`, the samples of the surrounding pixels are stored too.
+    void Begin(const PixelBounds& pixels, uint32_t width, uint32_t height, bool apron, const ColorHDR& background);
+
+    // Inclusive range of screen samples stored by the tile
+    inline const PixelBounds& SampleBounds() const { return this->samples; }
+
+    // Set the screen samples [xBegin, xEnd] of row y, which must lie within SampleBounds()
+    inline void Fill(uint32_t y, uint32_t xBegin, uint32_t xEnd, const ColorHDR& color) {
+        ColorHDR* row = this->buffer.Row(y - this->samples.ymin);
+        std::fill(row + (xBegin - this->samples.xmin), row + (xEnd - this->samples.xmin) + 1, color);
+    }
+
+    // Filter the samples into the tile's pixels of `image`. BOX averages the pixel's own samples; TENT weights the
+    //     samples within one pixel of its center by (1 - |dx|)(1 - |dy|), which softens edges further.
+    void Resolve(SSAAFilter filter, ImageHDR& image) const;
+
+private:
+    void ResolveBox(ImageHDR& image) const;
+    void ResolveTent(ImageHDR& image) const;
+
+    uint32_t n;
+    PixelBounds pixels, samples;
+    ImageHDR buffer;                  // room for a full tile with its apron
+    std::vector<float> tentWeights;   // 1D tent weight of the sample k - n to the right of a pixel's first one
+};
+
+#endif
@@ -0,0 +1,167 @@
+#include "triangle_batch.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+PixelBounds ClampBounds(float xmin, float xmax, float ymin, float ymax, uint32_t width, uint32_t height) {
+    const float lastX = static_cast<float>(width) - 1.f;
+    const float lastY = static_cast<float>(height) - 1.f;
+    // written so that NaN coordinates also end up empty
+    if (!(xmax >= 0.f && ymax >= 0.f && xmin <= lastX && ymin <= lastY)) return { 1, 0, 1, 0 };
+
+    return { static_cast<uint32_t>(std::max(xmin, 0.f)), static_cast<uint32_t>(std::min(xmax, lastX)),
+             static_cast<uint32_t>(std::max(ymin, 0.f)), static_cast<uint32_t>(std::min(ymax, lastY)) };
+}
+
+namespace {
+
+// Plane through (x[i], y[i], f[i]); `area2` is twice the signed area of the triangle
+TriangleBatch::Plane SetupPlane(const std::array<double, 3>& x, const std::array<double, 3>& y,
+                                const std::array<double, 3>& f, double area2) {
+    double a = ((f[1] - f[0]) * (y[2] - y[0]) - (f[2] - f[0]) * (y[1] - y[0])) / area2;
+    double b = ((f[2] - f[0]) * (x[1] - x[0]) - (f[1] - f[0]) * (x[2] - x[0])) / area2;
+    double c = f[0] - a * x[0] - b * y[0];
+    return { static_cast<float>(a), static_cast<float>(b), static_cast<float>(c) };
+}
+
+// Edge through a -> b, positive on the left
+TriangleBatch::Edge SetupEdge(const glm::ivec2& a, const glm::ivec2& b) {
+    return { a.y - b.y, b.x - a.x, static_cast<int64_t>(a.x) * b.y - static_cast<int64_t>(a.y) * b.x };
+}
+
+// Which pixel centers of the STAMP_SIZE x STAMP_SIZE stamp at the box's top-left pixel have all three edges >= bias,
+//     limited to the box. Each edge is evaluated once at the anchor and offset per lane, so the lane loop is plain
+//     adds and compares that the compiler turns into a few vector instructions.
+uint16_t StampCoverage(const std::array<TriangleBatch::Edge, 3>& edge, const PixelBounds& box, bool conservative) {
+    constexpr uint32_t LANES = STAMP_SIZE * STAMP_SIZE;
+    const int64_t x0 = static_cast<int64_t>(box.xmin) * SUBPIXEL_ONE + SUBPIXEL_HALF;
+    const int64_t y0 = static_cast<int64_t>(box.ymin) * SUBPIXEL_ONE + SUBPIXEL_HALF;
+
+    std::array<int64_t, LANES> inside;
+    inside.fill(0);
+    for (const TriangleBatch::Edge& e : edge) {
+        const int64_t stepX = static_cast<int64_t>(e.a) * SUBPIXEL_ONE;
+        const int64_t stepY = static_cast<int64_t>(e.b) * SUBPIXEL_ONE;
+        int64_t base = e.At(x0, y0);
+        if (conservative) base += (std::abs(stepX) + std::abs(stepY)) / 2;
+        for (uint32_t lane = 0; lane != LANES; ++lane)
+            inside[lane] |= base + stepX * (lane % STAMP_SIZE) + stepY * (lane / STAMP_SIZE);
+    }
+
+    uint16_t mask = 0;
+    for (uint32_t lane = 0; lane != LANES; ++lane) mask |= static_cast<uint16_t>(inside[lane] >= 0) << lane;
+
+    // drop the lanes outside of the box
+    uint16_t row = static_cast<uint16_t>((1u << (box.xmax - box.xmin + 1)) - 1), boxMask = 0;
+    for (uint32_t y = 0; y <= box.ymax - box.ymin; ++y) boxMask |= row << (y * STAMP_SIZE);
+    return mask & boxMask;
+}
+
+}   // namespace
+
+void TriangleBatch::Reset(size_t capacity, uint32_t width, uint32_t height, Arena& arena, bool conservative,
+                          bool depthOnly) {
+    this->count = 0;
+    this->capacity = static_cast<uint32_t>(capacity);
+    this->width = width;
+    this->height = height;
+    this->conservative = conservative;
+    this->depthOnly = depthOnly;
+
+    this->bounds = arena.AllocateArray<PixelBounds>(capacity);
+    this->stampMasks = arena.AllocateArray<uint16_t>(capacity);
+    for (auto& column : this->vertices) column = arena.AllocateArray<glm::ivec2>(capacity);
+    for (auto& column : this->edges) column = arena.AllocateArray<Edge>(capacity);
+    this->depth = arena.AllocateArray<Plane>(capacity);
+    if (depthOnly) {
+        this->invW = {};
+        for (auto& column : this->planes) column = {};
+        return;
+    }
+    this->invW = arena.AllocateArray<Plane>(capacity);
+    for (auto& column : this->planes) column = arena.AllocateArray<Plane>(capacity);
+}
+
+bool TriangleBatch::Add(const Triangle& transformed, const Triangle& original) {
+    if (this->count == this->capacity) return false;
+
+    std::array<float, 3> invW;
+    std::array<glm::vec3, 3> screen;
+    for (int v = 0; v != 3; ++v) {
+        const glm::vec4& p = transformed.pos[v];
+        if (p.w == 0.f) return false;
+        invW[v] = 1.f / p.w;
+        screen[v] = glm::vec3(p) * invW[v];
+        if (!(std::abs(screen[v].x) < GUARD_BAND && std::abs(screen[v].y) < GUARD_BAND)) return false;
+    }
+
+    // snap to the subpixel grid; everything below is derived from the snapped positions
+    std::array<glm::ivec2, 3> fixed;
+    std::array<double, 3> x, y;
+    for (int v = 0; v != 3; ++v) {
+        fixed[v] = glm::ivec2(std::lround(screen[v].x * SUBPIXEL_ONE), std::lround(screen[v].y * SUBPIXEL_ONE));
+        x[v] = static_cast<double>(fixed[v].x) / SUBPIXEL_ONE;
+        y[v] = static_cast<double>(fixed[v].y) / SUBPIXEL_ONE;
+    }
+
+    std::array<Edge, 3> edge = { SetupEdge(fixed[1], fixed[2]), SetupEdge(fixed[2], fixed[0]),
+                                 SetupEdge(fixed[0], fixed[1]) };
+    int64_t area2 = edge[0].At(fixed[0].x, fixed[0].y);
+    if (area2 == 0) return false;
+    if (area2 < 0)
+        for (Edge& e : edge) e = { -e.a, -e.b, -e.c };
+    for (Edge& e : edge)
+        if (!(e.a > 0 || (e.a == 0 && e.b > 0))) e.c -= 1;   // exclusive unless left or top
+
+    PixelBounds box = ClampBounds(std::min({ screen[0].x, screen[1].x, screen[2].x }),
+                                  std::max({ screen[0].x, screen[1].x, screen[2].x }),
+                                  std::min({ screen[0].y, screen[1].y, screen[2].y }),
+                                  std::max({ screen[0].y, screen[1].y, screen[2].y }), this->width, this->height);
+    if (box.Empty()) return false;
+
+    // small triangles that miss every pixel are dropped here, which on dense meshes is most of them
+    uint16_t stampMask = 0;
+    if (box.FitsStamp()) {
+        stampMask = StampCoverage(edge, box, false);
+        if (stampMask == 0 && !(this->conservative && StampCoverage(edge, box, true) != 0)) return false;
+    }
+
+    // planes are set up in pixel units, with the orientation of the snapped vertices
+    double pixelArea2 = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+
+    const uint32_t i = this->count++;
+    this->bounds[i] = box;
+    this->stampMasks[i] = stampMask;
+    for (int v = 0; v != 3; ++v) this->vertices[v][i] = fixed[v];
+    for (int e = 0; e != 3; ++e) this->edges[e][i] = edge[e];
+
+    this->depth[i] = SetupPlane(x, y, { screen[0].z, screen[1].z, screen[2].z }, pixelArea2);
+    if (this->depthOnly) return true;
+    this->invW[i] = SetupPlane(x, y, { invW[0], invW[1], invW[2] }, pixelArea2);
+
+    auto setupAttribute = [&](Attribute attribute, float f0, float f1, float f2) {
+        this->planes[attribute][i] = SetupPlane(x, y, { f0 * invW[0], f1 * invW[1], f2 * invW[2] }, pixelArea2);
+    };
+    for (int k = 0; k != 3; ++k) {
+        setupAttribute(static_cast<Attribute>(POS_X + k), original.pos[0][k], original.pos[1][k], original.pos[2][k]);
+        setupAttribute(static_cast<Attribute>(NORMAL_X + k), original.normal[0][k], original.normal[1][k],
+                       original.normal[2][k]);
+    }
+    for (int k = 0; k != 2; ++k)
+        setupAttribute(static_cast<Attribute>(TEX_U + k), original.tex_coord[0][k], original.tex_coord[1][k],
+                       original.tex_coord[2][k]);
+    return true;
+}
+
+Fragment TriangleBatch::Interpolate(uint32_t index, float x, float y) const {
+    float w = 1.f / this->invW[index].At(x, y);
+    auto at = [&](Attribute attribute) { return this->planes[attribute][index].At(x, y) * w; };
+
+    Fragment fragment;
+    fragment.depth = this->depth[index].At(x, y);
+    fragment.pos = glm::vec3(at(POS_X), at(POS_Y), at(POS_Z));
+    fragment.normal = glm::vec3(at(NORMAL_X), at(NORMAL_Y), at(NORMAL_Z));
+    fragment.tex_coord = glm::vec2(at(TEX_U), at(TEX_V));
+    return fragment;
+}
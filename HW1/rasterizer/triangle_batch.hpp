@@ -0,0 +1,136 @@
+// Packed triangle setup for the raster stage, stored structure-of-arrays
+
+#ifndef TRIANGLE_BATCH_H
+#define TRIANGLE_BATCH_H
+
+#include <cmath>
+#include <cstdint>
+#include <span>
+
+#include "../thirdparty/glm/glm.hpp"
+#include "arena.hpp"
+#include "entities.hpp"
+
+// Screen positions are snapped to 1/2^SUBPIXEL_BITS of a pixel before edge setup (28.4 fixed point by default);
+//     compile with -DRASTER_SUBPIXEL_BITS=<n> to change the precision
+#ifndef RASTER_SUBPIXEL_BITS
+#define RASTER_SUBPIXEL_BITS 4
+#endif
+constexpr int32_t SUBPIXEL_BITS = RASTER_SUBPIXEL_BITS;
+constexpr int32_t SUBPIXEL_ONE = 1 << SUBPIXEL_BITS;
+constexpr int32_t SUBPIXEL_HALF = SUBPIXEL_ONE / 2;
+static_assert(SUBPIXEL_BITS >= 1 && SUBPIXEL_BITS <= 12, "unsupported subpixel precision");
+
+// Triangles reaching further than this many pixels from the origin are rejected instead of overflowing the
+//     fixed-point edge functions (there is no clipper yet); snapped coordinates then stay within 2^26
+constexpr float GUARD_BAND = static_cast<float>(1 << (26 - SUBPIXEL_BITS));
+
+// Triangles whose clamped box fits in STAMP_SIZE x STAMP_SIZE pixels get their exact coverage computed once at
+//     setup, as a bit mask over the stamp anchored at the box's top-left pixel
+constexpr uint32_t STAMP_SIZE = 4;
+
+// Inclusive pixel range, already clamped to the screen
+struct PixelBounds {
+    uint32_t xmin, xmax;
+    uint32_t ymin, ymax;
+
+    inline bool Empty() const { return xmin > xmax || ymin > ymax; }
+    inline bool FitsStamp() const { return xmax - xmin < STAMP_SIZE && ymax - ymin < STAMP_SIZE; }
+};
+
+// Clamp a floating-point box to a width x height screen; NaN or off-screen boxes come back empty
+PixelBounds ClampBounds(float xmin, float xmax, float ymin, float ymax, uint32_t width, uint32_t height);
+
+// Everything the per-pixel stage needs at one position of a triangle
+struct Fragment {
+    float depth;
+    glm::vec3 pos;      // world space
+    glm::vec3 normal;   // world space, not normalized
+    glm::vec2 tex_coord;
+};
+
+class TriangleBatch {
+public:
+    // Attributes interpolated perspective-correctly: each one is stored as a screen-space plane of attribute / w
+    enum Attribute { POS_X, POS_Y, POS_Z, NORMAL_X, NORMAL_Y, NORMAL_Z, TEX_U, TEX_V, ATTRIBUTE_COUNT };
+
+    // f(x, y) = a * x + b * y + c over screen pixels
+    struct Plane {
+        float a, b, c;
+
+        inline float At(float x, float y) const { return a * x + b * y + c; }
+    };
+
+    // E(X, Y) = a * X + b * Y + c over fixed-point positions; >= 0 exactly for the positions the triangle owns.
+    //     The top-left fill rule is folded into c: a position on an edge belongs to the triangle only if the edge is
+    //     a left edge, or a top edge (lowest row in memory order) when horizontal. Two triangles sharing an edge
+    //     therefore never both own a sample on it, and never both miss one.
+    struct Edge {
+        int32_t a, b;
+        int64_t c;
+
+        inline int64_t At(int64_t x, int64_t y) const { return a * x + b * y + c; }
+    };
+
+    // Allocate room for `capacity` triangles from `arena`, dropping the previous contents. With `conservative`,
+    //     small triangles are kept as long as they touch a pixel (MSAA); otherwise they must own a pixel center.
+    //     With `depthOnly`, only coverage and depth are set up (`original` is ignored by Add, and Interpolate must
+    //     not be called), for passes such as shadow maps that write nothing else.
+    void Reset(size_t capacity, uint32_t width, uint32_t height, Arena& arena, bool conservative = false,
+               bool depthOnly = false);
+
+    // Set up a triangle from its clip-space positions (`transformed`, before the perspective divide) and its
+    //     model-space attributes (`original`). Degenerate, off-screen and guard-band-crossing triangles are not added,
+    //     and neither are stamp-sized triangles that miss every pixel; both are rejected before any attribute setup.
+    bool Add(const Triangle& transformed, const Triangle& original);
+
+    // Drop the triangles but keep the storage, for a batch that is filled and drained several times
+    inline void Clear() { this->count = 0; }
+
+    inline uint32_t Size() const { return this->count; }
+
+    inline const PixelBounds& Bounds(uint32_t index) const { return this->bounds[index]; }
+    inline const glm::ivec2& Vertex(uint32_t index, int v) const { return this->vertices[v][index]; }
+    inline const Edge& GetEdge(uint32_t index, int e) const { return this->edges[e][index]; }
+
+    // Owned pixel centers of a triangle whose bounds fit the stamp: bit y * STAMP_SIZE + x is pixel
+    //     (xmin + x, ymin + y). Zero for larger triangles.
+    inline uint16_t StampMask(uint32_t index) const { return this->stampMasks[index]; }
+
+    // Whether the screen position (x, y) (in pixels, e.g. a pixel center) is owned by the triangle
+    inline bool Covers(uint32_t index, float x, float y) const {
+        return this->CoversFixed(index, std::lround(x * SUBPIXEL_ONE), std::lround(y * SUBPIXEL_ONE));
+    }
+    inline bool CoversFixed(uint32_t index, int64_t x, int64_t y) const {
+        return (this->edges[0][index].At(x, y) | this->edges[1][index].At(x, y) | this->edges[2][index].At(x, y))
+            >= 0;
+    }
+
+    // Depth after the perspective divide, linear in screen space
+    inline float Depth(uint32_t index, float x, float y) const { return this->depth[index].At(x, y); }
+    // 1 / w, also linear in screen space; only set up without `depthOnly`
+    inline const Plane& InverseW(uint32_t index) const { return this->invW[index]; }
+
+    inline float Interpolate(uint32_t index, Attribute attribute, float x, float y) const {
+        return this->planes[attribute][index].At(x, y) / this->invW[index].At(x, y);
+    }
+
+    Fragment Interpolate(uint32_t index, float x, float y) const;
+
+private:
+    uint32_t count = 0;
+    uint32_t capacity = 0;
+    uint32_t width = 0, height = 0;
+    bool conservative = false;
+    bool depthOnly = false;
+
+    std::span<PixelBounds> bounds;
+    std::span<uint16_t> stampMasks;
+    std::span<glm::ivec2> vertices[3];   // fixed-point screen positions
+    std::span<Edge> edges[3];            // edge e is opposite to vertex e
+    std::span<Plane> depth;
+    std::span<Plane> invW;
+    std::span<Plane> planes[ATTRIBUTE_COUNT];
+};
+
+#endif
@@ -0,0 +1,311 @@
+#include "virtual_texture.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include "../thirdparty/stb/stb_image.h"
+
+namespace {
+
+const char VTEX_MAGIC[4] = { 'V', 'T', 'X', '1' };
+
+inline Color TexelFromBytes(const unsigned char* bytes) {
+    Color texel;
+    texel.r = bytes[0];
+    texel.g = bytes[1];
+    texel.b = bytes[2];
+    texel.a = bytes[3];
+    return texel;
+}
+
+// 2x2 box filter; odd sizes clamp the last row/column
+std::vector<Color> Downsample(const std::vector<Color>& src, uint32_t width, uint32_t height, uint32_t newWidth,
+                              uint32_t newHeight) {
+    std::vector<Color> dst(static_cast<size_t>(newWidth) * newHeight);
+    for (uint32_t y = 0; y != newHeight; ++y) {
+        for (uint32_t x = 0; x != newWidth; ++x) {
+            uint32_t x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+            uint32_t y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+            const Color* quad[4] = { &src[y0 * width + x0], &src[y0 * width + x1], &src[y1 * width + x0],
+                                     &src[y1 * width + x1] };
+            uint32_t sum[4] = { 0, 0, 0, 0 };
+            for (const Color* c : quad) {
+                sum[0] += c->r;
+                sum[1] += c->g;
+                sum[2] += c->b;
+                sum[3] += c->a;
+            }
+            Color& out = dst[static_cast<size_t>(y) * newWidth + x];
+            out.r = static_cast<unsigned char>((sum[0] + 2) / 4);
+            out.g = static_cast<unsigned char>((sum[1] + 2) / 4);
+            out.b = static_cast<unsigned char>((sum[2] + 2) / 4);
+            out.a = static_cast<unsigned char>((sum[3] + 2) / 4);
+        }
+    }
+    return dst;
+}
+
+}   // namespace
+
+bool VirtualTexture::Bake(const std::string& image_file, const std::string& output_file, uint32_t tileSize) {
+    int width, height, nrChannels;
+    unsigned char* img = stbi_load(image_file.c_str(), &width, &height, &nrChannels, 4);
+    if (!img) {
+        std::cerr << "Reading texture " << image_file << " failed." << std::endl;
+        return false;
+    }
+    if (tileSize < VTEX_MIN_TILE || tileSize > VTEX_MAX_TILE || (tileSize & (tileSize - 1)) != 0) tileSize = 128;
+
+    // flip so that row 0 is the bottom row of the image
+    std::vector<Color> level(static_cast<size_t>(width) * height);
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+            level[static_cast<size_t>(y) * width + x] = TexelFromBytes(&img[((height - 1 - y) * width + x) * 4]);
+    stbi_image_free(img);
+
+    FileHeader header;
+    std::memcpy(header.magic, VTEX_MAGIC, sizeof(VTEX_MAGIC));
+    header.width = width;
+    header.height = height;
+    header.tileSize = tileSize;
+
+    // halve until the whole level fits in a single tile
+    std::vector<LevelInfo> levels;
+    uint32_t levelWidth = width, levelHeight = height;
+    while (true) {
+        levels.push_back({ levelWidth, levelHeight, (levelWidth + tileSize - 1) / tileSize,
+                           (levelHeight + tileSize - 1) / tileSize, 0 });
+        if (levelWidth <= tileSize && levelHeight <= tileSize) break;
+        levelWidth = std::max(1u, levelWidth / 2);
+        levelHeight = std::max(1u, levelHeight / 2);
+    }
+    header.levelCount = levels.size();
+
+    const uint64_t tileBytes = static_cast<uint64_t>(tileSize) * tileSize * sizeof(Color);
+    uint64_t offset = sizeof(FileHeader) + levels.size() * sizeof(LevelInfo);
+    for (LevelInfo& info : levels) {
+        info.offset = offset;
+        offset += static_cast<uint64_t>(info.tilesX) * info.tilesY * tileBytes;
+    }
+
+    std::ofstream out(output_file, std::ios::binary);
+    if (!out) {
+        std::cerr << "Writing to " << output_file << " failed." << std::endl;
+        return false;
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(levels.data()), levels.size() * sizeof(LevelInfo));
+
+    std::vector<Color> tile(static_cast<size_t>(tileSize) * tileSize);
+    for (size_t l = 0; l != levels.size(); ++l) {
+        const LevelInfo& info = levels[l];
+        for (uint32_t ty = 0; ty != info.tilesY; ++ty) {
+            for (uint32_t tx = 0; tx != info.tilesX; ++tx) {
+                for (uint32_t row = 0; row != tileSize; ++row) {
+                    uint32_t y = std::min(ty * tileSize + row, info.height - 1);
+                    for (uint32_t col = 0; col != tileSize; ++col) {
+                        uint32_t x = std::min(tx * tileSize + col, info.width - 1);
+                        tile[row * tileSize + col] = level[static_cast<size_t>(y) * info.width + x];
+                    }
+                }
+                out.write(reinterpret_cast<const char*>(tile.data()), tileBytes);
+            }
+        }
+        if (l + 1 != levels.size())
+            level = Downsample(level, info.width, info.height, levels[l + 1].width, levels[l + 1].height);
+    }
+
+    std::cout << "Baked " << image_file << " into " << levels.size() << " levels of " << tileSize << "x" << tileSize
+              << " tiles at " << output_file << "\n";
+    return static_cast<bool>(out);
+}
+
+VirtualTexture::VirtualTexture(uint16_t id, size_t maxResidentPages)
+    : id(id)
+    , maxResidentPages(std::max<size_t>(maxResidentPages, 1)) {}
+
+bool VirtualTexture::Open(const std::string& filename) {
+    this->filename = filename;
+    this->file.open(filename, std::ios::binary);
+    if (!this->file) {
+        std::cerr << "Opening virtual texture " << filename << " failed." << std::endl;
+        return false;
+    }
+
+    this->file.seekg(0, std::ios::end);
+    const uint64_t fileSize = static_cast<uint64_t>(this->file.tellg());
+    this->file.seekg(0);
+
+    // the header is checked before its level count sizes anything
+    this->file.read(reinterpret_cast<char*>(&this->header), sizeof(FileHeader));
+    const uint32_t tileSize = this->header.tileSize;
+    if (!this->file || std::memcmp(this->header.magic, VTEX_MAGIC, sizeof(VTEX_MAGIC)) != 0
+        || this->header.levelCount == 0 || this->header.levelCount > VTEX_MAX_LEVELS || tileSize < VTEX_MIN_TILE
+        || tileSize > VTEX_MAX_TILE || (tileSize & (tileSize - 1)) != 0) {
+        std::cerr << filename << " is not a baked virtual texture." << std::endl;
+        this->header = {};
+        return false;
+    }
+
+    this->levels.resize(this->header.levelCount);
+    this->file.read(reinterpret_cast<char*>(this->levels.data()), this->levels.size() * sizeof(LevelInfo));
+    if (!this->file || !this->ValidLayout(fileSize)) {
+        std::cerr << filename << " is a corrupt or truncated virtual texture." << std::endl;
+        this->header = {};
+        this->levels.clear();
+        return false;
+    }
+
+    this->pageTable.clear();
+    for (const LevelInfo& info : this->levels)
+        this->pageTable.emplace_back(static_cast<size_t>(info.tilesX) * info.tilesY, NOT_RESIDENT);
+
+    // The coarsest level stays resident so that every sample has a fallback
+    uint16_t coarsest = static_cast<uint16_t>(this->header.levelCount - 1);
+    return this->LoadPage({ this->id, coarsest, 0, 0 }, true);
+}
+
+bool VirtualTexture::ValidLayout(uint64_t fileSize) const {
+    const uint64_t tileSize = this->header.tileSize;
+    const uint64_t tileBytes = tileSize * tileSize * sizeof(Color);
+    const uint64_t tilesStart = sizeof(FileHeader) + this->levels.size() * sizeof(LevelInfo);
+    for (size_t l = 0; l != this->levels.size(); ++l) {
+        const LevelInfo& info = this->levels[l];
+        // level 0 is the image, and every level after it halves the one before, as Bake writes them
+        const uint32_t width = l == 0 ? this->header.width : std::max(1u, this->levels[l - 1].width / 2);
+        const uint32_t height = l == 0 ? this->header.height : std::max(1u, this->levels[l - 1].height / 2);
+        if (info.width == 0 || info.height == 0 || info.width != width || info.height != height) return false;
+        if (info.tilesX != (info.width + tileSize - 1) / tileSize
+            || info.tilesY != (info.height + tileSize - 1) / tileSize)
+            return false;
+        // page coordinates are 16-bit in requests
+        if (info.tilesX > UINT16_MAX + 1u || info.tilesY > UINT16_MAX + 1u) return false;
+
+        // the level's pages follow the descriptors and end within the file; sizes are far from overflowing here
+        const uint64_t levelBytes = static_cast<uint64_t>(info.tilesX) * info.tilesY * tileBytes;
+        if (info.offset < tilesStart || info.offset > fileSize || levelBytes > fileSize - info.offset) return false;
+    }
+    // the coarsest level is the single page kept resident
+    const LevelInfo& coarsest = this->levels.back();
+    return coarsest.tilesX == 1 && coarsest.tilesY == 1;
+}
+
+float VirtualTexture::LevelFromDepth(float depth) const {
+    if (this->header.levelCount == 0) return 0.f;
+    float t = std::clamp((1.f - depth) * 0.5f, 0.f, 1.f);
+    return t * static_cast<float>(this->header.levelCount - 1);
+}
+
+Color VirtualTexture::Sample(glm::vec2 tex_coord, float level) {
+    if (this->levels.empty()) return Color::Black;
+
+    const uint32_t tileSize = this->header.tileSize;
+    const uint32_t target = std::min(static_cast<uint32_t>(std::max(level + 0.5f, 0.f)), this->header.levelCount - 1);
+    const float u = std::clamp(tex_coord.x, 0.f, 1.f);
+    const float v = std::clamp(tex_coord.y, 0.f, 1.f);
+
+    for (uint32_t l = target; l < this->header.levelCount; ++l) {
+        const LevelInfo& info = this->levels[l];
+        uint32_t x = std::min(static_cast<uint32_t>(u * info.width), info.width - 1);
+        uint32_t y = std::min(static_cast<uint32_t>(v * info.height), info.height - 1);
+        uint32_t tileX = x / tileSize, tileY = y / tileSize;
+
+        int32_t slot = this->pageTable[l][tileY * info.tilesX + tileX];
+        if (slot != NOT_RESIDENT) {
+            this->slots[slot].lastUsed = std::max(this->slots[slot].lastUsed, this->frame);
+            return this->pool[static_cast<size_t>(slot) * tileSize * tileSize + (y % tileSize) * tileSize
+                              + x % tileSize];
+        }
+        if (l == target)
+            this->RecordRequest(
+              { this->id, static_cast<uint16_t>(l), static_cast<uint16_t>(tileX), static_cast<uint16_t>(tileY) });
+    }
+    return Color::Black;   // unreachable once opened: the coarsest level is pinned
+}
+
+void VirtualTexture::RecordRequest(const PageRequest& request) {
+    uint64_t key = request.Key();
+    if (key == this->lastRequestedKey) return;   // neighbouring pixels mostly hit the same page
+    this->lastRequestedKey = key;
+    if (this->requestedKeys.insert(key).second) this->feedback.push_back(request);
+}
+
+size_t VirtualTexture::StreamRequestedPages() {
+    // read in file order so that the seeks stay mostly forward
+    std::sort(this->feedback.begin(), this->feedback.end(), [](const PageRequest& a, const PageRequest& b) {
+        return a.Key() < b.Key();
+    });
+
+    size_t loaded = 0;
+    for (const PageRequest& request : this->feedback) {
+        if (this->pageTable[request.level][request.tileY * this->levels[request.level].tilesX + request.tileX]
+            != NOT_RESIDENT)
+            continue;
+        if (!this->LoadPage(request, false)) {
+            std::cerr << "[WARNING] virtual texture page budget exhausted; falling back to coarser levels\n";
+            break;
+        }
+        ++loaded;
+    }
+
+    this->feedback.clear();
+    this->requestedKeys.clear();
+    this->lastRequestedKey = UINT64_MAX;
+    ++this->frame;
+    return loaded;
+}
+
+int32_t VirtualTexture::AcquireSlot() {
+    if (!this->freeSlots.empty()) {
+        int32_t slot = this->freeSlots.back();
+        this->freeSlots.pop_back();
+        return slot;
+    }
+    if (this->slots.size() < this->maxResidentPages) {
+        this->slots.push_back({ 0, 0, false });
+        this->pool.resize(this->slots.size() * this->header.tileSize * this->header.tileSize);
+        return static_cast<int32_t>(this->slots.size() - 1);
+    }
+
+    // evict the least recently used page that was not loaded by the current streaming batch
+    int32_t victim = NOT_RESIDENT;
+    for (size_t i = 0; i != this->slots.size(); ++i) {
+        const Slot& slot = this->slots[i];
+        if (slot.pinned || slot.lastUsed > this->frame) continue;
+        if (victim == NOT_RESIDENT || slot.lastUsed < this->slots[victim].lastUsed) victim = static_cast<int32_t>(i);
+    }
+    if (victim == NOT_RESIDENT) return NOT_RESIDENT;
+
+    uint64_t key = this->slots[victim].key;
+    uint32_t level = (key >> 32) & 0xFFFF, tileY = (key >> 16) & 0xFFFF, tileX = key & 0xFFFF;
+    this->pageTable[level][tileY * this->levels[level].tilesX + tileX] = NOT_RESIDENT;
+    --this->residentCount;
+    return victim;
+}
+
+bool VirtualTexture::LoadPage(const PageRequest& request, bool pinned) {
+    int32_t slot = this->AcquireSlot();
+    if (slot == NOT_RESIDENT) return false;
+
+    const LevelInfo& info = this->levels[request.level];
+    uint64_t page = static_cast<uint64_t>(request.tileY) * info.tilesX + request.tileX;
+    uint64_t offset = info.offset + page * this->PageBytes();
+    this->file.clear();
+    this->file.seekg(static_cast<std::streamoff>(offset));
+    this->file.read(reinterpret_cast<char*>(&this->pool[static_cast<size_t>(slot) * this->header.tileSize
+                                                        * this->header.tileSize]),
+                    this->PageBytes());
+    if (!this->file) {
+        std::cerr << "Reading page from " << this->filename << " failed." << std::endl;
+        this->freeSlots.push_back(slot);
+        return false;
+    }
+
+    this->slots[slot] = { request.Key(), this->frame + 1, pinned };
+    this->pageTable[request.level][request.tileY * info.tilesX + request.tileX] = slot;
+    ++this->residentCount;
+    this->peakResidentCount = std::max(this->peakResidentCount, this->residentCount);
+    return true;
+}
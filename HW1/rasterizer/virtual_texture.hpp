@@ -0,0 +1,122 @@
+// Sparse (virtual) texture with per-page residency and sampling feedback
+
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "../thirdparty/glm/glm.hpp"
+#include "image.hpp"
+
+// Tile sizes a baked file may use: powers of two in this range
+constexpr uint32_t VTEX_MIN_TILE = 8;
+constexpr uint32_t VTEX_MAX_TILE = 4096;
+// Mip levels a baked file may have; a 2^32 texel wide image halves down to one tile in fewer
+constexpr uint32_t VTEX_MAX_LEVELS = 32;
+
+// A page is one tile of one mip level of one texture
+struct PageRequest {
+    uint16_t texture;
+    uint16_t level;
+    uint16_t tileX;
+    uint16_t tileY;
+
+    inline uint64_t Key() const {
+        return (static_cast<uint64_t>(texture) << 48) | (static_cast<uint64_t>(level) << 32)
+             | (static_cast<uint64_t>(tileY) << 16) | static_cast<uint64_t>(tileX);
+    }
+};
+
+class VirtualTexture {
+public:
+    // Tiled file layout: header, per-level descriptors, then every level's tiles row by row.
+    //   Tiles are tileSize x tileSize RGBA8 texels (edge tiles are padded by clamping), and row 0 of a level is
+    //   the bottom row of the image so that tex_coord (0, 0) is the bottom-left corner like in the obj files.
+    struct FileHeader {
+        char magic[4];
+        uint32_t width;
+        uint32_t height;
+        uint32_t tileSize;
+        uint32_t levelCount;
+    };
+
+    struct LevelInfo {
+        uint32_t width;
+        uint32_t height;
+        uint32_t tilesX;
+        uint32_t tilesY;
+        uint64_t offset;   // byte offset of the first tile of this level in the file
+    };
+
+    // Convert an image file readable by stb_image into a pre-tiled mip chain at output_file
+    static bool Bake(const std::string& image_file, const std::string& output_file, uint32_t tileSize = 128);
+
+    VirtualTexture(uint16_t id = 0, size_t maxResidentPages = 1024);
+
+    // Read the header of a baked file and make the coarsest level (a single tile) resident
+    bool Open(const std::string& filename);
+
+    // Sample the texture at tex_coord in [0,1] using the requested (fractional) mip level. The page covering the
+    //   texel at the requested level is recorded in the feedback buffer; if it is not resident, the closest coarser
+    //   resident level is used instead.
+    Color Sample(glm::vec2 tex_coord, float level);
+
+    // Map a depth value in [-1, 1] onto the mip chain (nearer is finer)
+    float LevelFromDepth(float depth) const;
+
+    // Load every page recorded in the feedback buffer since the last call, evicting the least recently requested
+    //   pages when the residency budget is exceeded. Returns the number of pages read from disk.
+    size_t StreamRequestedPages();
+
+    inline bool HasPendingRequests() const { return !this->feedback.empty(); }
+    inline uint32_t GetLevelCount() const { return this->header.levelCount; }
+    inline size_t GetResidentPageCount() const { return this->residentCount; }
+    inline size_t GetResidentBytes() const { return this->residentCount * this->PageBytes(); }
+    inline size_t GetPeakResidentBytes() const { return this->peakResidentCount * this->PageBytes(); }
+
+private:
+    static constexpr int32_t NOT_RESIDENT = -1;
+
+    struct Slot {
+        uint64_t key;
+        uint32_t lastUsed;
+        bool pinned;
+    };
+
+    uint16_t id;
+    size_t maxResidentPages;
+    std::string filename;
+    std::ifstream file;
+    FileHeader header {};
+    std::vector<LevelInfo> levels;
+
+    // pageTable[level][tileY * tilesX + tileX] is a slot index into pool, or NOT_RESIDENT
+    std::vector<std::vector<int32_t>> pageTable;
+    std::vector<Slot> slots;
+    std::vector<Color> pool;
+    std::vector<int32_t> freeSlots;
+    size_t residentCount = 0;
+    size_t peakResidentCount = 0;
+    uint32_t frame = 0;
+
+    // Page requests recorded by Sample; one entry per distinct page (requestedKeys de-duplicates)
+    std::vector<PageRequest> feedback;
+    std::unordered_set<uint64_t> requestedKeys;
+    uint64_t lastRequestedKey = UINT64_MAX;
+
+    inline size_t PageBytes() const {
+        return static_cast<size_t>(this->header.tileSize) * this->header.tileSize * sizeof(Color);
+    }
+
+    // Whether the header and level descriptors describe the chain Bake writes, within a file of `fileSize` bytes
+    bool ValidLayout(uint64_t fileSize) const;
+    void RecordRequest(const PageRequest& request);
+    bool LoadPage(const PageRequest& request, bool pinned);
+    int32_t AcquireSlot();
+};
+
+#endif
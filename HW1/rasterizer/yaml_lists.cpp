@@ -0,0 +1,191 @@
+#include "yaml_lists.hpp"
+
+#include <charconv>
+
+namespace {
+
+bool IsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+bool IsKeyChar(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || IsDigit(c) || c == '_';
+}
+
+// The next line of `text` from `pos`, without its `\n`; `pos` moves past it. A `\r` stays in the line and fails
+//     the scan, as the YAML parser does not take CRLF configs either.
+std::string_view NextLine(std::string_view text, size_t& pos) {
+    const size_t end = text.find('\n', pos);
+    const std::string_view line
+      = text.substr(pos, end == std::string_view::npos ? std::string_view::npos : end - pos);
+    pos = end == std::string_view::npos ? text.size() : end + 1;
+    return line;
+}
+
+size_t SkipSpaces(std::string_view s, size_t i) {
+    while (i < s.size() && s[i] == ' ') ++i;
+    return i;
+}
+
+// Nothing but spaces and maybe a comment from `i` on
+bool RestIsBlank(std::string_view s, size_t i) {
+    i = SkipSpaces(s, i);
+    return i == s.size() || s[i] == '#';
+}
+
+// A number the YAML parser reads as a float, `-?(0|[1-9][0-9]*)\.[0-9]+([eE][+-]?[0-9]+)?`, or as an integer,
+//     `0|[1-9][0-9]*`; anything else (signs on integers, leading zeros, `.5`, `1.`, `.inf`) is left to it
+bool ParseNumber(std::string_view token, double& value, bool& isFloat) {
+    size_t i = 0;
+    const bool negative = i < token.size() && token[i] == '-';
+    if (negative) ++i;
+    const size_t intStart = i;
+    while (i < token.size() && IsDigit(token[i])) ++i;
+    if (i == intStart || (token[intStart] == '0' && i - intStart > 1)) return false;
+    isFloat = i < token.size() && token[i] == '.';
+    if (isFloat) {
+        const size_t fracStart = ++i;
+        while (i < token.size() && IsDigit(token[i])) ++i;
+        if (i == fracStart) return false;
+        if (i < token.size() && (token[i] == 'e' || token[i] == 'E')) {
+            ++i;
+            if (i < token.size() && (token[i] == '+' || token[i] == '-')) ++i;
+            const size_t expStart = i;
+            while (i < token.size() && IsDigit(token[i])) ++i;
+            if (i == expStart) return false;
+        }
+    } else if (negative) {
+        return false;
+    }
+    if (i != token.size()) return false;
+    // parsed as a double like the YAML parser does, so the float it is narrowed to is the same
+    return std::from_chars(token.data(), token.data() + token.size(), value).ec == std::errc();
+}
+
+// `key: value` at the start of `s`, appended to `item`
+bool ParseField(std::string_view s, YamlListItem& item) {
+    if (item.fieldCount == YAML_ITEM_FIELDS) return false;
+    size_t i = 0;
+    while (i < s.size() && IsKeyChar(s[i])) ++i;
+    if (i == 0 || i + 1 >= s.size() || s[i] != ':' || s[i + 1] != ' ') return false;   // a nested block otherwise
+    YamlListField& field = item.fields[item.fieldCount];
+    field.key = s.substr(0, i);
+    if (item.Find(field.key)) return false;
+    i = SkipSpaces(s, i + 1);
+
+    // a plain scalar runs to the next space, or in a flow sequence also to the next `,` or `]`
+    auto token = [&](bool flow) {
+        const size_t start = i;
+        while (i < s.size() && s[i] != ' ' && !(flow && (s[i] == ',' || s[i] == ']'))) ++i;
+        return s.substr(start, i - start);
+    };
+    field.count = 0;
+    field.sequence = i < s.size() && s[i] == '[';
+    if (field.sequence) {
+        for (++i;;) {
+            i = SkipSpaces(s, i);
+            if (field.count == YAML_FIELD_VALUES
+                || !ParseNumber(token(true), field.values[field.count], field.isFloat[field.count]))
+                return false;
+            ++field.count;
+            i = SkipSpaces(s, i);
+            if (i < s.size() && s[i] == ',') {
+                ++i;
+                continue;
+            }
+            if (i < s.size() && s[i] == ']') break;
+            return false;
+        }
+        ++i;
+    } else {
+        if (!ParseNumber(token(false), field.values[0], field.isFloat[0])) return false;
+        field.count = 1;
+    }
+    if (!RestIsBlank(s, i)) return false;
+    ++item.fieldCount;
+    return true;
+}
+
+}   // namespace
+
+bool YamlListField::Floats(uint32_t n) const {
+    if (!this->sequence || this->count < n) return false;
+    for (uint32_t i = 0; i < n; ++i)
+        if (!this->isFloat[i]) return false;
+    return true;
+}
+
+bool YamlListField::Integers(uint32_t n) const {
+    if (!this->sequence || this->count < n) return false;
+    for (uint32_t i = 0; i < n; ++i)
+        if (this->isFloat[i]) return false;
+    return true;
+}
+
+const YamlListField* YamlListItem::Find(std::string_view key) const {
+    for (uint32_t i = 0; i < this->fieldCount; ++i)
+        if (this->fields[i].key == key) return &this->fields[i];
+    return nullptr;
+}
+
+std::optional<YamlBlock> FindYamlBlock(std::string_view text, std::string_view key) {
+    std::optional<YamlBlock> found;
+    for (size_t pos = 0; pos < text.size();) {
+        const size_t begin = pos;
+        const std::string_view line = NextLine(text, pos);
+        if (line.size() <= key.size() || line.substr(0, key.size()) != key || line[key.size()] != ':'
+            || !RestIsBlank(line, key.size() + 1))
+            continue;
+        if (found) return std::nullopt;   // left to the YAML parser to complain about
+
+        // indented lines, comments, blank lines and `- ` items at the key's own indentation belong to the block
+        size_t end = pos;
+        while (end < text.size()) {
+            size_t next = end;
+            const std::string_view content = NextLine(text, next);
+            const bool item = !content.empty() && content[0] == '-' && (content.size() == 1 || content[1] == ' ');
+            if (!content.empty() && content[0] != ' ' && content[0] != '#' && !item) break;
+            end = next;
+        }
+        found = YamlBlock { begin, end };
+        pos = end;
+    }
+    return found;
+}
+
+bool ScanYamlList(std::string_view block, const std::function<bool(const YamlListItem&)>& item) {
+    size_t pos = 0;
+    NextLine(block, pos);   // the key
+
+    YamlListItem current;
+    bool open = false;
+    size_t items = 0;
+    size_t dashIndent = std::string_view::npos, fieldIndent = std::string_view::npos;
+    while (pos < block.size()) {
+        const std::string_view line = NextLine(block, pos);
+        const size_t indent = SkipSpaces(line, 0);
+        if (indent == line.size() || line[indent] == '#') continue;
+        if (line[indent] == '\t') return false;
+
+        const std::string_view content = line.substr(indent);
+        if (content[0] == '-' && (content.size() == 1 || content[1] == ' ')) {
+            if (dashIndent == std::string_view::npos) dashIndent = indent;
+            if (indent != dashIndent) return false;
+            if (open && !item(current)) return false;
+            current.fieldCount = 0;
+            open = true;
+            ++items;
+            // the first field may share the line with the dash
+            const size_t first = SkipSpaces(line, indent + 1);
+            fieldIndent = std::string_view::npos;
+            if (RestIsBlank(line, first)) continue;
+            fieldIndent = first;
+            if (!ParseField(line.substr(first), current)) return false;
+            continue;
+        }
+        if (!open || indent <= dashIndent) return false;
+        if (fieldIndent == std::string_view::npos) fieldIndent = indent;
+        if (indent != fieldIndent || !ParseField(content, current)) return false;
+    }
+    return open && item(current) && items != 0;
+}
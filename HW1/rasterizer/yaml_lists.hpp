@@ -0,0 +1,54 @@
+// Direct scanner for the long lists of a config (`transforms`, `lights`): their items are read straight into the
+//     loader's arrays instead of through a YAML node per key and number. It only takes the plain layout the sample
+//     configs use and leaves anything else to the full YAML parser, so both accept and reject the same configs.
+
+#ifndef YAML_LISTS_H
+#define YAML_LISTS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string_view>
+
+// Fields and numbers per item the scanner holds; an item with more falls back to the full parser
+constexpr uint32_t YAML_ITEM_FIELDS = 8;
+constexpr uint32_t YAML_FIELD_VALUES = 8;
+
+// One `key: value` line of an item. The value is a number or a one-line flow sequence `[a, b, ...]` of numbers,
+//     each typed the way the YAML parser types it: a float has a fraction (`1.0`, `-2.5e-3`), an integer has none
+//     and no sign (`255`).
+struct YamlListField {
+    std::string_view key;
+    bool sequence = false;
+    uint32_t count = 0;
+    double values[YAML_FIELD_VALUES];
+    bool isFloat[YAML_FIELD_VALUES];
+
+    // A sequence whose first `n` numbers are floats (or integers)
+    bool Floats(uint32_t n) const;
+    bool Integers(uint32_t n) const;
+};
+
+struct YamlListItem {
+    uint32_t fieldCount = 0;
+    YamlListField fields[YAML_ITEM_FIELDS];
+
+    const YamlListField* Find(std::string_view key) const;   // nullptr when absent
+};
+
+// Where a top-level `key:` and the indented block under it are in a config, as [begin, end) byte offsets
+struct YamlBlock {
+    size_t begin;
+    size_t end;
+};
+
+// The block under `key`, or nothing when the key is missing, appears more than once or is not followed by a block
+std::optional<YamlBlock> FindYamlBlock(std::string_view text, std::string_view key);
+
+// Call `item` for every item of the block sequence in `block` (a FindYamlBlock range, key line included). Returns
+//     false as soon as the block uses anything the scanner does not take or `item` returns false, in which case
+//     the items handed out so far must be dropped and the block parsed as YAML.
+bool ScanYamlList(std::string_view block, const std::function<bool(const YamlListItem&)>& item);
+
+#endif